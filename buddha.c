@@ -1,15 +1,37 @@
+#include <math.h>
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
 
 #include "buddha.h"
+#include "image.h"
 
 
-plot_t plot_init(complex center, double width, double height, int rows, int cols){
-	size_t sz = sizeof(unsigned int) * rows * cols;
-	unsigned int *grid = malloc(sz);
-	memset(grid, 0, sz);
+// Number of tiles across the rows and columns of a sparse plot
+#define tile_rows(p) (((p).area.rows + PLOT_TILE_SIZE - 1) >> PLOT_TILE_BITS)
+#define tile_cols(p) (((p).area.columns + PLOT_TILE_SIZE - 1) >> PLOT_TILE_BITS)
+
+// Number of bytes in the dense grid of a plot
+#define grid_bytes(p) (sizeof(unsigned int) * (p).channels * (p).area.rows * (p).area.columns)
+
+// Map zeroed memory for a dense grid, asking for it to be backed by huge pages
+// Points land all over the plot, so with small pages nearly every point added to a large plot also misses the TLB
+// Returns NULL if the memory could not be mapped
+static unsigned int *grid_map(size_t bytes){
+	void *grid = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(grid == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+	madvise(grid, bytes, MADV_HUGEPAGE);  // Only a hint, the grid works the same without it
+#endif
+	return grid;
+}
+
+static plot_t plot_create(complex center, double width, double height, int rows, int cols, int channels, const range_t *ranges, bool sparse){
+	range_t *rngs = malloc(sizeof(range_t) * channels);
+	memcpy(rngs, ranges, sizeof(range_t) * channels);
 	
 	plot_t pl = {
 		{
@@ -17,36 +39,231 @@ plot_t plot_init(complex center, double width, double height, int rows, int cols
 			width, height,
 			rows, cols
 		},
-		grid
+		channels, rngs,
+		NULL, NULL
 	};
+	
+	if(sparse) pl.tiles = calloc((size_t)channels * tile_rows(pl) * tile_cols(pl), sizeof(plot_tile_t));
+	else pl.grid = grid_map(grid_bytes(pl));
 	return pl;
 }
 
+plot_t plot_init(complex center, double width, double height, int rows, int cols, int channels, const range_t *ranges){
+	return plot_create(center, width, height, rows, cols, channels, ranges, false);
+}
+
+plot_t plot_init_sparse(complex center, double width, double height, int rows, int cols, int channels, const range_t *ranges){
+	return plot_create(center, width, height, rows, cols, channels, ranges, true);
+}
+
 void plot_clear(plot_t pl){
-	memset(pl.grid, 0, sizeof(unsigned int) * pl.area.rows * pl.area.columns);
+	if(pl.grid) memset(pl.grid, 0, grid_bytes(pl));
+	else{
+		// Tiles are released so that they are only allocated again once touched
+		size_t count = (size_t)pl.channels * tile_rows(pl) * tile_cols(pl);
+		for(size_t i = 0; i < count; i++){
+			free(pl.tiles[i].counts);
+			pl.tiles[i] = (plot_tile_t){0, NULL};
+		}
+	}
+}
+
+void plot_sum(plot_t pl, plot_t part){
+	if(pl.grid && part.grid){
+		size_t count = (size_t)pl.channels * pl.area.rows * pl.area.columns;
+		for(size_t i = 0; i < count; i++) pl.grid[i] += part.grid[i];
+		return;
+	}
+	
+	unsigned int n;
+	for(int ch = 0; ch < pl.channels; ch++) for(int r = 0; r < pl.area.rows; r++) for(int c = 0; c < pl.area.columns; c++){
+		if((n = plotch(part, ch, r, c)) > 0) plotadd(pl, ch, r, c, n);
+	}
 }
 
 void plot_free(plot_t pl){
-	free(pl.grid);
+	if(pl.tiles) plot_clear(pl);
+	if(pl.grid) munmap(pl.grid, grid_bytes(pl));
+	free(pl.tiles);
+	free(pl.ranges);
+}
+
+
+
+// Find the tile of a sparse plot holding the bin and the index of the bin within it
+static plot_tile_t *plot_tile(const plot_t *pl, int ch, int r, int c, int *idx){
+	*idx = (r & (PLOT_TILE_SIZE - 1)) << PLOT_TILE_BITS | (c & (PLOT_TILE_SIZE - 1));
+	return pl->tiles + ((size_t)ch * tile_rows(*pl) + (r >> PLOT_TILE_BITS)) * tile_cols(*pl) + (c >> PLOT_TILE_BITS);
+}
+
+static unsigned int tile_count(const plot_tile_t *tl, int idx){
+	switch(tl->width){
+		case 1: return ((unsigned char *)tl->counts)[idx];
+		case 2: return ((unsigned short *)tl->counts)[idx];
+		case 4: return ((unsigned int *)tl->counts)[idx];
+		default: return 0;
+	}
+}
+
+unsigned int plot_tile_get(const plot_t *pl, int ch, int r, int c){
+	int idx;
+	plot_tile_t *tl = plot_tile(pl, ch, r, c, &idx);
+	return tile_count(tl, idx);
+}
+
+void plot_tile_add(const plot_t *pl, int ch, int r, int c, unsigned int n){
+	int idx;
+	plot_tile_t *tl = plot_tile(pl, ch, r, c, &idx);
+	unsigned int val = tile_count(tl, idx) + n;
+	
+	// Widen the counts of the tile until they can hold the new value
+	int width = val > 0xffff ? 4 : val > 0xff ? 2 : 1;
+	if(width > tl->width){
+		void *counts = malloc((size_t)width * PLOT_TILE_SIZE * PLOT_TILE_SIZE);
+		if(!counts) return;
+		if(width == 1) memset(counts, 0, PLOT_TILE_SIZE * PLOT_TILE_SIZE);
+		else for(int i = 0; i < PLOT_TILE_SIZE * PLOT_TILE_SIZE; i++){
+			if(width == 2) ((unsigned short *)counts)[i] = tile_count(tl, i);
+			else ((unsigned int *)counts)[i] = tile_count(tl, i);
+		}
+		
+		free(tl->counts);
+		tl->counts = counts;
+		tl->width = width;
+	}
+	
+	switch(tl->width){
+		case 1: ((unsigned char *)tl->counts)[idx] = val;
+		break;
+		case 2: ((unsigned short *)tl->counts)[idx] = val;
+		break;
+		case 4: ((unsigned int *)tl->counts)[idx] = val;
+		break;
+	}
 }
 
 
 
-unsigned int plot_max(plot_t pl){
+unsigned int plot_max(plot_t pl, int ch){
 	int r, c;
 	unsigned int tmp, max = 0;
+	
+	// Only the allocated tiles of sparse plots can hold anything
+	if(pl.tiles){
+		plot_tile_t *tl = pl.tiles + (size_t)ch * tile_rows(pl) * tile_cols(pl);
+		for(int i = 0; i < tile_rows(pl) * tile_cols(pl); i++) if(tl[i].counts){
+			for(int j = 0; j < PLOT_TILE_SIZE * PLOT_TILE_SIZE; j++){
+				tmp = tile_count(tl + i, j);
+				max = tmp > max ? tmp : max;
+			}
+		}
+		return max;
+	}
+	
 	for(r = 0; r < pl.area.rows; r++) for(c = 0; c < pl.area.columns; c++){
-		tmp = plotat(pl, r, c);
+		tmp = plotch(pl, ch, r, c);
 		max = tmp > max ? tmp : max;
 	}
 	
 	return max;
 }
 
-unsigned int *plot_atcmp(plot_t pl, complex pt){
+unsigned int plot_atcmp(plot_t pl, complex pt){
 	int r, c;
-	if(comp_to_rc(pl.area, pt, &r, &c)) return &plotat(pl, r, c);
-	else return NULL;
+	if(comp_to_rc(pl.area, pt, &r, &c)) return plotat(pl, r, c);
+	else return 0;
+}
+
+
+
+const char *tone_curve_names[] = {"gamma", "log", "equalize"};
+
+bool tone_curve_parse(const char *name, tone_curve_t *curve){
+	for(int i = 0; i <= TONE_EQUALIZE; i++){
+		if(strcmp(tone_curve_names[i], name) == 0){
+			*curve = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+tone_t tone_init(tone_curve_t curve){
+	tone_t tn = {curve, 0, NULL, malloc(sizeof(unsigned short) * TONE_BUCKETS)};
+	if(curve == TONE_EQUALIZE && tn.lut){
+		tn.hist = calloc(TONE_BUCKETS, sizeof(unsigned int));
+		if(!tn.hist){
+			free(tn.lut);
+			tn.lut = NULL;
+		}
+	}
+	return tn;
+}
+
+void tone_free(tone_t tn){
+	free(tn.hist);
+	free(tn.lut);
+}
+
+bool tone_reset(tone_t *tn, tone_curve_t curve){
+	if(curve != TONE_EQUALIZE){
+		free(tn->hist);
+		tn->hist = NULL;
+	}else if(tn->hist){
+		// Buckets above that of the last max were never added to
+		memset(tn->hist, 0, sizeof(unsigned int) * (tone_bucket(tn->max) + 1));
+	}else if(!(tn->hist = calloc(TONE_BUCKETS, sizeof(unsigned int)))){
+		return false;
+	}
+	
+	tn->curve = curve;
+	tn->max = 0;
+	return true;
+}
+
+// Count in the middle of bucket i
+static double tone_count(unsigned int i){
+	if(i < (1u << TONE_BITS)) return i;
+	
+	// Buckets above keep the leading TONE_BITS bits of their counts
+	int shift = (i >> (TONE_BITS - 1)) - 1;
+	unsigned int lead = i - ((unsigned int)shift << (TONE_BITS - 1));
+	return ldexp(lead, shift) + ldexp(0.5, shift) - 0.5;
+}
+
+void tone_build(tone_t *tn, double gamma, unsigned int levels){
+	unsigned int top = tone_bucket(tn->max), i;
+	tn->lut[0] = 0;
+	if(tn->max == 0) return;
+	
+	// Equalization ranks the buckets by the bins at or below them, leaving out the empty bins
+	double below = 0, total = 0, scl;
+	if(tn->curve == TONE_EQUALIZE) for(i = 1; i <= top; i++) total += tn->hist[i];
+	
+	// The bucket of max is taken at max itself so that it reaches full brightness
+	double logmax = log1p(tn->max), n;
+	for(i = 1; i <= top; i++){
+		n = i < top ? tone_count(i) : tn->max;
+		if(tn->curve == TONE_LOG) scl = log1p(n) / logmax;
+		else if(tn->curve == TONE_EQUALIZE) scl = (below += tn->hist[i]) / total;
+		else scl = n / tn->max;
+		tn->lut[i] = (unsigned short)(pow(scl, gamma) * levels);
+	}
+}
+
+void tone_map(const tone_t *tn, unsigned int *counts, size_t count){
+	// Find every bucket first in a loop simple enough to be vectorized, then gather the brightnesses
+	// The shift of tone_bucket is read from the exponent of a float, which holds the count exactly once its low 8 bits are dropped
+	float f;
+	int bits, shift;
+	for(size_t i = 0; i < count; i++){
+		f = (float)(int)(counts[i] >> 8);
+		memcpy(&bits, &f, sizeof(bits));
+		shift = (bits >> 23) - 127 + 9 - TONE_BITS;
+		shift = shift > 0 ? shift : 0;
+		counts[i] = ((unsigned int)shift << (TONE_BITS - 1)) + (counts[i] >> shift);
+	}
+	for(size_t i = 0; i < count; i++) counts[i] = tn->lut[counts[i]];
 }
 
 
@@ -58,30 +275,669 @@ complex view_gener(viewport_t vw){
 	;
 }
 
-int plot_rand(plot_t pl, viewport_t farm, fractal_t rule, int min, int max, int numpts){
+complex view_gener_r(viewport_t vw, unsigned int *seed){
+	return vw.corner
+		+ ((double)rand_r(seed) * vw.width / RAND_MAX)
+		- ((double)rand_r(seed) * vw.height * I / RAND_MAX)
+	;
+}
+
+farm_t farm_init(viewport_t area){
+	area.rows = area.columns = 1;
+	farm_t fm = {area, 1, NULL, NULL};
+	return fm;
+}
+
+void farm_free(farm_t fm){
+	free(fm.cells);
+}
+
+// Classes of params according to the length of their orbits
+#define FARM_EARLY 1  // Escapes before any channel accepts it
+#define FARM_ACCEPTED 2  // Escapes within the range of some channel
+#define FARM_INSIDE 4  // Never escapes within the longest range
+
+static int farm_class(frc_kernel_t kern, fractal_t *rule, complex pt, int min, int max){
+	rule->param = pt;
+	int i = kern(rule, &pt, max, NULL, 0);
+	return i < 0 ? FARM_INSIDE : i <= min ? FARM_EARLY : FARM_ACCEPTED;
+}
+
+// Classify params on the corners and centers of the cells of the grid over area, then list the kept cells
+static farm_t farm_grid(fractal_t rule, int channels, const range_t *ranges, viewport_t area, bool anti){
+	int rows = area.rows, cols = area.columns;
+	int min = ranges[0].min, max = ranges[0].max, ch, r, c, i;
+	for(ch = 1; ch < channels; ch++){
+		if(ranges[ch].min < min) min = ranges[ch].min;
+		if(ranges[ch].max > max) max = ranges[ch].max;
+	}
+	
+	unsigned char *corner = malloc((size_t)(rows + 1) * (cols + 1));
+	unsigned char *cls = malloc((size_t)rows * cols);
+	bool *kept = calloc((size_t)rows * cols, sizeof(bool));
+	int *cells = malloc(sizeof(int) * rows * cols);
+	farm_t fm = {area, 0, cells, NULL};
+	if(!corner || !cls || !kept || !cells){
+		free(corner);
+		free(cls);
+		free(kept);
+		free(cells);
+		return farm_init(area);
+	}
+	
+	frc_kernel_t kern = frc_select(&rule);
+	double cw = area.width / cols, chh = area.height / rows;
+	
+	// Class of the param at each corner, then combined with the center for each cell
+	for(r = 0; r <= rows; r++) for(c = 0; c <= cols; c++){
+		corner[r * (cols + 1) + c] = farm_class(kern, &rule, area.corner + c * cw - r * chh * I, min, max);
+	}
+	for(r = 0; r < rows; r++) for(c = 0; c < cols; c++){
+		cls[r * cols + c] = farm_class(kern, &rule, area.corner + (c + 0.5) * cw - (r + 0.5) * chh * I, min, max)
+			| corner[r * (cols + 1) + c] | corner[r * (cols + 1) + c + 1]
+			| corner[(r + 1) * (cols + 1) + c] | corner[(r + 1) * (cols + 1) + c + 1];
+	}
+	
+	// Keep cells which might hold accepted params along with their neighbors
+	// Only params which never escape are accepted when plotting the anti-Buddhabrot
+	int dr, dc;
+	for(r = 0; r < rows; r++) for(c = 0; c < cols; c++){
+		i = cls[r * cols + c];
+		if(anti ? !(i & FARM_INSIDE) : !(i & FARM_ACCEPTED) && (i & (FARM_EARLY | FARM_INSIDE)) != (FARM_EARLY | FARM_INSIDE)) continue;
+		for(dr = -1; dr <= 1; dr++) for(dc = -1; dc <= 1; dc++){
+			if(0 <= r + dr && r + dr < rows && 0 <= c + dc && c + dc < cols) kept[(r + dr) * cols + c + dc] = true;
+		}
+	}
+	for(i = 0; i < rows * cols; i++) if(kept[i]) cells[fm.count++] = i;
+	
+	free(corner);
+	free(cls);
+	free(kept);
+	
+	// Sample the whole area rather than nothing if no cell was kept
+	if(fm.count == 0){
+		free(cells);
+		return farm_init(area);
+	}
+	return fm;
+}
+
+farm_t farm_fit(fractal_t rule, int channels, const range_t *ranges, int size, bool anti){
+	// Any param outside of the radius escapes immediately
+	viewport_t area = {-rule.radius + rule.radius * I, 2 * rule.radius, 2 * rule.radius, size, size};
+	farm_t fm = farm_grid(rule, channels, ranges, area, anti);
+	if(!fm.cells) return fm;
+	
+	// Fit again to the bounding box of the kept cells
+	int minr = size, minc = size, maxr = 0, maxc = 0, r, c;
+	for(int i = 0; i < fm.count; i++){
+		r = fm.cells[i] / size;
+		c = fm.cells[i] % size;
+		if(r < minr) minr = r;
+		if(r > maxr) maxr = r;
+		if(c < minc) minc = c;
+		if(c > maxc) maxc = c;
+	}
+	if(minr == 0 && minc == 0 && maxr == size - 1 && maxc == size - 1) return fm;
+	
+	double cw = area.width / size, chh = area.height / size;
+	area.corner += minc * cw - minr * chh * I;
+	area.width = (maxc - minc + 1) * cw;
+	area.height = (maxr - minr + 1) * chh;
+	farm_free(fm);
+	return farm_grid(rule, channels, ranges, area, anti);
+}
+
+double farm_coverage(const farm_t *fm){
+	return fm->cells ? (double)fm->count / (fm->area.rows * fm->area.columns) : 1;
+}
+
+complex farm_gener_r(const farm_t *fm, unsigned int *seed){
+	if(!fm->cells) return view_gener_r(fm->area, seed);
+	
+	// Pick a cell then a point within it, each cell having the same area
+	int cell = fm->cells[fm->count > 1 ? rand_r(seed) % fm->count : 0];
+	viewport_t vw = fm->area;
+	vw.width /= fm->area.columns;
+	vw.height /= fm->area.rows;
+	vw.corner += cell % fm->area.columns * vw.width - cell / fm->area.columns * vw.height * I;
+	return view_gener_r(vw, seed);
+}
+
+seedmap_t seedmap_init(viewport_t area, int rows, int cols, fractal_t rule){
+	area.rows = rows;
+	area.columns = cols;
+	seedmap_t sm = {area, rule, 0, {{0}}, malloc(sizeof(seed_cell_t) * rows * cols)};
+	if(sm.cells){
+		for(int i = 0; i < rows * cols; i++) sm.cells[i] = (seed_cell_t){0, INT_MAX, 0, 0, 0, 0};
+	}
+	return sm;
+}
+
+void seedmap_free(seedmap_t sm){
+	free(sm.cells);
+}
+
+// Discard the counts of accepted orbits if they were taken with other ranges than the plot
+static void seedmap_ranges(seedmap_t *sm, const plot_t *pl){
+	if(sm->channels == pl->channels && memcmp(sm->ranges, pl->ranges, sizeof(range_t) * pl->channels) == 0) return;
+	
+	sm->channels = pl->channels;
+	memcpy(sm->ranges, pl->ranges, sizeof(range_t) * pl->channels);
+	for(int i = 0; i < sm->area.rows * sm->area.columns; i++) sm->cells[i].tried = sm->cells[i].accepted = 0;
+}
+
+// Check whether the counts of accepted orbits of two seed maps were taken with the same ranges
+static bool seedmap_same_ranges(const seedmap_t *sm, const seedmap_t *other){
+	return sm->channels == other->channels && memcmp(sm->ranges, other->ranges, sizeof(range_t) * sm->channels) == 0;
+}
+
+void seedmap_merge(seedmap_t *sm, const seedmap_t *base, const seedmap_t *latest){
+	// Counts of accepted orbits are only carried between maps taken with the same ranges
+	// If the ranges of sm changed since base, its counts were reset and all of them are its own
+	bool own_since_base = !base || !seedmap_same_ranges(sm, base), add_latest = seedmap_same_ranges(sm, latest);
+	seed_cell_t *cell;
+	const seed_cell_t *b, *l;
+	for(int i = 0; i < sm->area.rows * sm->area.columns; i++){
+		cell = sm->cells + i;
+		l = latest->cells + i;
+		if(base){
+			b = base->cells + i;
+			cell->seen -= b->seen;
+			if(!own_since_base){
+				cell->tried -= b->tried;
+				cell->accepted -= b->accepted;
+			}
+		}
+		cell->seen += l->seen;
+		if(add_latest){
+			cell->tried += l->tried;
+			cell->accepted += l->accepted;
+		}
+		
+		// Lengths widen to cover those seen by either map
+		if(l->lo < cell->lo) cell->lo = l->lo;
+		if(l->hi > cell->hi) cell->hi = l->hi;
+		if(l->depth > cell->depth) cell->depth = l->depth;
+	}
+}
+
+// Level at which the params of the cell are skipped, keeping one in 2^level
+static int seed_level(const seedmap_t *sm, const seed_cell_t *cell){
+	// Cells where no length between the shortest and longest seen can be accepted by any channel
+	// An orbit which never escaped could escape at any length past the iterations performed
+	if(cell->seen >= SEED_MIN_SEEN){
+		int lo = cell->depth && cell->depth < cell->lo ? cell->depth + 1 : cell->lo;
+		int hi = cell->depth ? INT_MAX : cell->hi;
+		bool possible = false;
+		for(int ch = 0; ch < sm->channels; ch++){
+			possible |= lo <= sm->ranges[ch].max && hi > sm->ranges[ch].min;
+		}
+		if(!possible) return SEED_MAX_LEVEL;
+	}
+	
+	// Otherwise keep about eight times the fraction of accepted orbits
+	int level = 0;
+	if(cell->tried >= SEED_MIN_SEEN){
+		while(level < SEED_MAX_LEVEL && (unsigned long long)cell->accepted << (level + 4) <= cell->tried) level++;
+	}
+	return level;
+}
+
+double seedmap_skipped(const seedmap_t *sm){
+	int count = sm->area.rows * sm->area.columns;
+	double kept = 0;
+	for(int i = 0; i < count; i++) kept += 1.0 / (1 << seed_level(sm, sm->cells + i));
+	return 1 - kept / count;
+}
+
+int plot_rand(plot_t pl, const farm_t *farm, fractal_t rule, int numpts){
+	unsigned int seed = (unsigned int)time(NULL) + (unsigned int)clock();
+	return plot_rand_r(pl, farm, rule, numpts, &seed);
+}
+
+int plot_rand_r(plot_t pl, const farm_t *farm, fractal_t rule, int numpts, unsigned int *seed){
+	// Orbits are calculated up to the longest length accepted by any channel
+	int ch, max = 0;
+	for(ch = 0; ch < pl.channels; ch++){
+		if(pl.ranges[ch].max > max) max = pl.ranges[ch].max;
+	}
+	
 	complex pt, zero, orb[max];
 	int r, c, i;
-	unsigned int *bin, count = 0;
+	int accepted[PLOT_MAX_CHANNELS], acccount;
+	unsigned int count = 0;
 	
-	srand((unsigned int)time(NULL) + (unsigned int)clock());
+	frc_kernel_t kern = frc_select(&rule);
+	
+	seedmap_t *sm = farm->seeds;
+	seed_cell_t *cell = NULL;
+	int level, weight = 1;
+	if(sm) seedmap_ranges(sm, &pl);
 	
 	for(; numpts > 0; numpts--){
-		pt = view_gener(farm);
+		pt = farm_gener_r(farm, seed);
+		
+		// Skip all but one in 2^level params of the cell and weight the points of that one to make up for the rest
+		if(sm){
+			cell = comp_to_rc(sm->area, pt, &r, &c) ? sm->cells + r * sm->area.columns + c : NULL;
+			level = cell ? seed_level(sm, cell) : 0;
+			if(level > 0 && rand_r(seed) % (1 << level) != 0) continue;
+			weight = 1 << level;
+		}
 		
 		rule.param = pt;
 		zero = pt;
-		i = frc_orbit(rule, &zero, max, orb, max);
+		i = kern(&rule, &zero, max, orb, max);
+		
+		// Find the channels which accept an orbit of this length
+		acccount = 0;
+		for(ch = 0; ch < pl.channels; ch++){
+			if(pl.ranges[ch].min < i && i <= pl.ranges[ch].max) accepted[acccount++] = ch;
+		}
+		
+		if(cell){
+			cell->seen++;
+			if(i < 0){
+				if(max > cell->depth) cell->depth = max;
+			}else{
+				if(i < cell->lo) cell->lo = i;
+				if(i > cell->hi) cell->hi = i;
+			}
+			cell->tried++;
+			cell->accepted += acccount > 0;
+		}
+		if(acccount == 0) continue;
+		
+		// Locate each point once and add it to every accepting channel
+		for(i--; i >= 0; i--){
+			if(comp_to_rc(pl.area, orb[i], &r, &c)){
+				for(ch = 0; ch < acccount; ch++) plotadd(pl, accepted[ch], r, c, weight);
+				count += acccount * weight;
+			}
+		}
+	}
+	
+	return count;
+}
+
+
+
+int plot_anti(plot_t pl, const farm_t *farm, fractal_t rule, int numpts){
+	unsigned int seed = (unsigned int)time(NULL) + (unsigned int)clock();
+	return plot_anti_r(pl, farm, rule, numpts, &seed);
+}
+
+/* Calculate orbit in growing chunks, comparing each chunk against the last point of the one before, until it escapes or returns to a point
+ * As the chunks double in length, a cycle is found within a chunk of its period once the orbit has settled onto it
+ * 
+ * Returns:
+ *   int : number of points stored in orb, the last of which returns to the point period points before it
+ *      OR -1 if the orbit escaped
+ *   int *period : length of the cycle, zero if none was found before max points
+ */
+static int orbit_cycle(frc_kernel_t kern, const fractal_t *rule, complex pt, int max, complex *orb, int *period){
+	int n = 0, len = 8, step, k, ref = -1;
+	double dist;
+	*period = 0;
+	
+	while(n < max){
+		step = len < max - n ? len : max - n;
+		if(kern(rule, &pt, step, orb + n, step) >= 0) return -1;
+		
+		if(ref >= 0) for(k = n; k < n + step; k++){
+			dist = creal(orb[k] - orb[ref]) * creal(orb[k] - orb[ref]) + cimag(orb[k] - orb[ref]) * cimag(orb[k] - orb[ref]);
+			if(dist < PLOT_CYCLE_EPS * PLOT_CYCLE_EPS){
+				*period = k - ref;
+				return k + 1;
+			}
+		}
+		
+		n += step;
+		ref = n - 1;
+		len *= 2;
+	}
+	return n;
+}
+
+int plot_anti_r(plot_t pl, const farm_t *farm, fractal_t rule, int numpts, unsigned int *seed){
+	int ch, max = 0;
+	for(ch = 0; ch < pl.channels; ch++){
+		if(pl.ranges[ch].max > max) max = pl.ranges[ch].max;
+	}
+	
+	complex pt, orb[max];
+	int r, c, n, t, k, from, to, period, start;
+	unsigned int count = 0, times;
+	
+	frc_kernel_t kern = frc_select(&rule);
+	
+	for(; numpts > 0; numpts--){
+		pt = farm_gener_r(farm, seed);
+		
+		rule.param = pt;
+		n = orbit_cycle(kern, &rule, pt, max, orb, &period);
+		if(n < 0) continue;
 		
-		if(i > min){
-			for(i--; i >= 0; i--){
-				if(bin = plot_atcmp(pl, orb[i])){
-					(*bin)++;
+		for(ch = 0; ch < pl.channels; ch++){
+			from = pl.ranges[ch].min > 0 ? pl.ranges[ch].min : 0;
+			to = pl.ranges[ch].max;
+			
+			// Points calculated before the cycle was found are added once
+			for(t = from; t < to && t < n; t++){
+				if(comp_to_rc(pl.area, orb[t], &r, &c)){
+					plotadd(pl, ch, r, c, 1);
 					count++;
 				}
 			}
+			if(period == 0 || to <= n) continue;
+			
+			// Every point of the cycle is added once for each time the rest of the iterations would have landed on it
+			// Iteration t >= n lands on orb[start + (t - start) % period]
+			start = n - period;
+			if(from < n) from = n;
+			for(t = 0; t < period; t++){
+				k = start + (from - start + t) % period;
+				times = (to - from) / period + (t < (to - from) % period);
+				if(times > 0 && comp_to_rc(pl.area, orb[k], &r, &c)){
+					plotadd(pl, ch, r, c, times);
+					count += times;
+				}
+			}
 		}
 	}
 	
 	return count;
 }
 
+
+
+long long buddha_accumulate(const buddha_t *bd, long long numpts, unsigned int seed, unsigned int *counts){
+	// Plot over the counts of the caller, which plot_rand_r only reads the ranges of
+	plot_t pl = {bd->area, bd->channels, (range_t *)bd->ranges, counts, NULL};
+	
+	farm_t whole;
+	const farm_t *farm = bd->farm;
+	if(!farm){
+		double rad = bd->rule.radius;
+		whole = farm_init((viewport_t){-rad + rad * I, 2 * rad, 2 * rad, 0, 0});
+		farm = &whole;
+	}
+	
+	// Sample in batches to keep the count of each call within an int
+	long long total = 0;
+	int batch;
+	for(; numpts > 0; numpts -= batch){
+		batch = numpts > 1000000 ? 1000000 : (int)numpts;
+		total += (unsigned int)(bd->anti ? plot_anti_r : plot_rand_r)(pl, farm, bd->rule, batch, &seed);
+	}
+	return total;
+}
+
+
+
+// Partial histograms start with a line of text describing the plot followed by the counts of each channel
+// Floating point values are written in hexadecimal so that they are read back exactly
+#define PARTIAL_MAGIC "buddha-partial"
+#define PARTIAL_VERSION 1
+
+// Write unsigned integer using 7 bits per byte with the high bit marking that more bytes follow
+static void write_varint(FILE *fl, unsigned long long val){
+	while(val >= 0x80){
+		putc((int)(val & 0x7f) | 0x80, fl);
+		val >>= 7;
+	}
+	putc((int)val, fl);
+}
+
+static bool read_varint(FILE *fl, unsigned long long *val){
+	int byte, shift = 0;
+	*val = 0;
+	do{
+		if((byte = getc(fl)) == EOF || shift > 63) return false;
+		*val |= (unsigned long long)(byte & 0x7f) << shift;
+		shift += 7;
+	}while(byte & 0x80);
+	return true;
+}
+
+bool plot_save(FILE *fl, plot_t pl, long long samples){
+	fprintf(fl, "%s %i %a %a %a %a %i %i %i", PARTIAL_MAGIC, PARTIAL_VERSION,
+		creal(pl.area.corner), cimag(pl.area.corner), pl.area.width, pl.area.height,
+		pl.area.rows, pl.area.columns, pl.channels
+	);
+	for(int ch = 0; ch < pl.channels; ch++) fprintf(fl, " %i:%i", pl.ranges[ch].min, pl.ranges[ch].max);
+	fprintf(fl, " %lli\n", samples);
+	
+	// Each channel is stored as the number of non-zero bins
+	// followed by the gap of empty bins before each non-zero bin and its count
+	size_t i, last, nonzero;
+	int r, c;
+	unsigned int val;
+	for(int ch = 0; ch < pl.channels; ch++){
+		nonzero = 0;
+		for(r = 0; r < pl.area.rows; r++) for(c = 0; c < pl.area.columns; c++) nonzero += plotch(pl, ch, r, c) != 0;
+		write_varint(fl, nonzero);
+		
+		last = i = 0;
+		for(r = 0; r < pl.area.rows; r++) for(c = 0; c < pl.area.columns; c++, i++){
+			if(!(val = plotch(pl, ch, r, c))) continue;
+			write_varint(fl, i - last);
+			write_varint(fl, val);
+			last = i + 1;
+		}
+	}
+	
+	return !ferror(fl);
+}
+
+bool plot_merge(FILE *fl, plot_t *pl, long long *samples){
+	double real, imag, width, height;
+	int version, rows, cols, channels;
+	long long count;
+	range_t ranges[PLOT_MAX_CHANNELS];
+	
+	if(fscanf(fl, PARTIAL_MAGIC " %i %la %la %la %la %i %i %i", &version, &real, &imag, &width, &height, &rows, &cols, &channels) < 8
+		|| version != PARTIAL_VERSION || rows < 1 || cols < 1 || channels < 1 || channels > PLOT_MAX_CHANNELS
+	){
+		fprintf(stderr, "Not a partial histogram\n");
+		return false;
+	}
+	for(int ch = 0; ch < channels; ch++){
+		if(fscanf(fl, " %i:%i", &ranges[ch].min, &ranges[ch].max) < 2){
+			fprintf(stderr, "Not a partial histogram\n");
+			return false;
+		}
+	}
+	// Header ends with a single newline before the counts
+	if(fscanf(fl, " %lli", &count) < 1 || getc(fl) != '\n'){
+		fprintf(stderr, "Not a partial histogram\n");
+		return false;
+	}
+	
+	complex corner = real + imag * I;
+	if(pl->channels == 0){
+		*pl = plot_create(corner + width / 2 - height / 2 * I, width, height, rows, cols, channels, ranges, true);
+		// Use the corner exactly as it was written rather than recalculating it from the center
+		pl->area.corner = corner;
+		*samples = 0;
+	}else if(pl->area.corner != corner || pl->area.width != width || pl->area.height != height
+		|| pl->area.rows != rows || pl->area.columns != cols || pl->channels != channels
+		|| memcmp(pl->ranges, ranges, sizeof(range_t) * channels) != 0
+	){
+		fprintf(stderr, "Partial histogram was made with a different plot\n");
+		return false;
+	}
+	
+	size_t bins = (size_t)rows * cols, pos;
+	unsigned long long nonzero, gap, val;
+	for(int ch = 0; ch < channels; ch++){
+		if(!read_varint(fl, &nonzero)){
+			fprintf(stderr, "Partial histogram is truncated\n");
+			return false;
+		}
+		
+		pos = 0;
+		for(; nonzero > 0; nonzero--){
+			if(!read_varint(fl, &gap) || !read_varint(fl, &val)){
+				fprintf(stderr, "Partial histogram is truncated\n");
+				return false;
+			}
+			if(gap >= bins - pos){
+				fprintf(stderr, "Partial histogram has bins outside of the plot\n");
+				return false;
+			}
+			pos += gap;
+			plotadd(*pl, ch, (int)(pos / cols), (int)(pos % cols), (unsigned int)val);
+			pos++;
+		}
+	}
+	
+	*samples += count;
+	return true;
+}
+
+
+
+// Raw counts start with a line of text like partial histograms, ending with the byte order of the counts
+#define COUNTS_MAGIC "buddha-counts"
+#define COUNTS_VERSION 1
+
+bool plot_write_counts(int fd, plot_t pl, int minr, int minc, int maxr, int maxc){
+	int rows = maxr - minr, cols = maxc - minc;
+	double bin_width = pl.area.width / pl.area.columns, bin_height = pl.area.height / pl.area.rows;
+	
+	char header[256];
+	const unsigned int one = 1;
+	int len = snprintf(header, sizeof(header), "%s %i %a %a %a %a %i %i %i", COUNTS_MAGIC, COUNTS_VERSION,
+		creal(pl.area.corner) + minc * bin_width, cimag(pl.area.corner) - minr * bin_height, cols * bin_width, rows * bin_height,
+		rows, cols, pl.channels
+	);
+	for(int ch = 0; ch < pl.channels; ch++) len += snprintf(header + len, sizeof(header) - len, " %i:%i", pl.ranges[ch].min, pl.ranges[ch].max);
+	len += snprintf(header + len, sizeof(header) - len, " %s\n", *(const char*)&one ? "le" : "be");
+	
+	// Dense grids are sent straight from memory a row at a time, joining rows which follow one another in the grid
+	// Sparse plots are gathered into a single buffer first
+	size_t row_size = sizeof(unsigned int) * cols;
+	unsigned int *buf = NULL;
+	struct iovec *iov = malloc(sizeof(struct iovec) * ((pl.grid ? (size_t)pl.channels * rows : 1) + 1));
+	if(!iov) return false;
+	iov[0] = (struct iovec){header, len};
+	int count = 1;
+	
+	if(pl.grid){
+		unsigned int *row;
+		for(int ch = 0; ch < pl.channels; ch++) for(int r = minr; r < maxr; r++){
+			row = pl.grid + plotidx(pl, ch, r, minc);
+			if(count > 1 && (char*)iov[count - 1].iov_base + iov[count - 1].iov_len == (char*)row) iov[count - 1].iov_len += row_size;
+			else iov[count++] = (struct iovec){row, row_size};
+		}
+	}else{
+		buf = malloc(row_size * rows * pl.channels);
+		if(!buf){
+			free(iov);
+			return false;
+		}
+		
+		unsigned int *val = buf;
+		for(int ch = 0; ch < pl.channels; ch++) for(int r = minr; r < maxr; r++) for(int c = minc; c < maxc; c++) *val++ = plotch(pl, ch, r, c);
+		iov[count++] = (struct iovec){buf, row_size * rows * pl.channels};
+	}
+	
+	bool success = write_vec(fd, iov, count);
+	free(iov);
+	free(buf);
+	return success;
+}
+
+
+
+// Seed maps start with a line of text describing the grid, rule, and ranges followed by the cells
+#define SEEDMAP_MAGIC "buddha-seeds"
+#define SEEDMAP_VERSION 1
+
+// Identify the provided transforms so that rules can be compared between runs
+static int trans_id(complex (*trans)(complex)){
+	return trans == NULL ? 0 : trans == crect ? 1 : trans == conj ? 2 : 3;
+}
+
+bool seedmap_save(FILE *fl, const seedmap_t *sm){
+	fprintf(fl, "%s %i %a %a %a %a %i %i %i %a %a %a %i", SEEDMAP_MAGIC, SEEDMAP_VERSION,
+		creal(sm->area.corner), cimag(sm->area.corner), sm->area.width, sm->area.height,
+		sm->area.rows, sm->area.columns,
+		trans_id(sm->rule.trans), creal(sm->rule.power), cimag(sm->rule.power), sm->rule.radius,
+		sm->channels
+	);
+	for(int ch = 0; ch < sm->channels; ch++) fprintf(fl, " %i:%i", sm->ranges[ch].min, sm->ranges[ch].max);
+	fprintf(fl, "\n");
+	
+	// Cells are stored as their counts with lo and hi offset by one so that zero marks that no orbit escaped
+	const seed_cell_t *cell;
+	for(int i = 0; i < sm->area.rows * sm->area.columns; i++){
+		cell = sm->cells + i;
+		write_varint(fl, cell->seen);
+		write_varint(fl, cell->lo <= cell->hi ? (unsigned int)cell->lo + 1 : 0);
+		write_varint(fl, cell->lo <= cell->hi ? (unsigned int)cell->hi + 1 : 0);
+		write_varint(fl, cell->depth);
+		write_varint(fl, cell->tried);
+		write_varint(fl, cell->accepted);
+	}
+	
+	return !ferror(fl);
+}
+
+bool seedmap_load(FILE *fl, seedmap_t *sm){
+	double real, imag, width, height, power_real, power_imag, radius;
+	int version, rows, cols, trans, channels;
+	range_t ranges[PLOT_MAX_CHANNELS];
+	
+	if(fscanf(fl, SEEDMAP_MAGIC " %i %la %la %la %la %i %i %i %la %la %la %i", &version, &real, &imag, &width, &height,
+			&rows, &cols, &trans, &power_real, &power_imag, &radius, &channels) < 12
+		|| version != SEEDMAP_VERSION || channels < 0 || channels > PLOT_MAX_CHANNELS
+	){
+		fprintf(stderr, "Not a seed map\n");
+		return false;
+	}
+	for(int ch = 0; ch < channels; ch++){
+		if(fscanf(fl, " %i:%i", &ranges[ch].min, &ranges[ch].max) < 2){
+			fprintf(stderr, "Not a seed map\n");
+			return false;
+		}
+	}
+	if(getc(fl) != '\n'){
+		fprintf(stderr, "Not a seed map\n");
+		return false;
+	}
+	
+	// Classification only holds for the same params and rule
+	if(sm->area.corner != real + imag * I || sm->area.width != width || sm->area.height != height
+		|| sm->area.rows != rows || sm->area.columns != cols
+		|| trans_id(sm->rule.trans) != trans || sm->rule.power != power_real + power_imag * I || sm->rule.radius != radius
+	){
+		fprintf(stderr, "Seed map was made for a different farm or rule\n");
+		return false;
+	}
+	
+	// Read into a copy so that the map is left unchanged on error
+	size_t count = (size_t)rows * cols;
+	seed_cell_t *cells = malloc(sizeof(seed_cell_t) * count);
+	if(!cells) return false;
+	
+	unsigned long long val[6];
+	for(size_t i = 0; i < count; i++){
+		for(int j = 0; j < 6; j++){
+			if(!read_varint(fl, val + j) || val[j] > (j == 0 || j > 3 ? UINT_MAX : INT_MAX)){
+				fprintf(stderr, "Seed map is truncated\n");
+				free(cells);
+				return false;
+			}
+		}
+		cells[i] = (seed_cell_t){val[0], val[1] ? val[1] - 1 : INT_MAX, val[2] ? val[2] - 1 : 0, val[3], val[4], val[5]};
+	}
+	
+	free(sm->cells);
+	sm->cells = cells;
+	sm->channels = channels;
+	memcpy(sm->ranges, ranges, sizeof(range_t) * channels);
+	return true;
+}
@@ -1,38 +1,381 @@
 #ifndef _BUDDHA_H
 #define _BUDDHA_H
 
+#include <stdio.h>
+
 #include "fractal.h"
 
 
-// Get grid value from plot at given row and column
-#define plotat(p, r, c) ((p).grid[(p).area.columns * (r) + (c)])
+// Index of bin in the dense grid of plot at given channel, row, and column
+#define plotidx(p, ch, r, c) (((size_t)(ch) * (p).area.rows + (r)) * (p).area.columns + (c))
+// Get grid value from plot at given channel, row, and column
+#define plotch(p, ch, r, c) ((p).grid ? (p).grid[plotidx(p, ch, r, c)] : plot_tile_get(&(p), ch, r, c))
+// Get grid value from first channel of plot at given row and column
+#define plotat(p, r, c) plotch(p, 0, r, c)
+// Add n to grid value of plot at given channel, row, and column
+#define plotadd(p, ch, r, c, n) ((p).grid \
+	? (p).shared ? (void)__atomic_fetch_add((p).grid + plotidx(p, ch, r, c), (n), __ATOMIC_RELAXED) : (void)((p).grid[plotidx(p, ch, r, c)] += (n)) \
+	: plot_tile_add(&(p), ch, r, c, n))
+
+// Maximum number of channels in a plot (one for each of red, green, and blue)
+#define PLOT_MAX_CHANNELS 3
+
+// Lengths of orbits to count in a channel
+// An orbit which escapes after `i` iterations is counted if min < i <= max
+typedef struct{
+	int min, max;
+} range_t;
+
+// Sparse plots are divided into tiles of PLOT_TILE_SIZE by PLOT_TILE_SIZE bins
+#define PLOT_TILE_BITS 6
+#define PLOT_TILE_SIZE (1 << PLOT_TILE_BITS)
+
+// Tile of a sparse plot
+// Counts start as single bytes and are widened for the whole tile once any of them would overflow
+typedef struct{
+	int width;  // Number of bytes in each count: 1, 2, or 4
+	void *counts;  // NULL until a point is first added to the tile
+} plot_tile_t;
 
 // Grid for counting points
 typedef struct{
 	// Rectangle in the complex plane that grid corresponds to
 	viewport_t area;
 	
+	// Number of channels and the range of orbit lengths each one counts
+	int channels;
+	range_t *ranges;
+	
 	// Grid of bins counting the number of points in each
+	// One grid of area.rows * area.columns bins for each channel, one after another
+	// Mapped with huge pages where available by plot_init, so it must only be released by plot_free
+	// NULL if the plot is sparse
 	unsigned int *grid;
+	
+	// Tiles of a sparse plot in row-major order for each channel, one after another
+	// NULL if the plot is dense
+	plot_tile_t *tiles;
+	
+	// Whether points are added atomically so that many threads can add to a dense plot at once
+	// Sparse plots widen their tiles in place and can't be shared
+	bool shared;
 } plot_t;
 
-// Allocate memory and initialize fields for plot
-plot_t plot_init(complex center, double width, double height, int rows, int cols);
+// Allocate memory and initialize fields for plot with `channels` channels using the given ranges
+plot_t plot_init(complex center, double width, double height, int rows, int cols, int channels, const range_t *ranges);
+// Initialize plot like plot_init, but only allocate memory for tiles of the grid once points are added to them
+// Uses much less memory when most bins stay empty or hold small counts
+plot_t plot_init_sparse(complex center, double width, double height, int rows, int cols, int channels, const range_t *ranges);
 // Set every count in grid to zero
 void plot_clear(plot_t pl);
+// Add the counts of part to those of pl, which must have the same area and channels
+void plot_sum(plot_t pl, plot_t part);
 // Deallocate memory for plot
 void plot_free(plot_t pl);
 
-// Get maximum value in grid
-unsigned int plot_max(plot_t pl);
-// Get value of grid at given complex number
-unsigned int *plot_atcmp(plot_t pl, complex pt);
+// Get maximum value in grid of channel
+unsigned int plot_max(plot_t pl, int ch);
+// Get value of first channel of grid at given complex number, zero if outside of plot
+unsigned int plot_atcmp(plot_t pl, complex pt);
+
+// Get and add to values of sparse plots, use plotch and plotadd instead
+unsigned int plot_tile_get(const plot_t *pl, int ch, int r, int c);
+void plot_tile_add(const plot_t *pl, int ch, int r, int c, unsigned int n);
+
+// Curves mapping the count of a bin onto its brightness in [0, 1], which is then raised to a gamma
+typedef enum{
+	TONE_GAMMA,  // count / max
+	TONE_LOG,  // log(1 + count) / log(1 + max)
+	TONE_EQUALIZE  // fraction of the nonempty bins whose counts are at most count, spreading the bins evenly over the brightnesses
+} tone_curve_t;
+
+// Names of the curves as given on the command line
+extern const char *tone_curve_names[];
+// Find the curve with the given name
+// Returns true if found ; false if there is no such curve
+bool tone_curve_parse(const char *name, tone_curve_t *curve);
+
+// Counts below 2^TONE_BITS have a bucket each, and every doubling above shares 2^(TONE_BITS - 1) buckets
+// so that each bucket spans less than 1 / 2^(TONE_BITS - 1) of its counts
+#define TONE_BITS 14
+#define TONE_BUCKETS ((1u << TONE_BITS) + (32 - TONE_BITS) * (1u << (TONE_BITS - 1)))
+// Index of the bucket holding count n
+#define tone_bucket(n) ((n) < (1u << TONE_BITS) ? (n) \
+	: ((unsigned int)(32 - __builtin_clz(n) - TONE_BITS) << (TONE_BITS - 1)) + ((n) >> (32 - __builtin_clz(n) - TONE_BITS)))
+
+// Table mapping the counts of one channel onto brightnesses, built once for each image
+typedef struct{
+	tone_curve_t curve;
+	
+	// Largest count added
+	unsigned int max;
+	
+	// Number of bins added in each bucket, only kept for TONE_EQUALIZE, NULL otherwise
+	unsigned int *hist;
+	
+	// Brightness of each bucket up to that of max, filled in by tone_build
+	unsigned short *lut;
+} tone_t;
+
+// Add count n of a bin to the table before it is built
+#define tone_add(tn, n) ((void)((n) > (tn).max && ((tn).max = (n))), (tn).hist ? (void)(tn).hist[tone_bucket(n)]++ : (void)0)
+// Get brightness of count n from a built table
+#define tone_get(tn, n) ((tn).lut[tone_bucket(n)])
+
+// Allocate an empty table for the curve
+// Returns table whose lut is NULL if it could not be allocated
+tone_t tone_init(tone_curve_t curve);
+// Deallocate memory for table
+void tone_free(tone_t tn);
+// Empty the table so that it can be built again for another image with the curve, keeping its memory
+// Returns true if successful ; false if the histogram for TONE_EQUALIZE could not be allocated, leaving the table unusable until reset again
+bool tone_reset(tone_t *tn, tone_curve_t curve);
+
+/* Fill in the brightness of every bucket from the counts added so far
+ * The count of each bucket is taken from its middle, so counts of 2^TONE_BITS and above are within 1 / 2^TONE_BITS of their own brightness
+ * except for the bucket of max, which is taken at max
+ * 
+ * Arguments:
+ *   tone_t *tn : table whose counts have been added with tone_add
+ *   double gamma : power to raise the brightness from the curve to
+ *   unsigned int levels : brightness of max, at most 65535, such as 255 for 8-bit images
+ * 
+ * Returns:
+ *   tone_t *tn : table mapping zero to 0 and max to levels, each brightness rounded down
+ */
+void tone_build(tone_t *tn, double gamma, unsigned int levels);
+// Replace each of count bins by its brightness from a built table
+void tone_map(const tone_t *tn, unsigned int *counts, size_t count);
 
 // Generate random point from given viewport using 2D uniform distribution
+// Uses the global generator of rand so it is not reentrant, use view_gener_r from threads
 complex view_gener(viewport_t vw);
+// Generate random point like view_gener using *seed as the state of the generator instead of the global one
+complex view_gener_r(viewport_t vw, unsigned int *seed);
+
+// Lengths of the orbits sampled from a cell of a seed map
+typedef struct{
+	unsigned int seen;  // Number of orbits iterated from the cell
+	int lo, hi;  // Shortest and longest escape seen, lo > hi until an orbit escapes
+	int depth;  // Most iterations performed on an orbit which never escaped, zero if every orbit escaped
+	unsigned int tried, accepted;  // Number of orbits iterated and accepted by a channel since the ranges last changed
+} seed_cell_t;
+
+// Most orbits of a cell are skipped at this level, keeping one in 2^SEED_MAX_LEVEL
+#define SEED_MAX_LEVEL 5
+// Number of orbits iterated from a cell before it may be skipped
+#define SEED_MIN_SEEN 32
+
+/* Classification of params from the lengths of the orbits already sampled from each cell of a grid
+ * 
+ * Cells whose orbits have all been too short or too long for every channel,
+ * and cells where few orbits have been accepted, are skipped at level s for all but one in 2^s params
+ * The points of the params which are kept are then added 2^s times, so the expected count of every bin is unchanged
+ * Cells are never skipped entirely, so the classification only changes how quickly the plot converges
+ */
+typedef struct{
+	// Rectangle in the complex plane and grid of cells the classification covers
+	viewport_t area;
+	// Rule which the orbits were generated with, the param is unused
+	fractal_t rule;
+	
+	// Ranges which the tried and accepted counts were taken with
+	int channels;
+	range_t ranges[PLOT_MAX_CHANNELS];
+	
+	// Cells in row-major order
+	seed_cell_t *cells;
+} seedmap_t;
+
+// Create empty seed map of rows by cols cells over the area for orbits of the rule
+seedmap_t seedmap_init(viewport_t area, int rows, int cols, fractal_t rule);
+// Deallocate memory for seed map
+void seedmap_free(seedmap_t sm);
+// Write seed map so that it can be loaded by later runs
+// Returns true if successful ; false if error
+bool seedmap_save(FILE *fl, const seedmap_t *sm);
+// Replace the cells of the seed map by those of a file written by seedmap_save
+// Counts of accepted orbits are discarded if they were taken with other ranges
+// Returns true if successful ; false if error or the file was made for another area, grid, or rule
+bool seedmap_load(FILE *fl, seedmap_t *sm);
+/* Carry the orbits sampled into a seed map since it was loaded over to a newer copy of the same map
+ * so that processes sharing one file keep each other's orbits, as if this one sampled after the others
+ * 
+ * Arguments:
+ *   seedmap_t *sm : map which was equal to base before sampling into it
+ *   const seedmap_t *base : map as loaded before sampling, NULL if sm started empty
+ *   const seedmap_t *latest : map as since saved by the other processes, with the same area and grid as sm
+ * 
+ * Returns:
+ *   seedmap_t *sm : latest with the orbit counts sampled since base added and the lengths seen by either
+ */
+void seedmap_merge(seedmap_t *sm, const seedmap_t *base, const seedmap_t *latest);
+// Fraction of the params of the seed map expected to be skipped
+double seedmap_skipped(const seedmap_t *sm);
+
+// Region from which the params of orbits are randomly selected
+// The area is divided into a grid of cells of which only the listed ones are sampled from
+typedef struct{
+	viewport_t area;  // Rows and columns give the grid of cells
+	int count;  // Number of cells sampled from
+	int *cells;  // Row-major indices of the cells sampled from, NULL to sample the whole area
+	
+	// Classification of the params of the area which is updated as orbits are sampled, NULL to iterate every param
+	seedmap_t *seeds;
+} farm_t;
+
+// Create farm which samples uniformly from the whole area
+farm_t farm_init(viewport_t area);
+// Deallocate memory for farm
+void farm_free(farm_t fm);
+
+/* Fit farm to the params whose orbits are accepted by the plot, estimated from a coarse grid of escape times
+ * The square within the radius of the rule is divided into size by size cells and their corners and centers are iterated
+ * Cells are kept if any of their points is accepted by a channel, or if they hold both points which escape too early
+ * and points which never escape and so straddle the boundary of the set, along with the cells neighboring them
+ * The grid is then fit again over the bounding box of the kept cells
+ * 
+ * Every kept cell is sampled uniformly, so the plot is the same as sampling the whole square
+ * except for the orbits of the rare params in cells which the coarse grid missed
+ * For the anti-Buddhabrot, cells holding any point which never escapes are kept instead
+ * 
+ * Arguments:
+ *   fractal_t rule : rule used to generate orbits
+ *   int channels : number of channels in ranges
+ *   const range_t *ranges : lengths of orbits accepted by each channel
+ *   int size : number of cells along each side of the grid
+ *   bool anti : whether the farm is for orbits which never escape, as plotted by plot_anti
+ * 
+ * Returns:
+ *   farm_t : farm sampling only the kept cells
+ */
+farm_t farm_fit(fractal_t rule, int channels, const range_t *ranges, int size, bool anti);
+// Fraction of the area of the farm which is sampled from
+double farm_coverage(const farm_t *fm);
+// Generate random point uniformly from the cells of the farm using *seed as the state of the generator
+complex farm_gener_r(const farm_t *fm, unsigned int *seed);
+
+/* Add points from `numpts` number of orbits to `pl`
+ * Each orbit is calculated once and its points are added to every channel whose range includes its length
+ * If the farm has a seed map, params are skipped and the points of the rest weighted as it describes
+ * 
+ * Arguments:
+ *   plot_t pl : plot to add points to
+ *   const farm_t *farm : region from which to randomly select the params of the orbits
+ *   fractal_t rule : rule used to generate orbits (param is replaced by the selected point)
+ *   int numpts : number of orbits to generate
+ * 
+ * Returns:
+ *   int : total number of points added across all channels
+ */
+int plot_rand(plot_t pl, const farm_t *farm, fractal_t rule, int numpts);
+// Add points from orbits like plot_rand using *seed as the state of the generator
+// The same seed always produces the same orbits so runs can be repeated and split between processes
+int plot_rand_r(plot_t pl, const farm_t *farm, fractal_t rule, int numpts, unsigned int *seed);
+
+// Distance within which an orbit is taken to have returned to an earlier point
+#define PLOT_CYCLE_EPS 1e-12
+
+/* Add points from the orbits which never escape out of `numpts` orbits to `pl`, plotting the anti-Buddhabrot
+ * Each channel counts the iterations from its min up to its max, so the min skips the start of the orbit before it settles
+ * 
+ * Orbits are stopped once they return to within PLOT_CYCLE_EPS of an earlier point,
+ * and each point of the cycle is then added once for every time the remaining iterations would have landed on it,
+ * so the plot is the same as following every orbit to the end while most orbits take a small fraction of the iterations
+ * The seed map of the farm is not used
+ * 
+ * Arguments:
+ *   plot_t pl : plot to add points to
+ *   const farm_t *farm : region from which to randomly select the params of the orbits
+ *   fractal_t rule : rule used to generate orbits (param is replaced by the selected point)
+ *   int numpts : number of orbits to generate
+ * 
+ * Returns:
+ *   int : total number of points added across all channels
+ */
+int plot_anti(plot_t pl, const farm_t *farm, fractal_t rule, int numpts);
+// Add points from orbits like plot_anti using *seed as the state of the generator
+int plot_anti_r(plot_t pl, const farm_t *farm, fractal_t rule, int numpts, unsigned int *seed);
+
+// Everything needed to accumulate a Buddhabrot into a buffer owned by the caller
+typedef struct{
+	// Rule used to generate orbits, the param is replaced by each sampled point
+	fractal_t rule;
+	// Rectangle in the complex plane and grid of bins to count points in
+	viewport_t area;
+	
+	// Number of channels and the range of orbit lengths each one counts
+	int channels;
+	range_t ranges[PLOT_MAX_CHANNELS];
+	// Whether to count the orbits which never escape as by plot_anti instead of those which do
+	bool anti;
+	
+	// Region to sample params from, NULL for the square within the radius of the rule
+	// A farm with a seed map is updated while sampling and so can't be shared between threads
+	const farm_t *farm;
+} buddha_t;
+
+/* Add the points of numpts orbits sampled from the seed to the counts of every channel
+ * Only reads the description and writes the counts, so any number of threads may accumulate at once
+ * as long as each has its own counts (and seed map), after which the counts can simply be summed
+ * 
+ * Arguments:
+ *   const buddha_t *bd : description of the Buddhabrot
+ *   long long numpts : number of orbits to sample
+ *   unsigned int seed : state of the generator, the same seed always produces the same counts
+ *   unsigned int *counts : area.rows * area.columns counts for each channel, one channel after another in row-major order
+ * 
+ * Returns:
+ *   long long : total number of points added across all channels
+ *   unsigned int *counts : counts with the points added
+ */
+long long buddha_accumulate(const buddha_t *bd, long long numpts, unsigned int seed, unsigned int *counts);
+
+/* Write the counts of a plot as a partial histogram which can be merged with others by plot_merge
+ * Only the non-zero bins are stored, each as the gap from the previous one and its count
+ * 
+ * Arguments:
+ *   FILE *fl : file or pipe to write to
+ *   plot_t pl : plot to write
+ *   long long samples : number of orbits sampled to produce the plot
+ * 
+ * Returns:
+ *   bool : true if successful ; false if error
+ */
+bool plot_save(FILE *fl, plot_t pl, long long samples);
+
+/* Read a partial histogram written by plot_save and add its counts to a plot
+ * 
+ * Arguments:
+ *   FILE *fl : file or pipe to read from
+ *   plot_t *pl : plot to add counts to, which must have the same area, channels, and ranges
+ *      OR plot with no channels to initialize as a sparse plot from the partial histogram
+ *   long long *samples : running total of orbits sampled
+ * 
+ * Returns:
+ *   bool : true if successful ; false if error or the plots differ
+ *   plot_t *pl : the plot with counts added
+ *   long long *samples : the total with the samples of the partial histogram added
+ */
+bool plot_merge(FILE *fl, plot_t *pl, long long *samples);
 
-// Add points from `numpts` number of orbits to `pl`
-// Only include orbits with lengths between `min` and `max`
-int plot_rand(plot_t pl, viewport_t farm, fractal_t rule, int min, int max, int numpts);
+/* Write the counts of rows [minr, maxr) and columns [minc, maxc) of a plot uncompressed for other programs to read
+ * 
+ * The counts follow a line of text holding
+ *   buddha-counts VERSION REAL IMAG WIDTH HEIGHT ROWS COLUMNS CHANNELS MIN:MAX... le|be
+ * where the floating point values give the corner and size of the area written in hexadecimal
+ * Then come ROWS * COLUMNS counts as 32-bit unsigned integers in little or big endian for each channel, one channel after another in row-major order
+ * 
+ * Rows of dense plots are written by a single writev straight from the grid
+ * 
+ * Arguments:
+ *   int fd : file descriptor to write to
+ *   plot_t pl : plot to write
+ *   int minr, minc, maxr, maxc : rows and columns of the plot to write, which must lie within the plot
+ * 
+ * Returns:
+ *   bool : true if successful ; false if error
+ */
+bool plot_write_counts(int fd, plot_t pl, int minr, int minc, int maxr, int maxc);
 
 #endif
@@ -4,10 +4,21 @@
 #include <argp.h>
 #include <stdlib.h>
 #include <string.h>
+#include <locale.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/wait.h>
 
 #include <png.h>
 
 #include "buddha.h"
+#include "formula.h"
+#include "image.h"
+#include "node.h"
+#include "term.h"
 
 
 // Number of points to plot every second
@@ -16,35 +27,104 @@ float plots_per_sec = 10000;
 // Rectangle in complex plane to draw to the terminal
 viewport_t view = {-2 + 2 * I /* Corner */, 4 /* Width */, 4 /* Height */, 0 /* Rows */, 0 /* Columns */};
 
-// Factor to correct bin value by to achieve appropriate brightness
-// Value = (BinCount / MaxBinCount)^gamm ; 0 <= Value <= 1
-double gamm = 0.5;
+// Factor to correct bin value by to achieve appropriate brightness for each channel
+// Value = Curve(BinCount)^gamm ; 0 <= Value <= 1 ; where the curve of TONE_GAMMA is BinCount / MaxBinCount
+double gamm[PLOT_MAX_CHANNELS] = {0.5, 0.5, 0.5};
+tone_curve_t tone_curve = TONE_GAMMA;
+// Tables the viewer builds each frame, kept between frames so that drawing does not allocate them each time
+tone_t view_tones[PLOT_MAX_CHANNELS];
 
 // Fractal parameters used to generate orbits
 fractal_t rule = {NULL /* Transform */, 2 /* Power */, 0 /* Param */, 2 /* Radius */};  // Fractal rule used for generating orbits
-int max_iters = 100, min_iters = 10;  // Maximum number of iterations to calculate in orbit and Minimum to accept
+formula_t formula;  // Formula iterated in place of the rule when rule.formula is set
+
+// Minimum (exclusive) and Maximum (inclusive) lengths of orbits to accept into each channel
+// A single channel is drawn in greyscale while multiple channels are drawn as red, green, and blue
+int channels = 1;
+range_t ranges[PLOT_MAX_CHANNELS] = {{10 /* Min */, 100 /* Max */}};
 
 // Create plot to count the number of points from each orbit that fall in each bin
 // Grid not allocated until runtime
-plot_t plot = {{-2 + 2 * I /* Corner */, 4 /* Width */, 4 /* Height */, 1000 /* Rows */, 1000 /* Columns */}, NULL /* Grid */};
+plot_t plot = {{-2 + 2 * I /* Corner */, 4 /* Width */, 4 /* Height */, 1000 /* Rows */, 1000 /* Columns */}, 0 /* Channels */, NULL /* Ranges */, NULL /* Grid */, NULL /* Tiles */};
 int plotted = 0;  // Tracks total number of points plotted on plot
+bool is_sparse = 0;  // Allocate the grid of the plot in tiles as they are touched
+bool is_anti = 0;  // Plot the orbits which never escape instead of those which do
+
+// Area from which to draw points randomly to generate orbits
+// Fit to the params whose orbits are accepted using a grid of farm_size cells along each side, unless zero
+viewport_t farm_area = {-2 + 2*I, 4, 4, 0, 0};
+farm_t farm;
+int farm_size = 0;
+#define FARM_DEFAULT_SIZE 128
+
+// File holding the classification of params from earlier runs, loaded at start and saved at exit, NULL if not classifying
+// The classification covers the farm with a grid of SEEDMAP_SIZE by SEEDMAP_SIZE cells
+const char *seedmap_filename = NULL;
+seedmap_t seeds;
+seedmap_t seeds_loaded;  // Copy of the classification as loaded, whose cells are NULL if the file did not exist yet
+#define SEEDMAP_SIZE 256
 
 #define SCREENSHOT_NAME_LENGTH 64
 char screenshot_filename[SCREENSHOT_NAME_LENGTH] = "buddha_screenshot.png";
+// Format to write screenshots in, chosen from the extension of the screenshot file unless given
+image_format_t image_format = IMAGE_PNG;
+bool format_set = 0;
+int image_depth = 8;  // Bits of each channel of PNG screenshots, 8 or 16
+
+// Screenshots of the viewer are written by child processes so that sampling continues meanwhile
+// Each child has a copy-on-write snapshot of the plot from when it was forked,
+// so bins are only copied once the sampler changes them
+#define SCREENSHOT_MAX_JOBS 4
+typedef struct{
+	pid_t pid;
+	int progress;  // Read end of the pipe the child writes the percentage of rows done to
+	int percent;
+} screenshot_t;
+screenshot_t shots[SCREENSHOT_MAX_JOBS];
+int shot_count = 0;
+char shot_message[SCREENSHOT_NAME_LENGTH + 32] = "";  // Result of the last screenshot finished
+
+// Batch modes for spreading the sampling over many processes
+// A worker samples a fixed number of orbits from a seed and writes its partial histogram
+// A reducer sums the partial histograms given as arguments and writes the image
+const char *worker_filename = NULL;  // NULL if not a worker, "-" for standard output
+unsigned int worker_seed = 0;
+long long worker_samples = 1000000;
+int worker_threads = 1;  // Threads sampling the orbits of a worker, each from its own seed
+bool is_numa = 0;  // Pin the threads of a worker to the NUMA nodes of the machine with a shard of the plot on each node
+bool is_reducer = 0;
+char **partial_filenames = NULL;
+int partial_count = 0;
+
+// How the viewer draws to the terminal, chosen from the environment when term_auto
+bool term_auto = 1;
+term_mode_t term_mode = TERM_CELLS;
+term_color_t term_color = TERM_COLOR_256;
+term_t screen;
+// Rows at the bottom of the terminal left to ncurses for the labels
+#define LABEL_ROWS 3
+
+// Keys of options without a short name
+#define OPT_TERM 256
+#define OPT_FORMAT 257
+#define OPT_NUMA 258
+#define OPT_TONE 259
+#define OPT_DEPTH 260
 
 error_t parse_opt(int key, char *arg, struct argp_state *state){
 	double real, imag;
+	char *rng;
 	switch(key){
 		// Provide maximum number of iterations
 		case 'n':
-			if(sscanf(arg, " %i", &max_iters) < 1){
+			if(sscanf(arg, " %i", &ranges[0].max) < 1){
 				printf("Invalid input for maximum iterations, must be an integer: \"%s\"", arg);
 				argp_usage(state);
 			}
 		break;
 		// Provide minimum length of orbit that will be used
 		case 'm':
-			if(sscanf(arg, " %i", &min_iters) < 1){
+			if(sscanf(arg, " %i", &ranges[0].min) < 1){
 				printf("Invalid input for minimum iterations, must be an integer: \"%s\"", arg);
 				argp_usage(state);
 			}
@@ -57,6 +137,10 @@ error_t parse_opt(int key, char *arg, struct argp_state *state){
 		break;
 		case 'T': rule.trans = conj;  // Tricorn: z_(n+1) = conj(z_n) ^ p + c
 		break;
+		case 'f': // Iterate formula instead
+			if(!formula_compile(arg, &formula)) argp_usage(state);
+			rule.formula = &formula;
+		break;
 		
 		// Set Power
 		case 'p':
@@ -95,23 +179,159 @@ error_t parse_opt(int key, char *arg, struct argp_state *state){
 				argp_usage(state);
 			}
 		break;
-		// Set gamm value
+		// Set gamm value of every channel
 		case 'g':
-			if(sscanf(arg, " %lf", &gamm) < 1){
+			if(sscanf(arg, " %lf", &gamm[0]) < 1){
 				printf("Invalid gamm, must be floating point: \"%s\"\n", arg);
 				argp_usage(state);
 			}
+			gamm[1] = gamm[2] = gamm[0];
+		break;
+		// Set gamm value of each channel separately
+		case 'G':
+			if(sscanf(arg, " %lf,%lf,%lf", &gamm[0], &gamm[1], &gamm[2]) < PLOT_MAX_CHANNELS){
+				printf("Invalid channel gamms, must be GAMMA,GAMMA,GAMMA : \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		// Set curve applied before gamma
+		case OPT_TONE:
+			if(!tone_curve_parse(arg, &tone_curve)){
+				printf("Invalid tone curve, must be gamma, log, or equalize: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		
+		// Plot the anti-Buddhabrot
+		case 'A':
+			is_anti = 1;
+		break;
+		
+		// Set ranges of orbit lengths for multiple channels
+		case 'N':
+			rng = arg;
+			for(channels = 0; channels < PLOT_MAX_CHANNELS; channels++){
+				if(sscanf(rng, " %i:%i", &ranges[channels].min, &ranges[channels].max) < 2) break;
+				
+				// Move onto the range of the next channel
+				if(!(rng = strchr(rng, ','))){
+					channels++;
+					break;
+				}
+				rng++;
+			}
+			
+			if(channels == 0 || rng){
+				printf("Invalid channel ranges, must be MIN:MAX[,MIN:MAX[,MIN:MAX]] : \"%s\"\n", arg);
+				argp_usage(state);
+			}
 		break;
 		
 		case 's': // Set screenshot filename
 			strncpy(screenshot_filename, arg, SCREENSHOT_NAME_LENGTH);
 		break;
+		case OPT_FORMAT: // Set format of screenshots
+			if(!image_format_parse(arg, &image_format) || image_format == IMAGE_PFM){
+				printf("Invalid format, must be png, ppm, pam, or counts: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+			format_set = 1;
+		break;
+		case OPT_DEPTH: // Set bits of each channel of screenshots
+			if(sscanf(arg, " %i", &image_depth) < 1 || (image_depth != 8 && image_depth != 16)){
+				printf("Invalid depth, must be 8 or 16: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
 		case 'd': // Set dimensions of plot
 			if(sscanf(arg, " %i,%i", &plot.area.columns, &plot.area.rows) < 2){
 				printf("Invalid plot dimensions, should be COLUMNS,ROWS: \"%s\"\n", arg);
 				argp_usage(state);
 			}
 		break;
+		case 'Z': // Use sparse plot
+			is_sparse = 1;
+		break;
+		case 'X': // Classify params using seed map file
+			seedmap_filename = arg;
+		break;
+		case 'F': // Fit farm to accepted params
+			farm_size = FARM_DEFAULT_SIZE;
+			if(arg && (sscanf(arg, " %i", &farm_size) < 1 || farm_size < 1)){
+				printf("Invalid number of cells, must be a positive integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		
+		case 'W': // Run as worker writing partial histogram to file
+			worker_filename = arg;
+		break;
+		case 'S': // Set seed of worker
+			if(sscanf(arg, " %u", &worker_seed) < 1){
+				printf("Invalid seed, must be a non-negative integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		case 'K': // Set number of orbits sampled by worker
+			if(sscanf(arg, " %lli", &worker_samples) < 1 || worker_samples < 0){
+				printf("Invalid number of samples, must be a non-negative integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		case 't': // Set number of threads of worker
+			if(sscanf(arg, " %i", &worker_threads) < 1 || worker_threads < 1){
+				printf("Invalid number of threads, must be a positive integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		case OPT_NUMA: // Pin threads of worker to NUMA nodes
+			is_numa = 1;
+		break;
+		case 'R': // Run as reducer
+			is_reducer = 1;
+		break;
+		case ARGP_KEY_ARGS: // Partial histograms given to reducer
+			partial_filenames = state->argv + state->next;
+			partial_count = state->argc - state->next;
+		break;
+		case ARGP_KEY_END:
+			if(is_reducer && partial_count == 0){
+				printf("Reducer requires at least one partial histogram\n");
+				argp_usage(state);
+			}
+			if(!is_reducer && partial_count > 0){
+				printf("Partial histograms can only be given to the reducer (-R)\n");
+				argp_usage(state);
+			}
+			if(is_anti && seedmap_filename){
+				printf("Seed maps (-X) classify escaping orbits and can't be used with the anti-Buddhabrot (-A)\n");
+				argp_usage(state);
+			}
+			// Formulas which are one of the provided rules use their kernels
+			if(rule.formula) formula_rule(&formula, &rule);
+			if(rule.formula && seedmap_filename){
+				printf("Seed maps (-X) only record the provided rules and can't be used with a formula (-f)\n");
+				argp_usage(state);
+			}
+			if(worker_threads > 1 && seedmap_filename){
+				printf("Seed maps (-X) are updated by every orbit sampled and can't be shared by the threads of a worker (-t)\n");
+				argp_usage(state);
+			}
+			
+			if(!format_set) image_format = image_format_guess(screenshot_filename);
+			if(image_format == IMAGE_PFM) image_format = IMAGE_PNG;
+			if(image_depth == 16 && image_format != IMAGE_PNG){
+				printf("16-bit screenshots (--depth 16) can only be written as png\n");
+				argp_usage(state);
+			}
+		break;
+		
+		case OPT_TERM: // Set how the terminal is drawn to
+			if(!term_parse(arg, &term_auto, &term_mode, &term_color)){
+				printf("Invalid terminal mode, must be auto, cells, half, or braille optionally followed by ,256 or ,true : \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
 		default: return ARGP_ERR_UNKNOWN;
 	}
 	return 0;
@@ -125,16 +345,33 @@ struct argp_option options[] = {
 	{"mandel", 'M', 0, 0, "Use the standard mandelbrot rule for generation i.e. z_(n+1) = z_n ^ p + c (Standard)", 2},
 	{"burning-ship", 'B', 0, 0, "Use the burning ship rule for generation i.e. z_(n+1) = (|Re{z_n}| + i * |Im{z_n}|) ^ p + c", 2},
 	{"tricorn", 'T', 0, 0, "Use the tricorn rule for generation i.e. z_(n+1) = conj(z_n) ^ p + c", 2},
+	{"formula", 'f', "EXPR", 0, "Iterate z_(n+1) = EXPR of z_n and c instead of the rules above, replacing -M, -B, -T, and -p (see below for formulas)", 2},
 	{"position", 'z', "REAL[,IMAG]", 0, "Specify center of window when first starting  (default: 0 + 0i)", 3},
 	{"window", 'w', "WIDTH,HEIGHT", 0, "Provide width and height (in complex plane, floating-point) of window  (default: 2, 2)", 3},
 	{"gamma", 'g', "GAMMA", 0, "Power to raise normalized bin count to in order to obtain greyscale  (default: 0.5)", 3},
-	{"screenshot", 's', "FILE", 0, "File Path to store screenshots in (default: fractal_screenshot.png)", 4},
+	{"channel-gamma", 'G', "RED,GREEN,BLUE", 0, "Provide separate gamma for each channel of a nebulabrot", 3},
+	{"tone", OPT_TONE, "CURVE", 0, "Curve mapping bin counts to brightness before the gamma: gamma (count over the maximum), log (log of count over log of the maximum), or equalize (fraction of the nonempty bins with at most the count)  (default: gamma)", 3},
+	{"term", OPT_TERM, "MODE[,COLORS]", 0, "Draw the viewer with cells (characters and color pairs), half (half blocks, two pixels per cell), or braille (two by four dots per cell) in 256 or true colors, where auto chooses from the terminal  (default: auto)", 3},
+	{"anti", 'A', 0, 0, "Plot the anti-Buddhabrot from the orbits which never escape, where each channel counts the iterations of the orbit from its minimum up to its maximum", 1},
+	{"nebula", 'N', "MIN:MAX[,MIN:MAX[,MIN:MAX]]", 0, "Accumulate orbits with lengths in each range into the red, green, and blue channels respectively, all from the same orbits (overrides -m and -n)", 1},
+	{"screenshot", 's', "FILE", 0, "File Path to store screenshots in, - for standard output when reducing (default: buddha_screenshot.png)", 4},
+	{"format", OPT_FORMAT, "FORMAT", 0, "Write screenshots as png, ppm (binary RGB), pam (RGB with a PAM header), or counts (the raw count of every bin, see below) instead of the format given by the extension of the screenshot file", 4},
+	{"depth", OPT_DEPTH, "BITS", 0, "Bits of each channel of PNG screenshots, 8 or 16 for the dynamic range of plots with many orbits  (default: 8)", 4},
 	{"dimensions", 'd', "COLUMNS,ROWS", 0, "Provide number of rows and columns in plot  (default: 1000, 1000)", 4},
+	{"sparse", 'Z', 0, 0, "Store the plot in tiles which are only allocated once points land in them and which widen their counts as needed, saving memory when most bins stay empty or small", 4},
+	{"fit-farm", 'F', "CELLS", OPTION_ARG_OPTIONAL, "Only sample params from the cells of a CELLS by CELLS grid within the radius whose escape times show they can produce accepted orbits, found by a quick pass over the grid before sampling  (default: 128)", 4},
+	{"seed-map", 'X', "FILE", 0, "Classify params by the lengths of the orbits sampled from them so far, skipping most of those unlikely to be accepted and weighting the rest to keep the plot unbiased, loading the classification from FILE if it exists and adding what was sampled to FILE on exit", 4},
+	{"worker", 'W', "FILE", 0, "Sample orbits without opening the viewer and write the partial histogram to FILE (- for standard output), then exit", 5},
+	{"seed", 'S', "SEED", 0, "Seed of the random orbits sampled by a worker, give each worker its own  (default: 0)", 5},
+	{"samples", 'K', "COUNT", 0, "Number of orbits sampled by a worker  (default: 1000000)", 5},
+	{"threads", 't', "COUNT", 0, "Number of threads a worker samples with, splitting its orbits between seeds derived from its own  (default: 1)", 5},
+	{"numa", OPT_NUMA, 0, 0, "Pin the threads of a worker evenly to the NUMA nodes of the machine, each node adding to its own copy of the plot in its own memory, and only sum the copies once sampling is done", 5},
+	{"reduce", 'R', 0, 0, "Sum the partial histograms given as arguments (- for standard input) and save the image of the whole plot to the screenshot file, then exit", 5},
 	{0}
 };
 
 struct argp argp = {options, parse_opt,
-	"",
+	"\n-R PARTIAL...",
 	"Display and Navigate the Buddhabrot\v"
 	"Controls:\n"
 		"\tArrows / WASD / HJKL -- Move viewport around complex plane\n"
@@ -142,14 +379,23 @@ struct argp argp = {options, parse_opt,
 		"\t'[' / ']' -- Decrease Max Iterations / Increase Max Iterations\n"
 		"\t';' / '\"' -- Decrease Min Iterations / Increase Min Iterations\n"
 		"\t'-' / '+' -- Decrease Brightness / Increase Brightness\n"
+		"\tO -- Cycle Tone Curve (gamma, log, equalize)\n"
 		"\tF / G -- Decrease Plot Rate / Increase Plot Rate\n"
 		"\tC -- Clear Plot\n"
 		"\tB -- Clear and Redefine Plot Area as current window\n"
 		"\tP -- Pause / Play generation and plotting of orbits\n"
-		"\tY -- Take Screenshot of Window (stored to -s option)\n"
-		"\tU -- Take Screenshot of Whole Plot (stored to -s option)\n"
+		"\tY -- Take Screenshot of Window (stored to -s option) in the background\n"
+		"\tU -- Take Screenshot of Whole Plot (stored to -s option) in the background\n"
 		"\tQ -- Quit\n\n"
 		"Holding any Non-Assigned Key (e.g. Space Bar) speeds up generation and plotting of Orbits\n"
+	"\n"
+	"Formulas:\n"
+		"\tExpressions of z and c using numbers, i, pi, e, + - * / ^, (...), |...|, and the functions\n"
+		"\tsqrt exp log sin cos tan sinh cosh tanh conj rect abs re im, e.g. \"z^3 - z + c\" or \"sin(z) * c\"\n"
+	"\n"
+	"Counts:\n"
+		"\tA line of text \"buddha-counts 1 REAL IMAG WIDTH HEIGHT ROWS COLUMNS CHANNELS MIN:MAX... le|be\" giving the area in hexadecimal,\n"
+		"\tthen ROWS * COLUMNS 32-bit unsigned counts in little or big endian for each channel in turn, in row-major order\n"
 };
 
 
@@ -160,16 +406,59 @@ void draw_labels(complex mouse_loc, bool generating);
 // Takes value in the range [0, 28]
 // Clamped if outside range
 chtype degree_to_char(int value);
+// Get the table of the viewer for channel ch emptied for a new frame
+// Returns NULL if it could not be allocated
+tone_t *view_tone(int ch);
 
 // Draw values from plot to ncurses window
+// All channels are summed together and scaled using gamm
 void draw_plot(plot_t pl, viewport_t view, double gamm);
+// Draw plot to the terminal with several pixels per cell, colored like screenshots
+// Each channel is scaled by its own entry of gamm
+void draw_plot_pixels(plot_t pl, viewport_t view, const double *gamm);
 // Save screenshot of plot to file only showing area in vw
-bool write_plot(const char *filename, plot_t pl, viewport_t vw, double gamm);
+// Each channel is scaled by its own entry of gamm
+// The percentage of rows written is sent as a byte to the file descriptor progress whenever it changes, unless it is negative
+bool write_plot(const char *filename, plot_t pl, viewport_t vw, const double *gamm, int progress);
+
+// Start writing a screenshot of the plot showing the area in vw in the background
+void take_screenshot(viewport_t vw);
+// Collect the progress of the screenshots and the results of those which finished
+void poll_screenshots();
+// Wait for every screenshot to finish
+void finish_screenshots();
+
+// Set the farm to sample from, fitting it to the given ranges of orbit lengths if requested
+void fit_farm(const range_t *rngs);
+// Load and save the seed map from the file given by the options, if any
+// Returns true if successful ; false if error
+bool load_seeds();
+bool save_seeds();
+
+// Sample the orbits of a worker and write its partial histogram
+// Returns true if successful ; false if error
+bool run_worker();
+// Sum the partial histograms and write the image of the whole plot
+// Returns true if successful ; false if error
+bool run_reducer();
 
 int main(int argc, char *argv[]){
 	argp_parse(&argp, argc, argv, 0, NULL, NULL);
 	
-	// Ncurses Init
+	// Batch modes run without opening the viewer
+	if(worker_filename) return run_worker() ? 0 : 1;
+	if(is_reducer) return run_reducer() ? 0 : 1;
+	
+	// Find params to sample from before the terminal is taken over by ncurses
+	fit_farm(ranges);
+	if(!load_seeds()){
+		farm_free(farm);
+		seedmap_free(seeds);
+		return 1;
+	}
+	
+	// Ncurses Init, using the locale of the environment so blocks and braille can be drawn
+	setlocale(LC_ALL, "");
 	initscr();
 	curs_set(0);
 	noecho();
@@ -184,31 +473,37 @@ int main(int argc, char *argv[]){
 	init_pair(4, COLOR_CYAN, COLOR_WHITE);
 	init_pair(5, COLOR_BLACK, COLOR_CYAN);
 	
+	// Plot is drawn directly to the terminal unless using the characters and color pairs of ncurses
+	if(term_auto) term_detect(COLORS, &term_mode, &term_color);
+	screen = term_init(term_mode, term_color);
+	refresh();
+	
 	// Configure plot area and Allocate grid
 	view.rows = plot.area.rows;
 	view.columns = plot.area.columns;
-	plot.area = view;
-	plot.grid = malloc(sizeof(unsigned int) * plot.area.rows * plot.area.columns);
-	
-	// Define area from which to draw points randomly to generate orbits
-	viewport_t farm = {-2 + 2*I, 4, 4, 0, 0};
+	plot = (is_sparse ? plot_init_sparse : plot_init)(view.corner + view.width / 2 - view.height / 2 * I, view.width, view.height, view.rows, view.columns, channels, ranges);
 	
 	// Accept mouse events
 	mousemask(ALL_MOUSE_EVENTS, NULL);
 	MEVENT evt;
 	complex mouse_loc = 0;
 	
-	int c;
+	int c, i;
 	bool running = 1, generating = 1;
 	while(running){
 		// Generate and plot new orbits
-		if(generating) plotted += plot_rand(plot, farm, rule, min_iters, max_iters, (int)plots_per_sec);
+		if(generating) plotted += (is_anti ? plot_anti : plot_rand)(plot, &farm, rule, (int)plots_per_sec);
 		
 		// Draw Plot
-		draw_plot(plot, view, gamm);
+		if(term_mode == TERM_CELLS) draw_plot(plot, view, gamm[0]);
+		else draw_plot_pixels(plot, view, gamm);
+		poll_screenshots();
 		draw_labels(mouse_loc, generating);
 		refresh();
 		
+		// Wake up regularly while paused to update the progress of screenshots
+		if(!generating) timeout(shot_count > 0 ? 250 : -1);
+		
 		// Get Keyboard command
 		c = getch();
 		switch(c){
@@ -243,32 +538,49 @@ int main(int argc, char *argv[]){
 				view.height *= 0.9;
 			break;
 			
-			// Decrease minimum orbit length threshold
+			// Decrease minimum orbit length threshold of every channel
 			case ';': case ':':
-				min_iters -= 10;
-				if(min_iters < -1) min_iters = -10;
+				for(i = 0; i < plot.channels; i++){
+					plot.ranges[i].min -= 10;
+					if(plot.ranges[i].min < -1) plot.ranges[i].min = -10;
+				}
+				if(farm_size) fit_farm(plot.ranges);
 			break;
-			// Increase minimum orbit length threshold
+			// Increase minimum orbit length threshold of every channel
 			case '\'': case '"':
-				min_iters += 10;
-				if(min_iters > max_iters) min_iters = max_iters - 1;
+				for(i = 0; i < plot.channels; i++){
+					plot.ranges[i].min += 10;
+					if(plot.ranges[i].min > plot.ranges[i].max) plot.ranges[i].min = plot.ranges[i].max - 1;
+				}
+				if(farm_size) fit_farm(plot.ranges);
 			break;
 			
-			// Decrease number of iterations performed
+			// Decrease number of iterations performed for every channel
 			case '{': case '[':
-				max_iters -= 10;
-				if(max_iters < min_iters) max_iters = min_iters + 1;
+				for(i = 0; i < plot.channels; i++){
+					plot.ranges[i].max -= 10;
+					if(plot.ranges[i].max < plot.ranges[i].min) plot.ranges[i].max = plot.ranges[i].min + 1;
+				}
+				if(farm_size) fit_farm(plot.ranges);
 			break;
-			// Increase number of iterations performed
+			// Increase number of iterations performed for every channel
 			case '}': case ']':
-				max_iters += 10;
+				for(i = 0; i < plot.channels; i++) plot.ranges[i].max += 10;
+				if(farm_size) fit_farm(plot.ranges);
 			break;
 			
 			// Decrease Gamma to Increase Brightness
-			case '=': case '+': gamm /= 1.1;
+			case '=': case '+':
+				for(i = 0; i < PLOT_MAX_CHANNELS; i++) gamm[i] /= 1.1;
 			break;
 			// Increase Gamma to Decrease Brightness
-			case '-': case '_': gamm *= 1.1;
+			case '-': case '_':
+				for(i = 0; i < PLOT_MAX_CHANNELS; i++) gamm[i] *= 1.1;
+			break;
+			
+			// Cycle through the tone curves
+			case 'o': case 'O':
+				tone_curve = (tone_curve + 1) % (TONE_EQUALIZE + 1);
 			break;
 			
 			// Clear Plot of all points
@@ -308,14 +620,19 @@ int main(int argc, char *argv[]){
 			
 			// Save screenshot of Current Window
 			case 'y': case 'Y':
-				write_plot(screenshot_filename, plot, view, gamm);
+				take_screenshot(view);
 			break;
 			// Save screenshot of Whole Plot
 			case 'u': case 'U':
-				write_plot(screenshot_filename, plot, plot.area, gamm);
+				take_screenshot(plot.area);
 			break;
 			
 			
+			// Terminal is cleared by ncurses when resized
+			case KEY_RESIZE:
+				term_invalidate(&screen);
+			break;
+			
 			// Calculate mouse position
 			case KEY_MOUSE:
 				if(getmouse(&evt) == OK){
@@ -333,28 +650,46 @@ int main(int argc, char *argv[]){
 	
 	// End Ncurses
 	endwin();
+	term_free(&screen);
+	finish_screenshots();
+	for(int ch = 0; ch < PLOT_MAX_CHANNELS; ch++) tone_free(view_tones[ch]);
 	
-	return 0;
+	bool success = save_seeds();
+	farm_free(farm);
+	seedmap_free(seeds);
+	seedmap_free(seeds_loaded);
+	return success ? 0 : 1;
 }
 
 void draw_labels(complex mouse_loc, bool generating){
 	int rows, cols;
 	getmaxyx(stdscr, rows, cols);
 	
-	mvprintw(rows - 2, 0, " Min, Max Iters: %i, %i     Points Plotted: %i     Plots per Second: %i",
-		min_iters, max_iters,
+	// Labels are not drawn over the plot when it is drawn outside of ncurses, so clear their rows
+	if(term_mode != TERM_CELLS){
+		move(rows - LABEL_ROWS, 0);
+		clrtobot();
+	}
+	
+	mvprintw(rows - 2, 0, " Min, Max Iters:");
+	for(int ch = 0; ch < plot.channels; ch++) printw(" %i, %i%s", plot.ranges[ch].min, plot.ranges[ch].max, ch + 1 < plot.channels ? " /" : "");
+	printw("     Points Plotted: %i     Plots per Second: %i",
 		plotted,
 		(int)plots_per_sec
 	);
+	if(farm.seeds) printw("     Params Skipped: %.1lf%%", 100 * seedmap_skipped(farm.seeds));
 	
-	mvprintw(rows - 1, 0, " Mouse: %lf + %lf * i     Window: (%lf, %lf)     Plot: (%lf, %lf)     Gamma: %lf ",
+	mvprintw(rows - 1, 0, " Mouse: %lf + %lf * i     Window: (%lf, %lf)     Plot: (%lf, %lf)     Gamma: %lf     Tone: %s ",
 		creal(mouse_loc), cimag(mouse_loc),
 		view.width, view.height,
 		plot.area.width, plot.area.height,
-		gamm
+		gamm[0], tone_curve_names[tone_curve]
 	);
 	
-	if(!generating) mvprintw(rows - 3, 0, " (Paused) ");
+	move(rows - 3, 0);
+	if(!generating) printw(" (Paused) ");
+	if(shot_message[0]) printw(" %s ", shot_message);
+	for(int i = 0; i < shot_count; i++) printw(" Screenshot: %i%% ", shots[i].percent);
 }
 
 
@@ -369,6 +704,13 @@ chtype degree_to_char(int value){
 	return (chtype)(chrseq[value % 7]) | COLOR_PAIR(value / 7 + 1);
 }
 
+tone_t *view_tone(int ch){
+	tone_t *tn = view_tones + ch;
+	if(!tn->lut) *tn = tone_init(tone_curve);
+	else if(!tone_reset(tn, tone_curve)) return NULL;
+	return tn->lut ? tn : NULL;
+}
+
 void draw_plot(plot_t pl, viewport_t view, double gamm){
 	int width, height;
 	getmaxyx(stdscr, height, width);
@@ -385,46 +727,162 @@ void draw_plot(plot_t pl, viewport_t view, double gamm){
 	maxc = (int)((creal(view.corner - pl.area.corner) + view.width) * pl.area.columns / pl.area.width);
 	
 	// Transfer counts from plot to bins
-	int x, y, r, c;
-	unsigned int *val, maxval = 0;
+	int x, y, r, c, ch;
+	unsigned int *val;
 	for(r = minr; r < maxr; r++) for(c = minc; c < maxc; c++)
 	if(0 <= r && r < pl.area.rows && 0 < c && c < pl.area.columns){
 		x = (c - minc) * width / (maxc - minc);
 		y = (r - minr) * height / (maxr - minr);
 		
-		// Add values from plot to corresponding bin
+		// Add values from every channel of plot to corresponding bin
 		val = bins + y * width + x;
-		*val += plotat(pl, r, c);
-		
-		// Keep track of maximum value in bins
-		if(*val > maxval) maxval = *val;
+		for(ch = 0; ch < pl.channels; ch++) *val += plotch(pl, ch, r, c);
 	}
 	
+	// Map the bins onto the 29 degrees of characters
+	tone_t *tn = view_tone(0);
+	if(!tn) return;
+	for(int i = 0; i < width * height; i++) tone_add(*tn, bins[i]);
+	tone_build(tn, gamm, 29);
+	tone_map(tn, bins, width * height);
+	
 	// Draw out the bins
-	double scl;
 	for(y = 0; y < height; y++) for(x = 0; x < width; x++){
-		scl = (double)bins[y * width + x] / maxval;
-		scl = pow(scl, gamm);
-		mvaddch(y, x, degree_to_char((int)(scl * 29)));
+		mvaddch(y, x, degree_to_char(bins[y * width + x]));
 	}
 }
 
 
+void draw_plot_pixels(plot_t pl, viewport_t view, const double *gamm){
+	int rows, columns, cur_row, cur_col;
+	getmaxyx(stdscr, rows, columns);
+	int width = columns * term_sub_cols(term_mode), height = rows * term_sub_rows(term_mode);
+	
+	// Allocate bins of every channel and pixels to color them into
+	size_t sz = (size_t)width * height;
+	unsigned int *bins = calloc(sz * pl.channels, sizeof(unsigned int));
+	png_color *px = malloc(sizeof(png_color) * sz);
+	if(!bins || !px){
+		free(bins);
+		free(px);
+		return;
+	}
+	
+	// Calculate subsection of plot area to draw
+	int minr, minc, maxr, maxc;
+	minr = (int)(cimag(pl.area.corner - view.corner) * pl.area.rows / pl.area.height);
+	minc = (int)(creal(view.corner - pl.area.corner) * pl.area.columns / pl.area.width);
+	maxr = (int)((cimag(pl.area.corner - view.corner) + view.height) * pl.area.rows / pl.area.height);
+	maxc = (int)((creal(view.corner - pl.area.corner) + view.width) * pl.area.columns / pl.area.width);
+	
+	// Transfer counts of each channel from plot to bins
+	int x, y, r, c, ch;
+	for(r = minr; r < maxr; r++) for(c = minc; c < maxc; c++)
+	if(0 <= r && r < pl.area.rows && 0 <= c && c < pl.area.columns){
+		x = (c - minc) * width / (maxc - minc);
+		y = (r - minr) * height / (maxr - minr);
+		
+		for(ch = 0; ch < pl.channels; ch++) bins[ch * sz + y * width + x] += plotch(pl, ch, r, c);
+	}
+	
+	// Replace the bins of each channel by their brightnesses as in screenshots
+	tone_t *tn;
+	for(ch = 0; ch < pl.channels; ch++){
+		tn = view_tone(ch);
+		if(!tn){
+			free(bins);
+			free(px);
+			return;
+		}
+		for(size_t i = 0; i < sz; i++) tone_add(*tn, bins[ch * sz + i]);
+		tone_build(tn, gamm[ch], 255);
+		tone_map(tn, bins + ch * sz, sz);
+	}
+	
+	// Color the bins as in screenshots
+	for(size_t i = 0; i < sz; i++){
+		if(pl.channels == 1) px[i].red = px[i].green = px[i].blue = bins[i];
+		else{
+			px[i].red = bins[i];
+			px[i].green = bins[sz + i];
+			px[i].blue = pl.channels > 2 ? bins[2 * sz + i] : 0;
+		}
+	}
+	
+	// Leave the rows of the labels to ncurses
+	getyx(curscr, cur_row, cur_col);
+	term_draw(&screen, px, rows - LABEL_ROWS, columns, cur_row, cur_col);
+	
+	free(bins);
+	free(px);
+}
 
-// Take snapshot of plot at current view
+
+
+// Color columns [minc, maxc) of row r of the plot into row, mapping each channel through its table
+// Pixels are red, green, and blue of depth bits each, with 16-bit values big-endian as PNG stores them
+static void color_plot_row(plot_t pl, int r, int minc, int maxc, const tone_t *tones, int depth, png_bytep row){
+	unsigned int n, comp[PLOT_MAX_CHANNELS] = {0};
+	for(int c = minc; c < maxc; c++){
+		for(int ch = 0; ch < pl.channels; ch++){
+			n = plotch(pl, ch, r, c);
+			comp[ch] = tone_get(tones[ch], n);
+		}
+		
+		// Create greyscale from single channel or color from red, green, and blue channels
+		if(pl.channels == 1) comp[1] = comp[2] = comp[0];
+		for(int i = 0; i < 3; i++){
+			if(depth == 16) *row++ = comp[i] >> 8;
+			*row++ = comp[i];
+		}
+	}
+}
+
+// Send the percentage of done out of total rows to the file descriptor *progress when it changes from *percent
+// Stops sending by setting *progress negative if the pipe is closed
+static void send_progress(int *progress, unsigned char *percent, int done, int total){
+	if(*progress < 0 || done * 100 / total == *percent) return;
+	*percent = done * 100 / total;
+	if(write(*progress, percent, 1) < 0) *progress = -1;
+}
+
+// Write the image of rows [minr, maxr) and columns [minc, maxc) of the plot colored with the tables of each channel
 // Returns true if successful ; false if error
-bool write_plot(const char *filename, plot_t pl, viewport_t vw, double gamm){
-	FILE *fl = fopen(filename, "wb");
+static bool write_plot_image(const char *filename, plot_t pl, int minr, int minc, int maxr, int maxc, const tone_t *tones, int progress){
+	bool success;
+	int fd, r;
+	unsigned char percent = 0;
+	if(image_format != IMAGE_PNG){
+		// Uncompressed images are colored into one buffer which is written in a single call
+		png_color *px = malloc(sizeof(png_color) * (maxr - minr) * (maxc - minc));
+		if(!px){
+			fprintf(stderr, "Could not allocate image of %ix%i pixels\n", maxc - minc, maxr - minr);
+			return false;
+		}
+		for(r = minr; r < maxr; r++){
+			color_plot_row(pl, r, minc, maxc, tones, 8, (png_bytep)(px + (size_t)(r - minr) * (maxc - minc)));
+			send_progress(&progress, &percent, r - minr + 1, maxr - minr);
+		}
+		
+		success = (fd = image_open(filename)) >= 0;
+		success = success && write_pnm(fd, image_format, px, maxc - minc, maxr - minr);
+		success = (fd < 0 || image_close(fd)) && success;
+		if(!success && fd >= 0) fprintf(stderr, "Could not write image to %s\n", filename);
+		free(px);
+		return success;
+	}
+	
+	bool is_stdout = strcmp(filename, "-") == 0;
+	FILE *fl = is_stdout ? stdout : fopen(filename, "wb");
 	if(!fl){
 		fprintf(stderr, "Could not open %s to write image\n", filename);
-		fclose(fl);
 		return false;
 	}
 	
 	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if(!png_ptr){
 		fprintf(stderr, "Could not allocate write struct\n");
-		fclose(fl);
+		if(!is_stdout) fclose(fl);
 		return false;
 	}
 	
@@ -432,64 +890,383 @@ bool write_plot(const char *filename, plot_t pl, viewport_t vw, double gamm){
 	if(!info_ptr){
 		fprintf(stderr, "Could not allocate info struct\n");
 		png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-		fclose(fl);
+		if(!is_stdout) fclose(fl);
 		return false;
 	}
 	
 	if(setjmp(png_jmpbuf(png_ptr))){
 		fprintf(stderr, "Error in PNG writing\n");
 		png_destroy_write_struct(&png_ptr, &info_ptr);
-		fclose(fl);
+		if(!is_stdout) fclose(fl);
 		return false;
 	}
 	
-	// Calculate subsection of plot area to draw
-	int minr, minc, maxr, maxc;
-	minr = (int)(cimag(pl.area.corner - vw.corner) * pl.area.rows / pl.area.height);
-	minc = (int)(creal(vw.corner - pl.area.corner) * pl.area.columns / pl.area.width);
-	maxr = (int)((cimag(pl.area.corner - vw.corner) + vw.height) * pl.area.rows / pl.area.height);
-	maxc = (int)((creal(vw.corner - pl.area.corner) + vw.width) * pl.area.columns / pl.area.width);
-	
 	// Create header for file
 	png_init_io(png_ptr, fl);
 	png_set_IHDR(png_ptr, info_ptr, maxc - minc, maxr - minr,
-		8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+		image_depth, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
 		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
 	);
 	
 	png_write_info(png_ptr, info_ptr);
 	
-	int r, c;
-	
-	// Get max from subsection of interest
-	unsigned int val, maxval = 0;
-	for(r = minr; r < maxr; r++) for(c = minc; c < maxc; c++){
-		val = plotat(pl, r, c);
-		if(val > maxval) maxval = val;
-	}
-	
-	double scl;
-	png_color px;
-	png_bytep row = png_malloc(png_ptr, (maxc - minc) * sizeof(png_color));
 	// Iterate through pixels
+	png_bytep row = png_malloc(png_ptr, (maxc - minc) * sizeof(png_color) * (image_depth / 8));
 	for(r = minr; r < maxr; r++){
-		for(c = minc; c < maxc; c++){
-			scl = (double)plotat(pl, r, c) / maxval;
-			scl = pow(scl, gamm);  // Scale results
-			
-			// Create greyscale from value
-			px.red = (int)(scl * 255);
-			px.green = (int)(scl * 255);
-			px.blue = (int)(scl * 255);
-			((png_color*)row)[c - minc] = px;
-		}
+		color_plot_row(pl, r, minc, maxc, tones, image_depth, row);
 		png_write_row(png_ptr, row);
+		send_progress(&progress, &percent, r - minr + 1, maxr - minr);
 	}
 	
 	png_write_end(png_ptr, NULL);  // End writing
 	png_free(png_ptr, row);
 	png_destroy_write_struct(&png_ptr, &info_ptr);
-	fclose(fl);  // Close file descriptor
 	
+	// Close file descriptor, or flush standard output
+	return is_stdout ? fflush(fl) == 0 : fclose(fl) == 0;
+}
+
+// Take snapshot of plot at current view
+// Returns true if successful ; false if error
+bool write_plot(const char *filename, plot_t pl, viewport_t vw, const double *gamm, int progress){
+	// Calculate subsection of plot area to draw
+	int minr, minc, maxr, maxc;
+	minr = (int)(cimag(pl.area.corner - vw.corner) * pl.area.rows / pl.area.height);
+	minc = (int)(creal(vw.corner - pl.area.corner) * pl.area.columns / pl.area.width);
+	maxr = (int)((cimag(pl.area.corner - vw.corner) + vw.height) * pl.area.rows / pl.area.height);
+	maxc = (int)((creal(vw.corner - pl.area.corner) + vw.width) * pl.area.columns / pl.area.width);
+	
+	bool success;
+	int fd;
+	if(image_format == IMAGE_COUNTS){
+		// Counts are only written for the bins within the plot
+		if(minr < 0) minr = 0;
+		if(minc < 0) minc = 0;
+		if(maxr > pl.area.rows) maxr = pl.area.rows;
+		if(maxc > pl.area.columns) maxc = pl.area.columns;
+		if(maxr < minr) maxr = minr;
+		if(maxc < minc) maxc = minc;
+		
+		if((fd = image_open(filename)) < 0) return false;
+		success = plot_write_counts(fd, pl, minr, minc, maxr, maxc);
+		success = image_close(fd) && success;
+		if(!success) fprintf(stderr, "Could not write counts to %s\n", filename);
+		return success;
+	}
+	
+	// Build the table of each channel from subsection of interest
+	tone_t tones[PLOT_MAX_CHANNELS];
+	unsigned int val;
+	int r, c, ch;
+	for(ch = 0; ch < pl.channels; ch++){
+		tones[ch] = tone_init(tone_curve);
+		if(!tones[ch].lut){
+			fprintf(stderr, "Could not allocate tone table\n");
+			while(ch-- > 0) tone_free(tones[ch]);
+			return false;
+		}
+		for(r = minr; r < maxr; r++) for(c = minc; c < maxc; c++){
+			val = plotch(pl, ch, r, c);
+			tone_add(tones[ch], val);
+		}
+		tone_build(tones + ch, gamm[ch], image_depth == 16 ? 65535 : 255);
+	}
+	
+	success = write_plot_image(filename, pl, minr, minc, maxr, maxc, tones, progress);
+	for(ch = 0; ch < pl.channels; ch++) tone_free(tones[ch]);
+	return success;
+}
+
+
+
+void take_screenshot(viewport_t vw){
+	if(strcmp(screenshot_filename, "-") == 0){
+		snprintf(shot_message, sizeof(shot_message), "Screenshots of the viewer can't be written to standard output");
+		return;
+	}
+	if(shot_count == SCREENSHOT_MAX_JOBS){
+		snprintf(shot_message, sizeof(shot_message), "Wait for a screenshot to finish first");
+		return;
+	}
+	
+	int fds[2];
+	if(pipe(fds) != 0){
+		snprintf(shot_message, sizeof(shot_message), "Could not start screenshot");
+		return;
+	}
+	
+	pid_t pid = fork();
+	if(pid == 0){
+		// Write to a temporary file first so that screenshots finishing together can't interleave
+		close(fds[0]);
+		char tmpname[SCREENSHOT_NAME_LENGTH + 16];
+		snprintf(tmpname, sizeof(tmpname), "%s.%i", screenshot_filename, (int)getpid());
+		bool success = write_plot(tmpname, plot, vw, gamm, fds[1]) && rename(tmpname, screenshot_filename) == 0;
+		
+		// Leave the terminal and buffers of the viewer alone
+		_exit(success ? 0 : 1);
+	}
+	
+	close(fds[1]);
+	if(pid < 0){
+		close(fds[0]);
+		snprintf(shot_message, sizeof(shot_message), "Could not start screenshot");
+		return;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	shots[shot_count++] = (screenshot_t){pid, fds[0], 0};
+}
+
+void poll_screenshots(){
+	unsigned char buf[128];
+	ssize_t len;
+	int status;
+	for(int i = 0; i < shot_count; i++){
+		// Keep the latest percentage sent
+		while((len = read(shots[i].progress, buf, sizeof(buf))) > 0) shots[i].percent = buf[len - 1];
+		if(waitpid(shots[i].pid, &status, WNOHANG) != shots[i].pid) continue;
+		
+		bool success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		snprintf(shot_message, sizeof(shot_message), success ? "Screenshot saved to %s" : "Could not save screenshot to %s", screenshot_filename);
+		close(shots[i].progress);
+		shots[i--] = shots[--shot_count];
+	}
+}
+
+void finish_screenshots(){
+	if(shot_count > 0) printf("Waiting for %i screenshot%s to be saved\n", shot_count, shot_count > 1 ? "s" : "");
+	for(int i = 0; i < shot_count; i++){
+		waitpid(shots[i].pid, NULL, 0);
+		close(shots[i].progress);
+	}
+	shot_count = 0;
+}
+
+void fit_farm(const range_t *rngs){
+	farm_free(farm);
+	farm = farm_size > 0 ? farm_fit(rule, channels, rngs, farm_size, is_anti) : farm_init(farm_area);
+	if(!seedmap_filename) return;
+	
+	// Classification is kept as long as the farm covers the same area
+	if(!seeds.cells || seeds.area.corner != farm.area.corner || seeds.area.width != farm.area.width || seeds.area.height != farm.area.height){
+		seedmap_free(seeds);
+		seeds = seedmap_init(farm.area, SEEDMAP_SIZE, SEEDMAP_SIZE, rule);
+	}
+	if(seeds.cells) farm.seeds = &seeds;
+}
+
+bool load_seeds(){
+	if(!farm.seeds) return true;
+	
+	// Start with an empty classification if there is no file yet, but not if it can't be read
+	FILE *fl = fopen(seedmap_filename, "rb");
+	if(!fl){
+		if(errno == ENOENT){
+			fprintf(stderr, "Starting new seed map %s\n", seedmap_filename);
+			return true;
+		}
+		fprintf(stderr, "Could not open %s to read seed map\n", seedmap_filename);
+		return false;
+	}
+	bool success = seedmap_load(fl, farm.seeds);
+	fclose(fl);
+	if(!success){
+		fprintf(stderr, "Could not load seed map from %s\n", seedmap_filename);
+		return false;
+	}
+	
+	// Keep what was loaded so that only the orbits sampled by this process are added when saving
+	seeds_loaded = *farm.seeds;
+	seeds_loaded.cells = malloc(sizeof(seed_cell_t) * seeds.area.rows * seeds.area.columns);
+	if(!seeds_loaded.cells){
+		fprintf(stderr, "Could not allocate seed map\n");
+		return false;
+	}
+	memcpy(seeds_loaded.cells, seeds.cells, sizeof(seed_cell_t) * seeds.area.rows * seeds.area.columns);
 	return true;
 }
+
+// Merge the classification with the file saved by other processes since it was loaded
+// Returns true if merged or there is nothing to merge with ; false if the file is for another farm and will be replaced
+static bool merge_seeds(){
+	FILE *fl = fopen(seedmap_filename, "rb");
+	if(!fl) return true;
+	
+	seedmap_t latest = seedmap_init(seeds.area, seeds.area.rows, seeds.area.columns, seeds.rule);
+	bool success = latest.cells && seedmap_load(fl, &latest);
+	fclose(fl);
+	
+	// A classification reset since loading, such as when the farm moved, has nothing in common with what was loaded
+	bool same_area = seeds_loaded.cells && seeds_loaded.area.corner == seeds.area.corner
+		&& seeds_loaded.area.width == seeds.area.width && seeds_loaded.area.height == seeds.area.height;
+	if(success) seedmap_merge(&seeds, same_area ? &seeds_loaded : NULL, &latest);
+	seedmap_free(latest);
+	return success;
+}
+
+bool save_seeds(){
+	if(!farm.seeds) return true;
+	
+	// Workers finishing together take turns through a lock file beside the map
+	// so that each one merges with the map left by those before it instead of replacing it
+	char tmpname[strlen(seedmap_filename) + 16];
+	snprintf(tmpname, sizeof(tmpname), "%s.lock", seedmap_filename);
+	int lock = open(tmpname, O_RDWR | O_CREAT, 0666);
+	if(lock < 0 || flock(lock, LOCK_EX) != 0){
+		fprintf(stderr, "Could not lock %s to write seed map\n", tmpname);
+		if(lock >= 0) close(lock);
+		return false;
+	}
+	if(!merge_seeds()) fprintf(stderr, "Replacing seed map %s\n", seedmap_filename);
+	
+	// Write to a file of this process then move it into place, so that the map is never seen half written
+	snprintf(tmpname, sizeof(tmpname), "%s.%i", seedmap_filename, (int)getpid());
+	FILE *fl = fopen(tmpname, "wb");
+	bool success = fl != NULL;
+	if(fl){
+		success = seedmap_save(fl, farm.seeds);
+		success = fclose(fl) == 0 && success;
+		success = success && rename(tmpname, seedmap_filename) == 0;
+	}
+	if(!success){
+		fprintf(stderr, "Could not write seed map to %s\n", seedmap_filename);
+		remove(tmpname);
+	}
+	close(lock);
+	return success;
+}
+
+// Thread of a worker sampling its share of the orbits into a shard of the plot
+typedef struct{
+	pthread_t tid;
+	bool started;  // Whether tid was started, otherwise the samples were taken on the main thread
+	int node;  // NUMA node to pin the thread to, -1 if not pinned
+	plot_t *shard;
+	unsigned int seed;
+	long long samples;
+} sampler_t;
+
+static void *run_sampler(void *arg){
+	sampler_t *sp = arg;
+	if(sp->node >= 0) node_pin(sp->node);
+	
+	// Sample in batches to keep the count of each call within an int
+	long long left;
+	int batch;
+	for(left = sp->samples; left > 0; left -= batch){
+		batch = left > 1000000 ? 1000000 : (int)left;
+		(is_anti ? plot_anti_r : plot_rand_r)(*sp->shard, &farm, rule, batch, &sp->seed);
+	}
+	return NULL;
+}
+
+bool run_worker(){
+	fit_farm(ranges);
+	if(!load_seeds()){
+		farm_free(farm);
+		seedmap_free(seeds);
+		return false;
+	}
+	
+	// Threads share the dense shard of their node, adding to it atomically, while sparse plots give each thread its own
+	// The grids are only mapped here, so their pages are placed on the nodes of the threads which first add to them
+	int nodes = is_numa ? node_count() : 1;
+	int shard_count = is_sparse || nodes > worker_threads ? worker_threads : nodes;
+	plot_t *shards = calloc(shard_count, sizeof(plot_t));
+	sampler_t *samplers = malloc(sizeof(sampler_t) * worker_threads);
+	bool success = shards && samplers;
+	for(int i = 0; success && i < shard_count; i++){
+		shards[i] = (is_sparse ? plot_init_sparse : plot_init)(view.corner + view.width / 2 - view.height / 2 * I, view.width, view.height, plot.area.rows, plot.area.columns, channels, ranges);
+		shards[i].shared = !is_sparse && shard_count < worker_threads;
+		success = shards[i].grid || shards[i].tiles;
+	}
+	if(!success){
+		fprintf(stderr, "Could not allocate plot of worker\n");
+		for(int i = 0; shards && i < shard_count; i++) plot_free(shards[i]);
+		free(shards);
+		free(samplers);
+		farm_free(farm);
+		return false;
+	}
+	
+	// The first thread keeps the seed of the worker so that a single thread repeats the orbits of earlier versions
+	// Seeds of the rest are spread by the golden ratio so that they don't run into those of workers given neighboring seeds
+	for(int i = 0; i < worker_threads; i++){
+		sampler_t *sp = samplers + i;
+		*sp = (sampler_t){0, true, is_numa ? node_of(i, worker_threads) : -1, shards + (long long)i * shard_count / worker_threads, worker_seed + i * 0x9e3779b9u,
+			worker_samples * (i + 1) / worker_threads - worker_samples * i / worker_threads};
+		if(pthread_create(&sp->tid, NULL, run_sampler, sp)){
+			sp->started = false;
+			sp->node = -1;
+			run_sampler(sp);
+		}
+	}
+	for(int i = 0; i < worker_threads; i++) if(samplers[i].started) pthread_join(samplers[i].tid, NULL);
+	
+	// Shards are only summed once at the end, crossing between nodes a single time
+	plot = shards[0];
+	plot.shared = false;
+	for(int i = 1; i < shard_count; i++){
+		plot_sum(plot, shards[i]);
+		plot_free(shards[i]);
+	}
+	free(shards);
+	free(samplers);
+	
+	bool is_stdout = strcmp(worker_filename, "-") == 0;
+	FILE *fl = is_stdout ? stdout : fopen(worker_filename, "wb");
+	if(!fl){
+		fprintf(stderr, "Could not open %s to write partial histogram\n", worker_filename);
+		plot_free(plot);
+		farm_free(farm);
+		return false;
+	}
+	
+	success = plot_save(fl, plot, worker_samples);
+	if(is_stdout) success = fflush(fl) == 0 && success;
+	else success = fclose(fl) == 0 && success;
+	if(!success) fprintf(stderr, "Could not write partial histogram to %s\n", worker_filename);
+	
+	// Classification is saved along with the histogram for later workers
+	success = save_seeds() && success;
+	
+	plot_free(plot);
+	farm_free(farm);
+	seedmap_free(seeds);
+	seedmap_free(seeds_loaded);
+	return success;
+}
+
+bool run_reducer(){
+	plot_t sum = {{0}, 0, NULL, NULL, NULL};
+	long long samples = 0;
+	bool success = true;
+	
+	FILE *fl;
+	bool is_stdin;
+	for(int i = 0; i < partial_count && success; i++){
+		is_stdin = strcmp(partial_filenames[i], "-") == 0;
+		fl = is_stdin ? stdin : fopen(partial_filenames[i], "rb");
+		if(!fl){
+			fprintf(stderr, "Could not open %s to read partial histogram\n", partial_filenames[i]);
+			success = false;
+			break;
+		}
+		
+		// Standard input may hold many partial histograms one after another
+		do{
+			success = plot_merge(fl, &sum, &samples);
+			if(!success) fprintf(stderr, "Could not read partial histogram from %s\n", partial_filenames[i]);
+		}while(success && is_stdin && ungetc(getc(fl), fl) != EOF);
+		
+		if(!is_stdin) fclose(fl);
+	}
+	
+	if(success){
+		success = write_plot(screenshot_filename, sum, sum.area, gamm, -1);
+		if(success) fprintf(strcmp(screenshot_filename, "-") == 0 ? stderr : stdout, "Plot of %lli orbits saved to %s\n", samples, screenshot_filename);
+	}
+	
+	if(sum.channels) plot_free(sum);
+	return success;
+}
@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "formula.h"
+
+
+/* Formulas are parsed into a graph of nodes which is simplified as it is built
+ * Nodes are only ever added, so the operands of a node always come before it in the pool
+ * Operations are those of the bytecode along with constants and the variables z and c
+ */
+enum{
+	NODE_CONST = FOP_IM + 1,
+	NODE_Z,
+	NODE_C
+};
+
+#define MAX_NODES 256
+
+typedef struct{
+	int op;
+	int a, b;  // Operands
+	complex val;  // Value of a constant or real factor of FOP_SCALE
+	int deg;  // Polynomial degree in z or -1 if not a polynomial
+	
+	int uses;  // Number of nodes using this one as an operand
+	int reg;  // Register holding the value once compiled, -1 before
+	
+	int base, exp;  // Node raised to the integer power exp > 1 which was expanded into this one, exp is 0 otherwise
+} node_t;
+
+typedef struct{
+	const char *src, *pos;
+	node_t nodes[MAX_NODES];
+	int count;
+	bool failed;
+} parser_t;
+
+// Functions which can be applied to a parenthesized argument
+static const struct{
+	const char *name;
+	int op;
+} functions[] = {
+	{"sqrt", FOP_SQRT}, {"exp", FOP_EXP}, {"log", FOP_LOG},
+	{"sin", FOP_SIN}, {"cos", FOP_COS}, {"tan", FOP_TAN},
+	{"sinh", FOP_SINH}, {"cosh", FOP_COSH}, {"tanh", FOP_TANH},
+	{"conj", FOP_CONJ}, {"rect", FOP_RECT}, {"abs", FOP_ABS},
+	{"re", FOP_RE}, {"im", FOP_IM}
+};
+#define FUNCTION_COUNT (int)(sizeof(functions) / sizeof(functions[0]))
+
+// Report error at the current position, only the first error is printed
+static int parse_error(parser_t *ps, const char *msg){
+	if(!ps->failed) fprintf(stderr, "Invalid formula \"%s\" at character %i: %s\n", ps->src, (int)(ps->pos - ps->src) + 1, msg);
+	ps->failed = true;
+	return -1;
+}
+
+
+
+// Calculate operation on constant values
+static complex eval_op(int op, complex a, complex b, complex c, double k){
+	switch(op){
+		case FOP_ADD: return a + b;
+		case FOP_SUB: return a - b;
+		case FOP_MUL: return a * b;
+		case FOP_DIV: return a / b;
+		case FOP_NEG: return -a;
+		case FOP_SCALE: return a * k;
+		case FOP_SQR: return a * a;
+		case FOP_SQRADD: return a * a + b;
+		case FOP_MULADD: return a * b + c;
+		case FOP_POW: return cpow(a, b);
+		case FOP_SQRT: return csqrt(a);
+		case FOP_EXP: return cexp(a);
+		case FOP_LOG: return clog(a);
+		case FOP_SIN: return csin(a);
+		case FOP_COS: return ccos(a);
+		case FOP_TAN: return ctan(a);
+		case FOP_SINH: return csinh(a);
+		case FOP_COSH: return ccosh(a);
+		case FOP_TANH: return ctanh(a);
+		case FOP_CONJ: return conj(a);
+		case FOP_RECT: return crect(a);
+		case FOP_ABS: return cabs(a);
+		case FOP_RE: return creal(a);
+		case FOP_IM: return cimag(a);
+	}
+	return 0;
+}
+
+// Number of operands of an operation
+static int op_arity(int op){
+	switch(op){
+		case FOP_ADD: case FOP_SUB: case FOP_MUL: case FOP_DIV: case FOP_SQRADD: case FOP_POW: return 2;
+		case FOP_MULADD: return 3;
+		case NODE_CONST: case NODE_Z: case NODE_C: return 0;
+		default: return 1;
+	}
+}
+
+// Polynomial degree in z of an operation on operands of degrees da and db or -1 if it is not a polynomial
+static int op_degree(int op, int da, int db){
+	switch(op){
+		case NODE_Z: return 1;
+		case NODE_C: case NODE_CONST: return 0;
+		case FOP_NEG: case FOP_SCALE: case FOP_CONJ: case FOP_RECT: return da;
+		case FOP_SQR: return da < 0 ? -1 : 2 * da;
+		case FOP_ADD: case FOP_SUB: case FOP_MUL: case FOP_DIV:
+			if(da < 0 || db < 0) return -1;
+			if(op == FOP_MUL) return da + db;
+			if(op == FOP_DIV) return db == 0 ? da : -1;
+			return da > db ? da : db;
+		default:
+			// Any other function of z is not a polynomial
+			return da == 0 && (op_arity(op) < 2 || db == 0) ? 0 : -1;
+	}
+}
+
+static int add_node(parser_t *ps, int op, int a, int b, complex val){
+	if(a < 0 || b < 0) return -1;
+	if(ps->count >= MAX_NODES) return parse_error(ps, "formula is too long");
+	int arity = op_arity(op);
+	int deg = op_degree(op, arity > 0 ? ps->nodes[a].deg : 0, arity > 1 ? ps->nodes[b].deg : 0);
+	ps->nodes[ps->count] = (node_t){op, a, b, val, deg, 0, -1};
+	return ps->count++;
+}
+
+static int node_const(parser_t *ps, complex val){
+	return add_node(ps, NODE_CONST, 0, 0, val);
+}
+
+// Check whether node n is the constant val
+static bool is_const(const parser_t *ps, int n, complex val){
+	return ps->nodes[n].op == NODE_CONST && ps->nodes[n].val == val;
+}
+
+static int node_binary(parser_t *ps, int op, int a, int b);
+
+// Build the node of a unary operation, simplifying where possible
+static int node_unary(parser_t *ps, int op, int a){
+	if(a < 0) return -1;
+	const node_t *na = ps->nodes + a;
+	
+	// Fold constants
+	if(na->op == NODE_CONST) return node_const(ps, eval_op(op, na->val, 0, 0, 0));
+	
+	if(op == FOP_NEG && na->op == FOP_NEG) return na->a;
+	if(op == FOP_NEG && na->op == FOP_SCALE) return add_node(ps, FOP_SCALE, na->a, 0, -na->val);
+	if(op == FOP_CONJ && na->op == FOP_CONJ) return na->a;
+	return add_node(ps, op, a, 0, 0);
+}
+
+// Build x^n for integer n > 0 by repeated squaring
+static int node_pow_int(parser_t *ps, int x, int n){
+	if(n == 1) return x;
+	int half = node_pow_int(ps, x, n / 2);
+	int sqr = node_unary(ps, FOP_SQR, half);
+	return n % 2 ? node_binary(ps, FOP_MUL, sqr, x) : sqr;
+}
+
+// Build the node of a binary operation, simplifying where possible
+static int node_binary(parser_t *ps, int op, int a, int b){
+	if(a < 0 || b < 0) return -1;
+	const node_t *na = ps->nodes + a, *nb = ps->nodes + b;
+	
+	// Fold constants
+	if(na->op == NODE_CONST && nb->op == NODE_CONST) return node_const(ps, eval_op(op, na->val, nb->val, 0, 0));
+	
+	switch(op){
+		case FOP_ADD:
+			if(is_const(ps, a, 0)) return b;
+			if(is_const(ps, b, 0)) return a;
+			if(nb->op == FOP_NEG) return node_binary(ps, FOP_SUB, a, nb->a);
+		break;
+		case FOP_SUB:
+			if(is_const(ps, b, 0)) return a;
+			if(is_const(ps, a, 0)) return node_unary(ps, FOP_NEG, b);
+			if(nb->op == FOP_NEG) return node_binary(ps, FOP_ADD, a, nb->a);
+		break;
+		case FOP_MUL:
+			// Keep any constant on the right
+			if(na->op == NODE_CONST) return node_binary(ps, FOP_MUL, b, a);
+			if(nb->op != NODE_CONST) break;
+			
+			if(nb->val == 0) return b;
+			if(nb->val == 1) return a;
+			if(nb->val == -1) return node_unary(ps, FOP_NEG, a);
+			if(cimag(nb->val) == 0){
+				// Combine real factors
+				if(na->op == FOP_SCALE) return add_node(ps, FOP_SCALE, na->a, 0, na->val * nb->val);
+				return add_node(ps, FOP_SCALE, a, 0, nb->val);
+			}
+		break;
+		case FOP_DIV:
+			if(nb->op == NODE_CONST) return node_binary(ps, FOP_MUL, a, node_const(ps, 1 / nb->val));
+		break;
+		case FOP_POW:
+			if(nb->op != NODE_CONST) break;
+			
+			complex p = nb->val;
+			if(p == 0) return node_const(ps, 1);
+			if(p == 0.5) return node_unary(ps, FOP_SQRT, a);
+			if(cimag(p) == 0 && creal(p) == floor(creal(p)) && fabs(creal(p)) <= 64){
+				int n = (int)creal(p);
+				int pw = node_pow_int(ps, a, abs(n));
+				if(pw >= 0 && n > 1){
+					ps->nodes[pw].base = a;
+					ps->nodes[pw].exp = n;
+				}
+				return n > 0 ? pw : node_binary(ps, FOP_DIV, node_const(ps, 1), pw);
+			}
+		break;
+	}
+	return add_node(ps, op, a, b, 0);
+}
+
+
+
+static void skip_space(parser_t *ps){
+	while(isspace((unsigned char)*ps->pos)) ps->pos++;
+}
+
+// Check whether the next character can start a factor multiplied without a *
+static bool starts_factor(parser_t *ps){
+	skip_space(ps);
+	char ch = *ps->pos;
+	return isalnum((unsigned char)ch) || ch == '.' || ch == '(';
+}
+
+static int parse_expr(parser_t *ps);
+static int parse_unary(parser_t *ps);
+
+// primary := NUMBER | NAME | NAME '(' expr ')' | '(' expr ')' | '|' expr '|'
+static int parse_primary(parser_t *ps){
+	skip_space(ps);
+	char ch = *ps->pos;
+	if(isdigit((unsigned char)ch) || ch == '.'){
+		char *end;
+		double val = strtod(ps->pos, &end);
+		if(end == ps->pos) return parse_error(ps, "expected a number");
+		ps->pos = end;
+		return node_const(ps, val);
+	}
+	
+	if(ch == '(' || ch == '|'){
+		ps->pos++;
+		int n = parse_expr(ps);
+		skip_space(ps);
+		if(*ps->pos != (ch == '(' ? ')' : '|')) return parse_error(ps, ch == '(' ? "expected ')'" : "expected '|'");
+		ps->pos++;
+		return ch == '(' ? n : node_unary(ps, FOP_ABS, n);
+	}
+	
+	if(!isalpha((unsigned char)ch)) return parse_error(ps, *ps->pos ? "unexpected character" : "unexpected end of formula");
+	
+	const char *name = ps->pos;
+	while(isalpha((unsigned char)*ps->pos)) ps->pos++;
+	size_t len = ps->pos - name;
+	
+	if(len == 1 && *name == 'z') return add_node(ps, NODE_Z, 0, 0, 0);
+	if(len == 1 && *name == 'c') return add_node(ps, NODE_C, 0, 0, 0);
+	if(len == 1 && *name == 'i') return node_const(ps, I);
+	if(len == 1 && *name == 'e') return node_const(ps, M_E);
+	if(len == 2 && strncmp(name, "pi", 2) == 0) return node_const(ps, M_PI);
+	
+	for(int f = 0; f < FUNCTION_COUNT; f++){
+		if(strlen(functions[f].name) != len || strncmp(functions[f].name, name, len) != 0) continue;
+		
+		skip_space(ps);
+		if(*ps->pos != '(') return parse_error(ps, "expected '(' after function");
+		ps->pos++;
+		int n = parse_expr(ps);
+		skip_space(ps);
+		if(*ps->pos != ')') return parse_error(ps, "expected ')'");
+		ps->pos++;
+		return node_unary(ps, functions[f].op, n);
+	}
+	
+	ps->pos = name;
+	return parse_error(ps, "unknown name");
+}
+
+// power := primary ['^' unary]
+static int parse_power(parser_t *ps){
+	int n = parse_primary(ps);
+	skip_space(ps);
+	if(*ps->pos != '^') return n;
+	
+	ps->pos++;
+	return node_binary(ps, FOP_POW, n, parse_unary(ps));
+}
+
+// unary := ('-' | '+') unary | power
+static int parse_unary(parser_t *ps){
+	skip_space(ps);
+	if(*ps->pos == '-'){
+		ps->pos++;
+		return node_unary(ps, FOP_NEG, parse_unary(ps));
+	}else if(*ps->pos == '+'){
+		ps->pos++;
+		return parse_unary(ps);
+	}
+	return parse_power(ps);
+}
+
+// term := unary (('*' | '/') unary | power)*
+static int parse_term(parser_t *ps){
+	int n = parse_unary(ps);
+	while(!ps->failed){
+		skip_space(ps);
+		if(*ps->pos == '*' || *ps->pos == '/'){
+			int op = *ps->pos++ == '*' ? FOP_MUL : FOP_DIV;
+			n = node_binary(ps, op, n, parse_unary(ps));
+		}else if(starts_factor(ps)) n = node_binary(ps, FOP_MUL, n, parse_power(ps));
+		else break;
+	}
+	return n;
+}
+
+// expr := term (('+' | '-') term)*
+static int parse_expr(parser_t *ps){
+	int n = parse_term(ps);
+	while(!ps->failed){
+		skip_space(ps);
+		if(*ps->pos != '+' && *ps->pos != '-') break;
+		
+		int op = *ps->pos++ == '+' ? FOP_ADD : FOP_SUB;
+		n = node_binary(ps, op, n, parse_term(ps));
+	}
+	return n;
+}
+
+
+
+// Emit the instructions calculating node n and return its register
+static int compile_node(parser_t *ps, formula_t *fm, int n){
+	node_t *nd = ps->nodes + n;
+	if(nd->reg >= 0) return nd->reg;
+	
+	switch(nd->op){
+		case NODE_Z: return nd->reg = 0;
+		case NODE_C: return nd->reg = 1;
+		case NODE_CONST:
+			// Share registers between equal constants
+			for(int r = 2; r < 2 + fm->consts; r++) if(fm->values[r] == nd->val) return nd->reg = r;
+			if(2 + fm->consts >= FORMULA_MAX_REGS) return -1;
+			fm->values[2 + fm->consts] = nd->val;
+			return nd->reg = 2 + fm->consts++;
+	}
+	
+	// Fuse a square or product used only by an addition into it
+	formula_instr_t in = {nd->op, 0, 0, 0, 0, creal(nd->val)};
+	int a = nd->a, b = nd->b, rc = 0;
+	if(nd->op == FOP_ADD){
+		if(ps->nodes[b].uses == 1 && (ps->nodes[b].op == FOP_SQR || ps->nodes[b].op == FOP_MUL)){
+			a = nd->b;
+			b = nd->a;
+		}
+		const node_t *na = ps->nodes + a;
+		if(na->uses == 1 && na->op == FOP_SQR){
+			in.op = FOP_SQRADD;
+			a = na->a;
+		}else if(na->uses == 1 && na->op == FOP_MUL){
+			in.op = FOP_MULADD;
+			rc = compile_node(ps, fm, b);
+			a = na->a;
+			b = na->b;
+		}
+	}
+	
+	int arity = op_arity(in.op);
+	int ra = compile_node(ps, fm, a), rb = arity > 1 ? compile_node(ps, fm, b) : 0;
+	if(ra < 0 || rb < 0 || rc < 0 || fm->count >= FORMULA_MAX_CODE || fm->regs >= FORMULA_MAX_REGS) return -1;
+	in.a = ra;
+	in.b = rb;
+	in.c = rc;
+	in.dst = fm->regs++;
+	fm->code[fm->count++] = in;
+	return nd->reg = in.dst;
+}
+
+// Count the uses of each node reachable from n and assign registers to the constants among them
+// so that the constants come before the temporary values
+static bool prepare_node(parser_t *ps, formula_t *fm, int n){
+	node_t *nd = ps->nodes + n;
+	if(nd->uses++ > 0) return true;
+	if(nd->op == NODE_CONST) return compile_node(ps, fm, n) >= 0;
+	
+	int arity = op_arity(nd->op);
+	if(arity > 0 && !prepare_node(ps, fm, nd->a)) return false;
+	if(arity > 1 && !prepare_node(ps, fm, nd->b)) return false;
+	return true;
+}
+
+// Recognize formulas which are one of the provided rules trans(z)^n + c for integers n > 0
+static void match_rule(const parser_t *ps, int root, formula_t *fm){
+	const node_t *nd = ps->nodes + root, *x, *base;
+	fm->trans = NULL;
+	fm->power = 0;
+	if(nd->op != FOP_ADD) return;
+	
+	if(ps->nodes[nd->b].op == NODE_C) x = ps->nodes + nd->a;
+	else if(ps->nodes[nd->a].op == NODE_C) x = ps->nodes + nd->b;
+	else return;
+	
+	base = x->exp ? ps->nodes + x->base : x;
+	if(base->op == NODE_Z) fm->trans = NULL;
+	else if(base->op == FOP_CONJ && ps->nodes[base->a].op == NODE_Z) fm->trans = conj;
+	else if(base->op == FOP_RECT && ps->nodes[base->a].op == NODE_Z) fm->trans = crect;
+	else return;
+	fm->power = x->exp ? x->exp : 1;
+}
+
+bool formula_compile(const char *src, formula_t *fm){
+	parser_t *ps = malloc(sizeof(parser_t));
+	if(!ps) return false;
+	ps->src = ps->pos = src;
+	ps->count = 0;
+	ps->failed = false;
+	
+	int root = parse_expr(ps);
+	skip_space(ps);
+	if(!ps->failed && *ps->pos) parse_error(ps, "unexpected character");
+	if(ps->failed || root < 0){
+		free(ps);
+		return false;
+	}
+	
+	fm->count = 0;
+	fm->consts = 0;
+	bool success = prepare_node(ps, fm, root);
+	fm->regs = 2 + fm->consts;
+	fm->result = success ? compile_node(ps, fm, root) : -1;
+	if(fm->result < 0){
+		ps->pos = src + strlen(src);
+		parse_error(ps, "formula is too long");
+		free(ps);
+		return false;
+	}
+	
+	// Every use of z comes before the last instruction, so it can write the next value of z in place
+	if(fm->count > 0 && fm->result == fm->code[fm->count - 1].dst) fm->result = fm->code[fm->count - 1].dst = 0;
+	
+	fm->degree = ps->nodes[root].deg > 1 ? ps->nodes[root].deg : 2;
+	match_rule(ps, root, fm);
+	
+	free(ps);
+	return true;
+}
+
+
+
+// Set up the registers for a formula
+static inline void formula_load(const formula_t *fm, double *re, double *im, complex z, complex c){
+	re[0] = creal(z);
+	im[0] = cimag(z);
+	re[1] = creal(c);
+	im[1] = cimag(c);
+	for(int r = 2; r < 2 + fm->consts; r++){
+		re[r] = creal(fm->values[r]);
+		im[r] = cimag(fm->values[r]);
+	}
+}
+
+// Run the instructions of a formula once
+// The arithmetic is written out on the real and imaginary parts like in the kernels of frc_select
+static inline void formula_run(const formula_t *fm, double *restrict re, double *restrict im){
+	const formula_instr_t *in = fm->code, *end = fm->code + fm->count;
+	double x, y, d;
+	complex w;
+	for(; in < end; in++){
+		const double ax = re[in->a], ay = im[in->a], bx = re[in->b], by = im[in->b];
+		switch(in->op){
+			case FOP_ADD: x = ax + bx; y = ay + by; break;
+			case FOP_SUB: x = ax - bx; y = ay - by; break;
+			case FOP_MUL: x = ax * bx - ay * by; y = ax * by + ay * bx; break;
+			case FOP_DIV:
+				d = bx * bx + by * by;
+				x = (ax * bx + ay * by) / d;
+				y = (ay * bx - ax * by) / d;
+			break;
+			case FOP_NEG: x = -ax; y = -ay; break;
+			case FOP_SCALE: x = ax * in->k; y = ay * in->k; break;
+			case FOP_SQR: x = ax * ax - ay * ay; y = 2 * ax * ay; break;
+			case FOP_SQRADD: x = ax * ax - ay * ay + bx; y = 2 * ax * ay + by; break;
+			case FOP_MULADD: x = ax * bx - ay * by + re[in->c]; y = ax * by + ay * bx + im[in->c]; break;
+			case FOP_CONJ: x = ax; y = -ay; break;
+			case FOP_RECT: x = fabs(ax); y = fabs(ay); break;
+			case FOP_ABS: x = hypot(ax, ay); y = 0; break;
+			case FOP_RE: x = ax; y = 0; break;
+			case FOP_IM: x = ay; y = 0; break;
+			default:
+				w = eval_op(in->op, CMPLX(ax, ay), CMPLX(bx, by), 0, 0);
+				x = creal(w);
+				y = cimag(w);
+		}
+		re[in->dst] = x;
+		im[in->dst] = y;
+	}
+}
+
+bool formula_rule(const formula_t *fm, fractal_t *fr){
+	if(fm->power < 1) return false;
+	fr->trans = fm->trans;
+	fr->power = fm->power;
+	fr->formula = NULL;
+	return true;
+}
+
+complex formula_eval(const formula_t *fm, complex z, complex c){
+	double re[FORMULA_MAX_REGS], im[FORMULA_MAX_REGS];
+	formula_load(fm, re, im, z, c);
+	formula_run(fm, re, im);
+	return CMPLX(re[fm->result], im[fm->result]);
+}
+
+int formula_orbit(const fractal_t *fr, complex *pt, int max, complex *orb, int orbcap){
+	const formula_t *fm = fr->formula;
+	const int res = fm->result;
+	const double rad2 = fr->radius * fr->radius;
+	double re[FORMULA_MAX_REGS], im[FORMULA_MAX_REGS];
+	formula_load(fm, re, im, *pt, fr->param);
+	
+	int iters;
+	bool esc = re[0] * re[0] + im[0] * im[0] >= rad2;
+	for(iters = 0; !esc && iters < max; iters++){
+		if(orb && iters < orbcap) orb[iters] = CMPLX(re[0], im[0]);
+		formula_run(fm, re, im);
+		if(res){
+			re[0] = re[res];
+			im[0] = im[res];
+		}
+		esc = re[0] * re[0] + im[0] * im[0] >= rad2;
+	}
+	
+	*pt = CMPLX(re[0], im[0]);
+	return esc ? iters : -1;
+}
+
+complex formula_eval_de(const formula_t *fm, complex z, complex c, complex dz, complex dc, complex *deriv){
+	complex v[FORMULA_MAX_REGS], d[FORMULA_MAX_REGS] = {dz, dc};
+	v[0] = z;
+	v[1] = c;
+	for(int r = 2; r < 2 + fm->consts; r++) v[r] = fm->values[r];
+	
+	for(int i = 0; i < fm->count; i++){
+		const formula_instr_t *in = fm->code + i;
+		complex a = v[in->a], b = v[in->b], da = d[in->a], db = d[in->b], val = eval_op(in->op, a, b, v[in->c], in->k), dv;
+		switch(in->op){
+			case FOP_ADD: dv = da + db; break;
+			case FOP_SUB: dv = da - db; break;
+			case FOP_MUL: dv = da * b + a * db; break;
+			case FOP_DIV: dv = (da * b - a * db) / (b * b); break;
+			case FOP_NEG: dv = -da; break;
+			case FOP_SCALE: dv = in->k * da; break;
+			case FOP_SQR: dv = 2 * a * da; break;
+			case FOP_SQRADD: dv = 2 * a * da + db; break;
+			case FOP_MULADD: dv = da * b + a * db + d[in->c]; break;
+			// d/dx a^b = b * a^(b - 1) * da + log(a) * a^b * db
+			case FOP_POW: dv = b * cpow(a, b - 1) * da + (a == 0 ? 0 : clog(a) * val * db); break;
+			case FOP_SQRT: dv = da / (2 * val); break;
+			case FOP_EXP: dv = val * da; break;
+			case FOP_LOG: dv = da / a; break;
+			case FOP_SIN: dv = ccos(a) * da; break;
+			case FOP_COS: dv = -csin(a) * da; break;
+			case FOP_TAN: dv = da / (ccos(a) * ccos(a)); break;
+			case FOP_SINH: dv = ccosh(a) * da; break;
+			case FOP_COSH: dv = csinh(a) * da; break;
+			case FOP_TANH: dv = da / (ccosh(a) * ccosh(a)); break;
+			// The transforms aren't holomorphic so they act on the derivative as reflections
+			case FOP_CONJ: dv = conj(da); break;
+			case FOP_RECT: dv = copysign(1, creal(a)) * creal(da) + copysign(1, cimag(a)) * cimag(da) * I; break;
+			case FOP_ABS: dv = a == 0 ? 0 : creal(conj(a) * da) / cabs(a); break;
+			case FOP_RE: dv = creal(da); break;
+			case FOP_IM: dv = cimag(da); break;
+			default: dv = 0;
+		}
+		v[in->dst] = val;
+		d[in->dst] = dv;
+	}
+	
+	*deriv = d[fm->result];
+	return v[fm->result];
+}
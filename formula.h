@@ -0,0 +1,105 @@
+#ifndef _FORMULA_H
+#define _FORMULA_H
+
+#include <complex.h>
+#include <stdbool.h>
+
+#include "fractal.h"
+
+
+// Operations of the bytecode, each writing register dst from registers a, b, and c
+typedef enum{
+	FOP_ADD,  // a + b
+	FOP_SUB,  // a - b
+	FOP_MUL,  // a * b
+	FOP_DIV,  // a / b
+	FOP_NEG,  // -a
+	FOP_SCALE,  // a * k for the real constant k
+	FOP_SQR,  // a^2
+	FOP_SQRADD,  // a^2 + b
+	FOP_MULADD,  // a * b + c
+	FOP_POW,  // a^b for any complex b
+	FOP_SQRT, FOP_EXP, FOP_LOG,
+	FOP_SIN, FOP_COS, FOP_TAN,
+	FOP_SINH, FOP_COSH, FOP_TANH,
+	FOP_CONJ,  // Complex conjugate
+	FOP_RECT,  // |Re(a)| + |Im(a)| i as used by the burning ship
+	FOP_ABS,  // |a|
+	FOP_RE, FOP_IM  // Real and imaginary parts
+} formula_op_t;
+
+// Single instruction of the bytecode
+typedef struct{
+	unsigned char op, dst, a, b, c;
+	double k;
+} formula_instr_t;
+
+// Limits on the size of a compiled formula
+#define FORMULA_MAX_CODE 64
+#define FORMULA_MAX_REGS 64
+
+/* Iteration formula compiled to bytecode over registers holding complex numbers
+ * Register 0 holds z and register 1 holds c, followed by the constants and then the temporary values
+ * Constants are only loaded into the registers once per orbit, leaving the instructions to do the arithmetic
+ */
+struct formula{
+	formula_instr_t code[FORMULA_MAX_CODE];
+	int count;  // Number of instructions
+	
+	complex values[FORMULA_MAX_REGS];  // Values of the constant registers
+	int consts;  // Number of constants after z and c
+	int regs;  // Total number of registers used
+	int result;  // Register holding the next value of z after the last instruction
+	
+	// Degree of the highest power of z in a polynomial formula, used to smooth continuous coloring
+	// 2 for formulas which aren't polynomials
+	double degree;
+	
+	// Transform and power when the formula is one of the provided rules trans(z)^power + c, otherwise power is 0
+	complex (*trans)(complex);
+	int power;
+};
+
+/* Compile formula of z and c into bytecode
+ * 
+ * Formulas are built from
+ *   numbers (such as 2, 0.5, 1e-3, or 3i), the variables z and c, the constants i, pi, and e
+ *   + - * / ^ with the usual precedence, where ^ is right associative and a number may be written before a factor as in 3z
+ *   (...) and |...| for the absolute value
+ *   sqrt exp log sin cos tan sinh cosh tanh conj rect abs re im, each applied to a parenthesized argument
+ * 
+ * Parts of the formula which don't depend on z or c are calculated when compiled, and the rest are simplified:
+ *   x + 0, x * 1, and x ^ 1 are replaced by x ; x / k by x * (1 / k) ; x * k by a real scaling when k is real
+ *   x ^ n for integers |n| <= 64 by repeated squaring ; x ^ 0.5 by sqrt(x)
+ *   x ^ 2 + y and x * y + w by single instructions
+ * and formulas of the form trans(z)^n + c are recognized as the provided rules (see formula_rule)
+ * 
+ * Usage:
+ *   formula_t fm;
+ *   if(formula_compile("z^3 - z + c", &fm)) rule.formula = &fm;
+ * 
+ * Arguments:
+ *   const char *src : text of the formula
+ *   formula_t *fm : where to store the compiled formula
+ * 
+ * Returns:
+ *   bool : true if successful ; false if the formula is invalid or too large (with a message printed to stderr)
+ *   formula_t *fm : the compiled formula
+ */
+bool formula_compile(const char *src, formula_t *fm);
+
+// Replace the formula of the rule by the transform and power of a provided rule if it is one, so that its specialized kernels are used
+// Returns true if replaced
+bool formula_rule(const formula_t *fm, fractal_t *fr);
+
+// Evaluate formula once for the given z and c
+complex formula_eval(const formula_t *fm, complex z, complex c);
+// Evaluate formula along with its derivative given the derivatives dz of z and dc of c
+// Transforms which aren't holomorphic act on the derivative as reflections, like in frc_orbit_de
+complex formula_eval_de(const formula_t *fm, complex z, complex c, complex dz, complex dc, complex *deriv);
+
+// Orbit kernel for rules with a formula, used by frc_select
+// Takes the same arguments as frc_orbit except that the rule is passed by reference
+int formula_orbit(const fractal_t *fr, complex *pt, int max, complex *orb, int orbcap);
+
+#endif
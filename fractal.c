@@ -1,6 +1,13 @@
 #include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "fractal.h"
+#include "formula.h"
 
 complex crect(complex pt){
 	return fabs(creal(pt)) + fabs(cimag(pt)) * I;
@@ -8,8 +15,13 @@ complex crect(complex pt){
 
 // Apply fractal rule to a point
 bool frc_apply(fractal_t fr, complex *pt){
+	if(fr.formula){
+		*pt = formula_eval(fr.formula, *pt, fr.param);
+		return cabs(*pt) >= fr.radius;
+	}
+	
 	if(fr.trans) *pt = fr.trans(*pt);
-	*pt = cpow(*pt, fr.power);
+	*pt = frc_cpow(*pt, fr.power);
 	*pt += fr.param;
 	
 	// Indicate if the new point escapes
@@ -17,9 +29,14 @@ bool frc_apply(fractal_t fr, complex *pt){
 }
 
 int frc_orbit(fractal_t fr, complex *pt, int max, complex *orb, int orbcap){
+	return frc_select(&fr)(&fr, pt, max, orb, orbcap);
+}
+
+// Generic kernel for rules with transforms that have no specialized kernels
+static int frc_orbit_generic(const fractal_t *fr, complex *pt, int max, complex *orb, int orbcap){
 	int iters;
-	bool esc = cabs(*pt) >= fr.radius;
-	for(iters = 0; !esc && iters < max; esc = frc_apply(fr, pt), iters++){
+	bool esc = cabs(*pt) >= fr->radius;
+	for(iters = 0; !esc && iters < max; esc = frc_apply(*fr, pt), iters++){
 		// Store the current point into the orbit if there is room
 		if(orb && iters < orbcap) orb[iters] = *pt;
 	}
@@ -31,6 +48,615 @@ int frc_orbit(fractal_t fr, complex *pt, int max, complex *orb, int orbcap){
 
 
 
+/* Complex powers in log-polar form
+ * z^p = exp(p * log(z)) where log(z) = log|z| + i arg(z), so each power takes one each of log, atan2, exp, and sincos
+ * Each of these is reduced to a small interval around an entry of a table and finished by a short polynomial,
+ * which skips the scaling and special cases of clog and cexp as the kernels only ever pass finite numbers
+ */
+#define POW_LOG_BITS 7  // Mantissas are split into 2^7 intervals, leaving |r| < 2^-8 for log(1 + r)
+#define POW_EXP_BITS 6  // Powers of two are split into 2^6 steps, leaving |r| < ln(2) / 2^7 for exp(r)
+#define POW_SIN_BITS 6  // Turns are split into 2^6 steps, leaving |r| < pi / 2^6 for sin(r) and cos(r)
+#define POW_ATAN_STEPS 32  // Ratios in [0, 1] are split into 32 steps, leaving |u| < 1 / 64 for atan(u)
+
+// ln(2) split into a high part whose multiples by an exponent are exact and the rest
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+// 2pi split into the nearest double and the rest
+#define TWO_PI_HI 6.28318530717958623200e+00
+#define TWO_PI_LO 2.44929359829470635445e-16
+// Adding this rounds a double below 2^51 in magnitude to an integer held in the low bits of the sum
+#define ROUND_MAGIC 0x1.8p52
+
+static struct{
+	double log_center[1 << POW_LOG_BITS], log_inv[1 << POW_LOG_BITS], log_val[1 << POW_LOG_BITS];
+	double exp_steps[1 << POW_EXP_BITS];
+	double sines[(1 << POW_SIN_BITS) * 5 / 4];  // A quarter turn more so that cosines are read as sines
+	double atans[POW_ATAN_STEPS + 1];
+} pow_tables;
+static pthread_once_t pow_once = PTHREAD_ONCE_INIT;
+
+static void pow_init(){
+	for(int i = 0; i < 1 << POW_LOG_BITS; i++){
+		pow_tables.log_center[i] = 1 + (i + 0.5) / (1 << POW_LOG_BITS);
+		pow_tables.log_inv[i] = 1 / pow_tables.log_center[i];
+		pow_tables.log_val[i] = log(pow_tables.log_center[i]);
+	}
+	for(int i = 0; i < 1 << POW_EXP_BITS; i++) pow_tables.exp_steps[i] = exp2((double)i / (1 << POW_EXP_BITS));
+	for(int i = 0; i < (1 << POW_SIN_BITS) * 5 / 4; i++) pow_tables.sines[i] = sin(2 * M_PI * i / (1 << POW_SIN_BITS));
+	for(int i = 0; i <= POW_ATAN_STEPS; i++) pow_tables.atans[i] = atan((double)i / POW_ATAN_STEPS);
+}
+
+// Round to the nearest integer using ROUND_MAGIC, returning it as both a double and an integer
+static inline double pow_round(double v, int64_t *k){
+	double sum = v + ROUND_MAGIC;
+	uint64_t bits;
+	memcpy(&bits, &sum, sizeof(bits));
+	*k = (int32_t)bits;
+	return sum - ROUND_MAGIC;
+}
+
+// Natural log of a positive normal number
+static inline double pow_log(double v){
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	int e = (int)(bits >> 52 & 0x7ff) - 1023;
+	int i = (int)(bits >> (52 - POW_LOG_BITS) & ((1 << POW_LOG_BITS) - 1));
+	
+	// log(v) = e * ln(2) + log(center) + log(1 + r) where the mantissa m = center * (1 + r)
+	double m;
+	bits = (bits & 0xfffffffffffffULL) | 0x3ff0000000000000ULL;
+	memcpy(&m, &bits, sizeof(m));
+	double r = (m - pow_tables.log_center[i]) * pow_tables.log_inv[i], r2 = r * r;
+	double p = r - r2 * 0.5 + r2 * r * (1.0 / 3 - r * 0.25 + r2 * (0.2 - r * (1.0 / 6)));
+	return e * LN2_HI + pow_tables.log_val[i] + (p + e * LN2_LO);
+}
+
+static inline double pow_exp(double t){
+	if(!(t < 709)) return t != t ? t : INFINITY;
+	if(!(t > -708)) return 0;
+	
+	// exp(t) = 2^(k / 2^POW_EXP_BITS) * exp(r)
+	int64_t k;
+	double kd = pow_round(t * (M_LOG2E * (1 << POW_EXP_BITS)), &k);
+	double r = (t - kd * (LN2_HI / (1 << POW_EXP_BITS))) - kd * (LN2_LO / (1 << POW_EXP_BITS)), r2 = r * r;
+	double p = r + r2 * (0.5 + r * (1.0 / 6)) + r2 * r2 * (1.0 / 24 + r * (1.0 / 120));
+	
+	// Whole powers of two are added straight to the exponent of the table entry
+	double sc = pow_tables.exp_steps[k & ((1 << POW_EXP_BITS) - 1)];
+	uint64_t bits;
+	memcpy(&bits, &sc, sizeof(bits));
+	bits += (uint64_t)(k >> POW_EXP_BITS) << 52;
+	memcpy(&sc, &bits, sizeof(sc));
+	return sc + sc * p;
+}
+
+static inline void pow_sincos(double t, double *s, double *c){
+	if(!(fabs(t) < 1e6)){
+		*s = sin(t);
+		*c = cos(t);
+		return;
+	}
+	
+	// sin(t) and cos(t) from the angle sum of k / 2^POW_SIN_BITS turns and r
+	int64_t k;
+	double kd = pow_round(t * ((1 << POW_SIN_BITS) / (2 * M_PI)), &k);
+	double r = (t - kd * (TWO_PI_HI / (1 << POW_SIN_BITS))) - kd * (TWO_PI_LO / (1 << POW_SIN_BITS)), r2 = r * r;
+	double sr = r - r * r2 * (1.0 / 6 - r2 * (1.0 / 120 - r2 * (1.0 / 5040)));
+	double cr = 1 - r2 * (0.5 - r2 * (1.0 / 24 - r2 * (1.0 / 720 - r2 * (1.0 / 40320))));
+	
+	int j = (int)(k & ((1 << POW_SIN_BITS) - 1));
+	double sj = pow_tables.sines[j], cj = pow_tables.sines[j + (1 << POW_SIN_BITS) / 4];
+	*s = sj * cr + cj * sr;
+	*c = cj * cr - sj * sr;
+}
+
+// Angle of (x, y) where both are finite and not both zero
+static inline double pow_atan2(double y, double x){
+	// Reduce to a ratio t in [0, 1] then to atan(t) = atan(c) + atan((t - c) / (1 + t * c)) for the nearest step c
+	double ax = fabs(x), ay = fabs(y);
+	bool swap = ay > ax;
+	double t = swap ? ax / ay : ay / ax;
+	int k = (int)(t * POW_ATAN_STEPS + 0.5);
+	double c = (double)k / POW_ATAN_STEPS;
+	double u = (t - c) / (1 + t * c), u2 = u * u;
+	double a = pow_tables.atans[k] + (u - u * u2 * (1.0 / 3 - u2 * (0.2 - u2 * (1.0 / 7))));
+	
+	if(swap) a = M_PI_2 - a;
+	if(signbit(x)) a = M_PI - a;
+	return signbit(y) ? -a : a;
+}
+
+// Raise x + yi to the power a + bi in place
+// The magnitude and argument are found once and both parts of the result come from them
+static inline void pow_polar(double *x, double *y, double a, double b){
+	double r2 = *x * *x + *y * *y;
+	if(!(r2 >= DBL_MIN && r2 <= DBL_MAX)){
+		complex w = cpow(CMPLX(*x, *y), CMPLX(a, b));
+		*x = creal(w);
+		*y = cimag(w);
+		return;
+	}
+	
+	double lr = 0.5 * pow_log(r2), th = pow_atan2(*y, *x);
+	double mag = pow_exp(a * lr - b * th), s, c;
+	pow_sincos(b * lr + a * th, &s, &c);
+	*x = mag * c;
+	*y = mag * s;
+}
+
+complex frc_cpow(complex pt, complex power){
+	pthread_once(&pow_once, pow_init);
+	double x = creal(pt), y = cimag(pt);
+	pow_polar(&x, &y, creal(power), cimag(power));
+	return CMPLX(x, y);
+}
+
+
+
+/* Specialized kernels work on the real and imaginary parts separately
+ * so that the compiler doesn't have to handle the special cases of complex multiplication
+ * Each transform and power is a macro acting on the variables x and y in place
+ */
+#define TRANS_NONE(x, y)
+#define TRANS_RECT(x, y) x = fabs(x); y = fabs(y)
+#define TRANS_CONJ(x, y) y = -y
+
+#define POW_SQR(x, y) tmp = x * x - y * y; y = 2 * x * y; x = tmp
+#define POW_CUBE(x, y) tmp = x * (x * x - 3 * y * y); y = y * (3 * x * x - y * y); x = tmp
+// Exponentiation by squaring with the integer power n
+#define POW_INT(x, y) { \
+		__typeof__(x) px = x, py = y, bx = x, by = y; \
+		for(int e = n - 1; e > 0; e >>= 1){ \
+			if(e & 1){ tmp = px * bx - py * by; py = px * by + py * bx; px = tmp; } \
+			tmp = bx * bx - by * by; by = 2 * bx * by; bx = tmp; \
+		} \
+		x = px; y = py; \
+	}
+// Any other power in log-polar form, where the tables are filled when the kernel is selected
+#define POW_ANY(x, y) pow_polar(&x, &y, creal(fr->power), cimag(fr->power))
+
+// Define kernel `name` calculating in the floating point type T for the given transform and power
+#define FRC_KERNEL(name, T, TRANS, POW) \
+static int name(const fractal_t *fr, complex *pt, int max, complex *orb, int orbcap){ \
+	T x = creal(*pt), y = cimag(*pt), tmp; \
+	const T cx = creal(fr->param), cy = cimag(fr->param); \
+	const T rad2 = fr->radius * fr->radius; \
+	const int n = (int)creal(fr->power); \
+	(void)n; (void)tmp; \
+	\
+	int iters; \
+	bool esc = x * x + y * y >= rad2; \
+	for(iters = 0; !esc && iters < max; iters++){ \
+		if(orb && iters < orbcap) orb[iters] = CMPLX(x, y); \
+		TRANS(x, y); \
+		POW(x, y); \
+		x += cx; \
+		y += cy; \
+		esc = x * x + y * y >= rad2; \
+	} \
+	\
+	*pt = CMPLX(x, y); \
+	return esc ? iters : -1; \
+}
+
+FRC_KERNEL(frc_none_sqr, double, TRANS_NONE, POW_SQR)
+FRC_KERNEL(frc_none_cube, double, TRANS_NONE, POW_CUBE)
+FRC_KERNEL(frc_none_int, double, TRANS_NONE, POW_INT)
+FRC_KERNEL(frc_none_any, double, TRANS_NONE, POW_ANY)
+FRC_KERNEL(frc_rect_sqr, double, TRANS_RECT, POW_SQR)
+FRC_KERNEL(frc_rect_cube, double, TRANS_RECT, POW_CUBE)
+FRC_KERNEL(frc_rect_int, double, TRANS_RECT, POW_INT)
+FRC_KERNEL(frc_rect_any, double, TRANS_RECT, POW_ANY)
+FRC_KERNEL(frc_conj_sqr, double, TRANS_CONJ, POW_SQR)
+FRC_KERNEL(frc_conj_cube, double, TRANS_CONJ, POW_CUBE)
+FRC_KERNEL(frc_conj_int, double, TRANS_CONJ, POW_INT)
+FRC_KERNEL(frc_conj_any, double, TRANS_CONJ, POW_ANY)
+
+// Single precision kernels
+// There are none for other powers since their log-polar form is calculated in double precision anyway
+FRC_KERNEL(frc_none_sqrf, float, TRANS_NONE, POW_SQR)
+FRC_KERNEL(frc_none_cubef, float, TRANS_NONE, POW_CUBE)
+FRC_KERNEL(frc_none_intf, float, TRANS_NONE, POW_INT)
+FRC_KERNEL(frc_rect_sqrf, float, TRANS_RECT, POW_SQR)
+FRC_KERNEL(frc_rect_cubef, float, TRANS_RECT, POW_CUBE)
+FRC_KERNEL(frc_rect_intf, float, TRANS_RECT, POW_INT)
+FRC_KERNEL(frc_conj_sqrf, float, TRANS_CONJ, POW_SQR)
+FRC_KERNEL(frc_conj_cubef, float, TRANS_CONJ, POW_CUBE)
+FRC_KERNEL(frc_conj_intf, float, TRANS_CONJ, POW_INT)
+
+// Kernels indexed by precision, transform, then power
+static const frc_kernel_t frc_kernels[2][3][4] = {
+	{
+		{frc_none_sqrf, frc_none_cubef, frc_none_intf, frc_none_any},
+		{frc_rect_sqrf, frc_rect_cubef, frc_rect_intf, frc_rect_any},
+		{frc_conj_sqrf, frc_conj_cubef, frc_conj_intf, frc_conj_any}
+	},
+	{
+		{frc_none_sqr, frc_none_cube, frc_none_int, frc_none_any},
+		{frc_rect_sqr, frc_rect_cube, frc_rect_int, frc_rect_any},
+		{frc_conj_sqr, frc_conj_cube, frc_conj_int, frc_conj_any}
+	}
+};
+
+
+
+/* Accumulating kernels run the same loop as the kernels above with hooks for the accumulator
+ * Each accumulator ACC defines ACC_POW, which runs after raising to the power,
+ * ACC_STEP, which runs after adding the param, and ACC_END, which stores the result into acc
+ * The kernels have the variables
+ *   sum, term, count : running sum, last term added to it, and number of terms
+ *   dist : smallest squared distance so far
+ *   pw : magnitude of z_n^p set by ACC_POW if it is needed
+ */
+#define ACC_TRAP_POW
+#define ACC_TRAP_STEP tmp = (x - tx) * (x - tx) + (y - ty) * (y - ty); if(tmp < dist) dist = tmp;
+// Orbits starting outside the radius take no steps, so their distance is that of z_0
+#define ACC_TRAP_END acc->value = acc->last = sqrt(dist < INFINITY ? dist : (x - tx) * (x - tx) + (y - ty) * (y - ty));
+
+#define ACC_STRIPE_POW
+#define ACC_STRIPE_STEP term = 0.5 * sin(density * atan2(y, x)) + 0.5; sum += term; count++;
+#define ACC_AVERAGE_END \
+	acc->value = count ? sum / count : 0; \
+	acc->last = count > 1 ? (sum - term) / (count - 1) : acc->value;
+#define ACC_STRIPE_END ACC_AVERAGE_END
+
+// The bounds of |z_n^p + c| are ||z_n^p| - |c|| and |z_n^p| + |c|
+// The first iteration from zero has equal bounds and is skipped
+#define ACC_TIA_POW pw = sqrt(x * x + y * y);
+#define ACC_TIA_STEP \
+	if(pw + cabsc > fabs(pw - cabsc)){ \
+		term = (sqrt(x * x + y * y) - fabs(pw - cabsc)) / (pw + cabsc - fabs(pw - cabsc)); \
+		sum += term; \
+		count++; \
+	}
+#define ACC_TIA_END ACC_AVERAGE_END
+
+// Transform for rules without specialized kernels
+#define TRANS_ANY(x, y) { complex w = fr->trans(CMPLX(x, y)); x = creal(w); y = cimag(w); }
+// Formulas take the place of the transform and power with the param subtracted, so that it is added back as in other rules
+#define POW_FORMULA(x, y) { complex w = formula_eval(fr->formula, CMPLX(x, y), fr->param); x = creal(w) - cx; y = cimag(w) - cy; }
+
+#define FRC_ACCUM_KERNEL(name, TRANS, POW, ACC) \
+static int name(const fractal_t *fr, complex *pt, int max, frc_accum_t *acc){ \
+	double x = creal(*pt), y = cimag(*pt), tmp, pw = 0; \
+	const double cx = creal(fr->param), cy = cimag(fr->param); \
+	const double rad2 = fr->radius * fr->radius; \
+	const int n = (int)creal(fr->power); \
+	const double tx = creal(acc->trap), ty = cimag(acc->trap), density = acc->density, cabsc = cabs(fr->param); \
+	double sum = 0, term = 0, dist = INFINITY; \
+	int count = 0; \
+	(void)n; (void)tmp; (void)pw; (void)tx; (void)ty; (void)density; (void)cabsc; (void)sum; (void)term; (void)dist; (void)count; \
+	\
+	int iters; \
+	bool esc = x * x + y * y >= rad2; \
+	for(iters = 0; !esc && iters < max; iters++){ \
+		TRANS(x, y); \
+		POW(x, y); \
+		ACC##_POW \
+		x += cx; \
+		y += cy; \
+		ACC##_STEP \
+		esc = x * x + y * y >= rad2; \
+	} \
+	ACC##_END \
+	\
+	*pt = CMPLX(x, y); \
+	return esc ? iters : -1; \
+}
+
+// Generate the kernels of an accumulator for every transform and power
+#define FRC_ACCUM_KERNELS(acc, ACC) \
+	FRC_ACCUM_KERNEL(acc##_none_sqr, TRANS_NONE, POW_SQR, ACC) \
+	FRC_ACCUM_KERNEL(acc##_none_cube, TRANS_NONE, POW_CUBE, ACC) \
+	FRC_ACCUM_KERNEL(acc##_none_int, TRANS_NONE, POW_INT, ACC) \
+	FRC_ACCUM_KERNEL(acc##_none_any, TRANS_NONE, POW_ANY, ACC) \
+	FRC_ACCUM_KERNEL(acc##_rect_sqr, TRANS_RECT, POW_SQR, ACC) \
+	FRC_ACCUM_KERNEL(acc##_rect_cube, TRANS_RECT, POW_CUBE, ACC) \
+	FRC_ACCUM_KERNEL(acc##_rect_int, TRANS_RECT, POW_INT, ACC) \
+	FRC_ACCUM_KERNEL(acc##_rect_any, TRANS_RECT, POW_ANY, ACC) \
+	FRC_ACCUM_KERNEL(acc##_conj_sqr, TRANS_CONJ, POW_SQR, ACC) \
+	FRC_ACCUM_KERNEL(acc##_conj_cube, TRANS_CONJ, POW_CUBE, ACC) \
+	FRC_ACCUM_KERNEL(acc##_conj_int, TRANS_CONJ, POW_INT, ACC) \
+	FRC_ACCUM_KERNEL(acc##_conj_any, TRANS_CONJ, POW_ANY, ACC) \
+	FRC_ACCUM_KERNEL(acc##_generic, TRANS_ANY, POW_ANY, ACC) \
+	FRC_ACCUM_KERNEL(acc##_formula, TRANS_NONE, POW_FORMULA, ACC)
+
+FRC_ACCUM_KERNELS(frc_trap, ACC_TRAP)
+FRC_ACCUM_KERNELS(frc_stripe, ACC_STRIPE)
+FRC_ACCUM_KERNELS(frc_tia, ACC_TIA)
+
+// Table of the kernels of an accumulator indexed by transform then power
+#define FRC_ACCUM_TABLE(acc) { \
+	{acc##_none_sqr, acc##_none_cube, acc##_none_int, acc##_none_any}, \
+	{acc##_rect_sqr, acc##_rect_cube, acc##_rect_int, acc##_rect_any}, \
+	{acc##_conj_sqr, acc##_conj_cube, acc##_conj_int, acc##_conj_any} \
+}
+
+// Accumulating kernels indexed by kind (less one), transform, then power
+static const frc_accum_kernel_t frc_accum_kernels[3][3][4] = {
+	FRC_ACCUM_TABLE(frc_trap),
+	FRC_ACCUM_TABLE(frc_stripe),
+	FRC_ACCUM_TABLE(frc_tia)
+};
+static const frc_accum_kernel_t frc_accum_generic[3] = {frc_trap_generic, frc_stripe_generic, frc_tia_generic};
+static const frc_accum_kernel_t frc_accum_formula[3] = {frc_trap_formula, frc_stripe_formula, frc_tia_formula};
+
+/* Distance estimation kernels run the same loop as the kernels above while carrying the derivative dx + dy i
+ * Each transform DE_TRANS acts on both, and each power DE_POW leaves z^p in x, y and p * z^(p - 1) * dz in dx, dy
+ */
+// The transforms aren't holomorphic so they act on the derivative as reflections
+#define DE_TRANS_NONE
+#define DE_TRANS_RECT if(signbit(x)) dx = -dx; if(signbit(y)) dy = -dy; TRANS_RECT(x, y);
+#define DE_TRANS_CONJ TRANS_CONJ(x, y); dy = -dy;
+
+// Multiply u + vi by a + bi in place
+#define DE_MUL(u, v, a, b) tmp = u * (a) - v * (b); v = u * (b) + v * (a); u = tmp
+
+#define DE_POW_SQR DE_MUL(dx, dy, 2 * x, 2 * y); POW_SQR(x, y);
+#define DE_POW_CUBE { \
+		double sx = x * x - y * y, sy = 2 * x * y; \
+		DE_MUL(dx, dy, 3 * sx, 3 * sy); \
+		DE_MUL(x, y, sx, sy); \
+	}
+// Exponentiation by squaring finds z^(n - 1), which is multiplied once more by z for z^n
+#define DE_POW_INT { \
+		double px = 1, py = 0, bx = x, by = y; \
+		for(int e = n - 1; e > 0; e >>= 1){ \
+			if(e & 1){ DE_MUL(px, py, bx, by); } \
+			tmp = bx * bx - by * by; by = 2 * bx * by; bx = tmp; \
+		} \
+		DE_MUL(dx, dy, n * px, n * py); \
+		DE_MUL(x, y, px, py); \
+	}
+// Any other power takes z^(p - 1) = z^p / z so that both come from one log-polar form
+// where z^p * conj(z) / |z|^2 stands in for z^p / z, leaving zero and numbers too small or large to square to cpow
+#define DE_POW_ANY { \
+		double px = x, py = y, r2 = x * x + y * y, qx, qy; \
+		pow_polar(&px, &py, creal(fr->power), cimag(fr->power)); \
+		if(r2 >= DBL_MIN && r2 <= DBL_MAX){ \
+			qx = (px * x + py * y) / r2; \
+			qy = (py * x - px * y) / r2; \
+		}else{ \
+			complex w = cpow(CMPLX(x, y), fr->power - 1); \
+			qx = creal(w); \
+			qy = cimag(w); \
+		} \
+		DE_MUL(qx, qy, creal(fr->power), cimag(fr->power)); \
+		DE_MUL(dx, dy, qx, qy); \
+		x = px; \
+		y = py; \
+	}
+
+// Define kernel `name` tracking the derivative for the given transform and power
+#define FRC_DE_KERNEL(name, TRANS, POW) \
+static int name(const fractal_t *fr, complex *pt, complex *dz, complex dc, int max){ \
+	double x = creal(*pt), y = cimag(*pt), dx = creal(*dz), dy = cimag(*dz), tmp; \
+	const double cx = creal(fr->param), cy = cimag(fr->param), dcx = creal(dc), dcy = cimag(dc); \
+	const double rad2 = fr->radius * fr->radius; \
+	const int n = (int)creal(fr->power); \
+	(void)n; (void)tmp; \
+	\
+	int iters; \
+	bool esc = x * x + y * y >= rad2; \
+	for(iters = 0; !esc && iters < max; iters++){ \
+		TRANS \
+		POW \
+		x += cx; \
+		y += cy; \
+		dx += dcx; \
+		dy += dcy; \
+		esc = x * x + y * y >= rad2; \
+	} \
+	\
+	*pt = CMPLX(x, y); \
+	*dz = CMPLX(dx, dy); \
+	return esc ? iters : -1; \
+}
+
+FRC_DE_KERNEL(frc_de_none_sqr, DE_TRANS_NONE, DE_POW_SQR)
+FRC_DE_KERNEL(frc_de_none_cube, DE_TRANS_NONE, DE_POW_CUBE)
+FRC_DE_KERNEL(frc_de_none_int, DE_TRANS_NONE, DE_POW_INT)
+FRC_DE_KERNEL(frc_de_none_any, DE_TRANS_NONE, DE_POW_ANY)
+FRC_DE_KERNEL(frc_de_rect_sqr, DE_TRANS_RECT, DE_POW_SQR)
+FRC_DE_KERNEL(frc_de_rect_cube, DE_TRANS_RECT, DE_POW_CUBE)
+FRC_DE_KERNEL(frc_de_rect_int, DE_TRANS_RECT, DE_POW_INT)
+FRC_DE_KERNEL(frc_de_rect_any, DE_TRANS_RECT, DE_POW_ANY)
+FRC_DE_KERNEL(frc_de_conj_sqr, DE_TRANS_CONJ, DE_POW_SQR)
+FRC_DE_KERNEL(frc_de_conj_cube, DE_TRANS_CONJ, DE_POW_CUBE)
+FRC_DE_KERNEL(frc_de_conj_int, DE_TRANS_CONJ, DE_POW_INT)
+FRC_DE_KERNEL(frc_de_conj_any, DE_TRANS_CONJ, DE_POW_ANY)
+
+// Distance estimation kernels indexed by transform then power
+static const frc_de_kernel_t frc_de_kernels[3][4] = {
+	{frc_de_none_sqr, frc_de_none_cube, frc_de_none_int, frc_de_none_any},
+	{frc_de_rect_sqr, frc_de_rect_cube, frc_de_rect_int, frc_de_rect_any},
+	{frc_de_conj_sqr, frc_de_conj_cube, frc_de_conj_int, frc_de_conj_any}
+};
+
+// Generic distance estimation kernel for formulas and rules with transforms that have no specialized kernels
+static int frc_orbit_de_generic(const fractal_t *fr, complex *pt, complex *dz, complex dc, int max){
+	int iters;
+	complex tz, d = *dz;
+	bool esc = cabs(*pt) >= fr->radius;
+	for(iters = 0; !esc && iters < max; iters++){
+		if(fr->formula){
+			*pt = formula_eval_de(fr->formula, *pt, fr->param, d, dc, &d);
+			esc = cabs(*pt) >= fr->radius;
+			continue;
+		}
+		
+		// Transform the derivative in the same way as the point
+		// The transforms aren't holomorphic so they act on the derivative as reflections
+		tz = fr->trans ? fr->trans(*pt) : *pt;
+		if(fr->trans == conj) d = conj(d);
+		else if(fr->trans == crect){
+			d = copysign(1, creal(*pt)) * creal(d) + copysign(1, cimag(*pt)) * cimag(d) * I;
+		}
+		
+		// d/dx (tz^p + c) = p * tz^(p - 1) * dtz + dc
+		d = fr->power * cpow(tz, fr->power - 1) * d + dc;
+		*pt = cpow(tz, fr->power) + fr->param;
+		esc = cabs(*pt) >= fr->radius;
+	}
+	
+	*dz = d;
+	return esc ? iters : -1;
+}
+
+// Find index of transform into frc_kernels or -1 if it has no specialized kernels
+static int frc_trans_index(const fractal_t *fr){
+	if(fr->formula) return -1;
+	else if(!fr->trans) return 0;
+	else if(fr->trans == crect) return 1;
+	else if(fr->trans == conj) return 2;
+	else return -1;
+}
+
+// Find index of power into frc_kernels
+static int frc_power_index(const fractal_t *fr){
+	double p = creal(fr->power);
+	if(cimag(fr->power) != 0 || p != floor(p) || p < 1 || p > INT_MAX) return 3;
+	else if(p == 2) return 0;
+	else if(p == 3) return 1;
+	else return 2;
+}
+
+frc_kernel_t frc_select(const fractal_t *fr){
+	return frc_select_prec(fr, PREC_DOUBLE);
+}
+
+frc_kernel_t frc_select_prec(const fractal_t *fr, precision_t prec){
+	if(fr->formula) return formula_orbit;
+	pthread_once(&pow_once, pow_init);
+	
+	int trans = frc_trans_index(fr);
+	if(trans < 0) return frc_orbit_generic;
+	return frc_kernels[prec == PREC_FLOAT ? 0 : 1][trans][frc_power_index(fr)];
+}
+
+frc_accum_kernel_t frc_select_accum(const fractal_t *fr, accum_kind_t kind){
+	if(kind == ACCUM_NONE) return NULL;
+	if(fr->formula) return frc_accum_formula[kind - 1];
+	pthread_once(&pow_once, pow_init);
+	
+	int trans = frc_trans_index(fr);
+	if(trans < 0) return frc_accum_generic[kind - 1];
+	return frc_accum_kernels[kind - 1][trans][frc_power_index(fr)];
+}
+
+frc_de_kernel_t frc_select_de(const fractal_t *fr){
+	pthread_once(&pow_once, pow_init);
+	
+	int trans = frc_trans_index(fr);
+	if(trans < 0) return frc_orbit_de_generic;
+	return frc_de_kernels[trans][frc_power_index(fr)];
+}
+
+
+
+/* Double-double arithmetic
+ * A value is represented as the unevaluated sum hi + lo where |lo| <= ulp(hi) / 2
+ * giving about 32 significant digits using only double operations
+ */
+
+// Exact sum of two doubles
+static inline dd_t two_sum(double a, double b){
+	double s = a + b, v = s - a;
+	return (dd_t){s, (a - (s - v)) + (b - v)};
+}
+
+// Exact sum of two doubles when |a| >= |b|
+static inline dd_t quick_two_sum(double a, double b){
+	double s = a + b;
+	return (dd_t){s, b - (s - a)};
+}
+
+static inline dd_t dd_add(dd_t a, dd_t b){
+	dd_t s = two_sum(a.hi, b.hi), t = two_sum(a.lo, b.lo);
+	s.lo += t.hi;
+	s = quick_two_sum(s.hi, s.lo);
+	s.lo += t.lo;
+	return quick_two_sum(s.hi, s.lo);
+}
+
+static inline dd_t dd_neg(dd_t a){
+	return (dd_t){-a.hi, -a.lo};
+}
+
+static inline dd_t dd_mul(dd_t a, dd_t b){
+	// Exact product of the high parts using fused multiply-add
+	double p = a.hi * b.hi, e = fma(a.hi, b.hi, -p);
+	e += a.hi * b.lo + a.lo * b.hi;
+	return quick_two_sum(p, e);
+}
+
+static inline dd_t dd_abs(dd_t a){
+	return a.hi < 0 ? dd_neg(a) : a;
+}
+
+static inline ddcomplex_t ddc_mul(ddcomplex_t a, ddcomplex_t b){
+	return (ddcomplex_t){
+		dd_add(dd_mul(a.re, b.re), dd_neg(dd_mul(a.im, b.im))),
+		dd_add(dd_mul(a.re, b.im), dd_mul(a.im, b.re))
+	};
+}
+
+ddcomplex_t dd_complex(complex pt){
+	return (ddcomplex_t){{creal(pt), 0}, {cimag(pt), 0}};
+}
+
+complex dd_to_complex(ddcomplex_t pt){
+	return (pt.re.hi + pt.re.lo) + (pt.im.hi + pt.im.lo) * I;
+}
+
+bool frc_has_dd(const fractal_t *fr){
+	return frc_trans_index(fr) >= 0 && frc_power_index(fr) < 3;
+}
+
+int frc_orbit_dd(const fractal_t *fr, ddcomplex_t *pt, ddcomplex_t param, int max){
+	const double rad2 = fr->radius * fr->radius;
+	const int n = (int)creal(fr->power), trans = frc_trans_index(fr);
+	ddcomplex_t z = *pt, p, b;
+	
+	// The escape test only needs the high parts
+	int iters;
+	bool esc = z.re.hi * z.re.hi + z.im.hi * z.im.hi >= rad2;
+	for(iters = 0; !esc && iters < max; iters++){
+		if(trans == 1){
+			z.re = dd_abs(z.re);
+			z.im = dd_abs(z.im);
+		}else if(trans == 2) z.im = dd_neg(z.im);
+		
+		// Exponentiation by squaring
+		p = b = z;
+		for(int e = n - 1; e > 0; e >>= 1){
+			if(e & 1) p = ddc_mul(p, b);
+			b = ddc_mul(b, b);
+		}
+		
+		z.re = dd_add(p.re, param.re);
+		z.im = dd_add(p.im, param.im);
+		esc = z.re.hi * z.re.hi + z.im.hi * z.im.hi >= rad2;
+	}
+	
+	*pt = z;
+	return esc ? iters : -1;
+}
+
+int frc_orbit_de(fractal_t fr, complex *pt, complex *dz, complex dc, int max){
+	return frc_select_de(&fr)(&fr, pt, dz, dc, max);
+}
+
+double frc_distance(complex pt, complex dz){
+	// Orbits through a critical point have no derivative to estimate from
+	if(dz == 0) return 0;
+	
+	double mag = cabs(pt);
+	return 2 * mag * log(mag) / cabs(dz);
+}
+
+
+
 
 bool comp_to_rc(viewport_t vw, complex pt, int *r, int *c){
 	pt -= vw.corner;  // Calculate offset between point and corner
@@ -43,3 +669,26 @@ complex comp_at_rc(viewport_t vw, int r, int c){
 	return vw.corner + (c * vw.width / vw.columns - (r * vw.height / vw.rows) * I);
 }
 
+precision_t view_precision(viewport_t vw){
+	// Spacing of pixels relative to the size of the coordinates
+	double spacing = fmax(vw.width / vw.columns, vw.height / vw.rows);
+	spacing /= fmax(1, cabs(vw.corner));
+	
+	if(spacing >= 1e-4) return PREC_FLOAT;
+	else if(spacing >= 1e-13) return PREC_DOUBLE;
+	else return PREC_DD;
+}
+
+void view_shift(viewport_t *vw, complex delta){
+	dd_t re = dd_add((dd_t){creal(vw->corner), creal(vw->corner_lo)}, (dd_t){creal(delta), 0});
+	dd_t im = dd_add((dd_t){cimag(vw->corner), cimag(vw->corner_lo)}, (dd_t){cimag(delta), 0});
+	vw->corner = re.hi + im.hi * I;
+	vw->corner_lo = re.lo + im.lo * I;
+}
+
+ddcomplex_t comp_at_rc_dd(viewport_t vw, double r, double c){
+	// Offset from the corner is small so double precision is enough for it
+	dd_t re = dd_add((dd_t){creal(vw.corner), creal(vw.corner_lo)}, (dd_t){c * vw.width / vw.columns, 0});
+	dd_t im = dd_add((dd_t){cimag(vw.corner), cimag(vw.corner_lo)}, (dd_t){-(r * vw.height / vw.rows), 0});
+	return (ddcomplex_t){re, im};
+}
@@ -4,6 +4,9 @@
 #include <complex.h>
 #include <stdbool.h>
 
+// Iteration formula compiled by formula_compile (see formula.h)
+typedef struct formula formula_t;
+
 typedef struct{
 	// Transformation to apply to number before taking power
 	// If trans == NULL then the value is left unchanged
@@ -18,8 +21,30 @@ typedef struct{
 	
 	// Full Rule: z_(n+1) = trans(z_n)^power + param
 	// Test for Escape: |z_n| >= radius
+	
+	// Formula to iterate instead of the rule above if not NULL, where c is the param
+	// The power is then only used to smooth continuous coloring and should be the degree of the formula
+	const formula_t *formula;
 } fractal_t;
 
+// Arithmetic used to calculate orbits
+typedef enum{
+	PREC_AUTO,  // Choose from the spacing of pixels using view_precision
+	PREC_FLOAT,  // Single precision
+	PREC_DOUBLE,  // Double precision
+	PREC_DD  // Double-double precision (about 32 significant digits)
+} precision_t;
+
+// Double-double number whose value is the unevaluated sum hi + lo
+typedef struct{
+	double hi, lo;
+} dd_t;
+
+// Complex number with double-double components
+typedef struct{
+	dd_t re, im;
+} ddcomplex_t;
+
 // Takes absolute value of each component of a complex number
 // crect(a + bi) = |a| + |b|i
 complex crect(complex pt);
@@ -44,6 +69,13 @@ complex crect(complex pt);
  */ 
 bool frc_apply(fractal_t fr, complex *pt);
 
+/* Raise a complex number to any power like cpow, in log-polar form as the kernels of non-integer powers do
+ * The log and argument are found once from tables and short polynomials instead of through clog and cexp,
+ * keeping the result within about 1e-13 of cpow relative to its magnitude (see --bench of fractal)
+ * Numbers too small or large to square fall back to cpow
+ */
+complex frc_cpow(complex pt, complex power);
+
 /* Iteratively applies fractal rule to the point
  * 
  * Usage:
@@ -64,6 +96,143 @@ bool frc_apply(fractal_t fr, complex *pt);
  */
 int frc_orbit(fractal_t fr, complex *pt, int max, complex *orb, int orbcap);
 
+// Orbit calculation specialized for the transform and power of a rule
+// Takes the same arguments as frc_orbit except that the rule is passed by reference
+typedef int (*frc_kernel_t)(const fractal_t *fr, complex *pt, int max, complex *orb, int orbcap);
+
+/* Select the orbit kernel specialized for the transform and power of the rule
+ * There are kernels compiled for each of the provided transforms (none, crect, and conj)
+ * with powers of 2, 3, other positive integers, and any other complex number (calculated as by frc_cpow)
+ * Rules with any other transform use a generic kernel built on frc_apply
+ * and rules with a formula use formula_orbit
+ * 
+ * Usage:
+ *   fractal_t fr = {crect, 2, 0, 2};
+ *   frc_kernel_t kern = frc_select(&fr);  // Select once
+ *   for(...){
+ *     pt = ...;
+ *     fr.param = ...;
+ *     i = kern(&fr, &pt, 100, NULL, 0);  // Use for every point
+ *   }
+ * 
+ * Arguments:
+ *   const fractal_t *fr : rule to select kernel for, only the transform and power are used
+ * 
+ * Returns:
+ *   frc_kernel_t : kernel which behaves like frc_orbit for any rule with the same transform and power
+ */
+frc_kernel_t frc_select(const fractal_t *fr);
+// Select orbit kernel which calculates using the given precision
+// Only PREC_FLOAT and PREC_DOUBLE are accepted, any other is treated as PREC_DOUBLE
+// Rules without specialized kernels or with non-integer powers always use double precision
+frc_kernel_t frc_select_prec(const fractal_t *fr, precision_t prec);
+
+// Quantities which can be accumulated over an orbit while it is calculated
+typedef enum{
+	ACCUM_NONE,
+	ACCUM_TRAP,  // Orbit trap: smallest distance from the orbit to the trap point
+	ACCUM_STRIPE,  // Stripe average: average of (sin(density * arg(z_n)) + 1) / 2
+	ACCUM_TIA  // Triangle inequality average: average position of |z_n| between its bounds from |z_(n-1)^p| and |c|
+} accum_kind_t;
+
+// Settings and results of an accumulator
+typedef struct{
+	accum_kind_t kind;
+	
+	// Location of the point used by orbit traps
+	complex trap;
+	// Number of stripes around the origin used by stripe averages
+	double density;
+	
+	// Accumulated value over the whole orbit
+	// and, for averages, the value without the final iteration to allow smooth interpolation between them
+	double value, last;
+} frc_accum_t;
+
+// Orbit calculation which also accumulates a value over the orbit into acc
+// Takes the same arguments as frc_kernel_t except that the orbit is never stored
+typedef int (*frc_accum_kernel_t)(const fractal_t *fr, complex *pt, int max, frc_accum_t *acc);
+
+/* Select the orbit kernel which accumulates the given kind of value
+ * Like frc_select, there are kernels specialized for each provided transform and power,
+ * so an accumulator costs nothing in the kernels of frc_select
+ * 
+ * Arguments:
+ *   const fractal_t *fr : rule to select kernel for, only the transform and power are used
+ *   accum_kind_t kind : kind of value to accumulate
+ * 
+ * Returns:
+ *   frc_accum_kernel_t : kernel accumulating over the orbit in double precision
+ *      OR NULL if kind is ACCUM_NONE
+ */
+frc_accum_kernel_t frc_select_accum(const fractal_t *fr, accum_kind_t kind);
+
+// Convert between complex and double-double complex numbers
+ddcomplex_t dd_complex(complex pt);
+complex dd_to_complex(ddcomplex_t pt);
+
+// Determine whether the rule can be iterated by frc_orbit_dd
+// Only rules with the provided transforms and positive integer powers can be, never those with a formula
+bool frc_has_dd(const fractal_t *fr);
+
+/* Iteratively applies fractal rule to the point using double-double precision
+ * The rule must satisfy frc_has_dd
+ * 
+ * Arguments:
+ *   const fractal_t *fr : parameters indicating how the point should be moved and the bounding radius
+ *   ddcomplex_t *pt : initial point for calculating orbit
+ *   ddcomplex_t param : param to use in place of fr->param
+ *   int max : maximum number of iterations to perform
+ * 
+ * Returns:
+ *   int : number of iterations performed before escaping
+ *      OR -1 if point did not escape
+ *   ddcomplex_t *pt : final value in orbit after escaping or reaching the maximum iterations
+ */
+int frc_orbit_dd(const fractal_t *fr, ddcomplex_t *pt, ddcomplex_t param, int max);
+
+/* Iteratively applies fractal rule to the point while tracking the derivative of the orbit
+ * The derivative is taken with respect to either the param (Mandelbrot) or the initial point (Julia)
+ * 
+ * Usage:
+ *   fractal_t fr = {NULL, 2, 0.3 + 0.5 * I, 100};
+ *   complex pt = 0, dz = 0;
+ *   int i = frc_orbit_de(fr, &pt, &dz, 1, 100);  // Derivative with respect to param
+ *   double dist = i < 0 ? 0 : frc_distance(pt, dz);
+ * 
+ * Arguments:
+ *   fractal_t fr : parameters indicating how the point should be moved and the bounding radius
+ *   complex *pt : initial point for calculating orbit
+ *   complex *dz : initial derivative (0 for derivative by param ; 1 for derivative by initial point)
+ *   complex dc : derivative of param (1 for derivative by param ; 0 for derivative by initial point)
+ *   int max : maximum number of iterations to perform
+ * 
+ * Returns:
+ *   int : number of iterations performed before escaping
+ *      OR -1 if point did not escape
+ *   complex *pt : final value in orbit after escaping or reaching the maximum iterations
+ *   complex *dz : derivative of the final value
+ */
+int frc_orbit_de(fractal_t fr, complex *pt, complex *dz, complex dc, int max);
+
+// Orbit calculation which also tracks the derivative, taking the same arguments as frc_orbit_de
+typedef int (*frc_de_kernel_t)(const fractal_t *fr, complex *pt, complex *dz, complex dc, int max);
+
+/* Select the distance estimation kernel specialized for the transform and power of the rule
+ * Select once and use for many points as with frc_select, whereas frc_orbit_de selects on every call
+ * 
+ * Arguments:
+ *   const fractal_t *fr : rule to select kernel for, only the transform, power, and formula are used
+ * 
+ * Returns:
+ *   frc_de_kernel_t : kernel which behaves like frc_orbit_de for any rule with the same transform and power
+ */
+frc_de_kernel_t frc_select_de(const fractal_t *fr);
+
+// Estimate the distance to the boundary of the set from the final value and derivative of an escaped orbit
+// The true distance lies between a quarter of the estimate and the estimate itself
+double frc_distance(complex pt, complex dz);
+
 
 
 // Identifies a rectangle within the complex plane
@@ -76,11 +245,28 @@ typedef struct{
 	
 	// Number of Rows and Columns of Pixels
 	int rows, columns;
+	
+	// Low order part of corner for double-double precision
+	// The corner is located at corner + corner_lo
+	complex corner_lo;
 } viewport_t;
 
 // Calculate the row and column of a complex number using the given viewport
 bool comp_to_rc(viewport_t vw, complex pt, int *r, int *c);
 // Calculate the complex number at a given row and column using the given viewport
 complex comp_at_rc(viewport_t vw, int r, int c);
+// Calculate the complex number at a given (possibly fractional) row and column in double-double precision
+ddcomplex_t comp_at_rc_dd(viewport_t vw, double r, double c);
+
+// Move the corner of the viewport by delta without losing the low order part of the corner
+void view_shift(viewport_t *vw, complex delta);
+
+/* Choose the cheapest precision which can still separate the pixels of the viewport
+ * Uses the spacing of pixels relative to the size of the coordinates
+ *   float : spacing >= 1e-4
+ *   double : 1e-4 > spacing >= 1e-13
+ *   double-double : spacing < 1e-13
+ */
+precision_t view_precision(viewport_t vw);
 
 #endif
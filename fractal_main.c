@@ -2,13 +2,26 @@
 #include <complex.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <locale.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <png.h>
 
 #include <argp.h>
 
 #include "fractal.h"
+#include "formula.h"
+#include "image.h"
+#include "node.h"
+#include "render.h"
+#include "serve.h"
+#include "term.h"
 
 
 // Default values for params
@@ -16,28 +29,30 @@ int iterations = 100;
 bool is_julia = 0;
 bool radius_set = 0;  // Track whether the radius has been set to allow change of default
 fractal_t rule = {NULL /* No Transform */, 2 /* Power */, 0 /* No Param */, 2 /* Bounding Radius */};
+formula_t formula;  // Formula iterated in place of the rule when rule.formula is set
 
 
-typedef struct{
-	/* color_count: Number of colors to cycle through
-	 * Ex: [    blue    |   orange   |    white    ]  ; color_count = 3
-	 * iters_per_cycle: Number of complex iterations to fit into each cycle of all the colors
-	 * Ex: [ 0 , 1 , 2 , 3 , 4 , 5 , 6 , 7 , 8 , 9 ]  ; iters_per_cycle = 10
-	 * A good ratio is   color_count * 10 = iters_per_cycle
-	 */
-	int color_count, iters_per_cycle;
-	
-	// Indicates that the color of points should be interpolated according to how far they go after escaping
-	bool is_continuous;
-	
-	// colors: array of 24-bit colors {red, green, blue} to cycle through
-	// set_color: color for non-escaping points
-	png_color *colors, set_color;
-} color_scheme_t;
-
 #define SCREENSHOT_NAME_LENGTH 64
 char screenshot_filename[SCREENSHOT_NAME_LENGTH] = "fractal_screenshot.png";
 int scrshot_width = 1000, scrshot_height = 1000;
+// Format to write screenshots in, chosen from the extension of the screenshot file unless given
+// Writing to "-" sends a single screenshot of the window to standard output instead of opening the viewer
+image_format_t image_format = IMAGE_PNG;
+bool format_set = 0;
+
+// Number of extra samples taken in screenshot pixels along edges and
+// the difference in color between neighboring pixels that counts as an edge
+int aa_samples = 0, aa_threshold = 32;
+
+// Width in pixels over which distance estimated coloring fades from the boundary, zero disables it
+double de_thickness = 0;
+
+// Arithmetic used to calculate orbits, chosen from the zoom when PREC_AUTO
+precision_t precision = PREC_AUTO;
+const char *precision_names[] = {"auto", "float", "double", "dd"};
+
+// Value accumulated over orbits to color screenshots by instead of iterations
+frc_accum_t accum = {ACCUM_NONE};
 
 // Color Schemes
 #define SCHEME_COUNT 4
@@ -54,6 +69,40 @@ color_scheme_t schemes[] = {
 const char *scheme_names[] = {"starry", "firey", "foresty", "purple"};
 color_scheme_t global_scheme = {0};
 
+// Julia Sets to render in batch for params along path or across grid from sweep_from to sweep_to
+// sweep_columns == 0 indicates that no sweep was requested
+complex sweep_from, sweep_to;
+int sweep_columns = 0, sweep_rows = 1;
+bool sweep_sheet = 0;  // Write sweep as one contact sheet instead of a file per param
+int sweep_sheet_columns = 0;  // Number of images in each row of the contact sheet
+int threads = 0;  // Number of worker threads, less than one uses every processor
+bool numa = 0;  // Pin worker threads evenly to the NUMA nodes of the machine
+
+// Time the kernels of each class of power instead of opening the viewer
+bool bench = 0;
+
+// Seconds given to refine a screenshot of the window before writing it without opening the viewer, 0 if no deadline
+double deadline = 0;
+
+// Address to serve tiles on instead of opening the viewer, NULL if not serving
+const char *serve_address = NULL;
+int cache_megabytes = 256;  // Size of the cache of tiles kept by the server
+
+// How the viewer draws to the terminal, chosen from the environment when term_auto
+bool term_auto = true;
+term_mode_t term_mode = TERM_CELLS;
+term_color_t term_color = TERM_COLOR_256;
+term_t screen;
+// Rows at the bottom of the terminal left to ncurses for the status lines
+#define STATUS_ROWS 2
+
+// Keys of options without a short name
+#define OPT_TERM 256
+#define OPT_FORMAT 257
+#define OPT_NUMA 258
+#define OPT_BENCH 259
+#define OPT_DEADLINE 260
+
 
 viewport_t view = {
 	-1 + I, // Upper Left Corner
@@ -62,8 +111,27 @@ viewport_t view = {
 };
 
 
+// Parse duration given as a number of seconds optionally followed by ms, s, m, or h
+// Returns true if successful ; false if invalid
+static bool parse_duration(const char *arg, double *secs){
+	double val;
+	int len;
+	if(sscanf(arg, " %lf%n", &val, &len) < 1) return false;
+	
+	const char *unit = arg + len;
+	if(strcmp(unit, "ms") == 0) val /= 1000;
+	else if(strcmp(unit, "m") == 0) val *= 60;
+	else if(strcmp(unit, "h") == 0) val *= 3600;
+	else if(*unit && strcmp(unit, "s") != 0) return false;
+	
+	*secs = val;
+	return true;
+}
+
 error_t parse_opt(int key, char *arg, struct argp_state *state){
-	double real, imag;
+	double real, imag, real2, imag2;
+	long double lreal, limag;
+	bool is_cont;
 	switch(key){
 		case 'j': // Set julia param
 			is_julia = 1;
@@ -107,15 +175,23 @@ error_t parse_opt(int key, char *arg, struct argp_state *state){
 		break;
 		case 'T': rule.trans = conj;  // Tricorn: z_(n+1) = conj(z_n) ^ p + c
 		break;
+		case 'f': // Iterate formula instead
+			if(!formula_compile(arg, &formula)) argp_usage(state);
+			rule.formula = &formula;
+		break;
 		
 		case 'z': // Set location of center of window in complex plane
-			switch(sscanf(arg, " %lf,%lf", &real, &imag)){
+			// Read as long double to keep extra digits in the low order part of the corner
+			switch(sscanf(arg, " %Lf,%Lf", &lreal, &limag)){
 				case 0:
 					printf("Invalid window location given: \"%s\"\n", arg);
 					argp_usage(state);
-				case 1: imag = 0;
+				case 1: limag = 0;
 				case 2:
-					view.corner = (real - view.width / 2) + (imag + view.height / 2) * I;
+					lreal -= view.width / 2;
+					limag += view.height / 2;
+					view.corner = (double)lreal + (double)limag * I;
+					view.corner_lo = (double)(lreal - (double)lreal) + (double)(limag - (double)limag) * I;
 			}
 		break;
 		case 'w': // Set window width and height in complex plane
@@ -123,9 +199,9 @@ error_t parse_opt(int key, char *arg, struct argp_state *state){
 				printf("Invalid window width and/or height given: \"%s\"\n", arg);
 				argp_usage(state);
 			}
-		
+			
 			// Shift corner to compensate for dimension change to keep center stationary
-			view.corner = (creal(view.corner) + (view.width - real) / 2) + (cimag(view.corner) + (-view.height + imag) / 2) * I;
+			view_shift(&view, (view.width - real) / 2 + (-view.height + imag) / 2 * I);
 			view.width = real;
 			view.height = imag;
 		break;
@@ -139,23 +215,143 @@ error_t parse_opt(int key, char *arg, struct argp_state *state){
 				argp_usage(state);
 			}
 		break;
+		case OPT_FORMAT: // Set format of screenshots
+			if(!image_format_parse(arg, &image_format) || image_format == IMAGE_COUNTS){
+				printf("Invalid format, must be png, ppm, pam, or pfm: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+			format_set = 1;
+		break;
 		case 'c': // Set do continuous coloring
 			global_scheme.is_continuous = 1;
 			if(!radius_set) rule.radius = 100;
 		break;
 		case 'm':
 			// Find and set scheme
+			is_cont = global_scheme.is_continuous;
 			for(int i = 0; i < SCHEME_COUNT; i++){
 				if(strcmp(scheme_names[i], arg) == 0){
-					bool is_cont = global_scheme.is_continuous;
 					global_scheme = schemes[i];
 					global_scheme.is_continuous = is_cont;
 					return 0;
 				}
 			}
 			
+			// Otherwise load scheme from file
+			if(access(arg, F_OK) == 0){
+				if(!scheme_load(arg, &global_scheme)) argp_usage(state);
+				global_scheme.is_continuous = is_cont;
+				return 0;
+			}
+			
 			printf("No color scheme found called \"%s\"\n", arg);
 		break;
+		
+		case 'a': // Set number of samples for anti-aliasing
+			if(sscanf(arg, " %i", &aa_samples) < 1){
+				printf("Invalid number of samples, must be an integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		case 'A': // Set threshold for anti-aliasing
+			if(sscanf(arg, " %i", &aa_threshold) < 1){
+				printf("Invalid anti-aliasing threshold, must be an integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		
+		case 'e': // Set distance estimated coloring
+			if(sscanf(arg, " %lf", &de_thickness) < 1){
+				printf("Invalid distance estimation thickness, must be floating point: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		
+		case 'o': // Set accumulator for coloring
+			if(!accum_parse(arg, &accum)){
+				printf("Invalid orbit coloring, must be trap[:REAL,IMAG], stripe[:DENSITY], tia, or none: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		
+		case 'P': // Set precision
+			for(int i = 0; i <= PREC_DD; i++){
+				if(strcmp(precision_names[i], arg) == 0){
+					precision = i;
+					return 0;
+				}
+			}
+			
+			printf("Invalid precision, must be one of auto, float, double, or dd: \"%s\"\n", arg);
+			argp_usage(state);
+		break;
+		
+		case 'S': // Set sweep of julia params
+			switch(sscanf(arg, " %lf,%lf:%lf,%lf:%i x%i", &real, &imag, &real2, &imag2, &sweep_columns, &sweep_rows)){
+				case 5: sweep_rows = 1;
+				case 6:
+					sweep_from = real + imag * I;
+					sweep_to = real2 + imag2 * I;
+					if(sweep_columns > 0 && sweep_rows > 0) break;
+				default:
+					printf("Invalid sweep, must be REAL,IMAG:REAL,IMAG:COUNT[xROWS] : \"%s\"\n", arg);
+					argp_usage(state);
+			}
+		break;
+		case 'k': // Write sweep as contact sheet
+			sweep_sheet = 1;
+		break;
+		case 't': // Set number of worker threads
+			if(sscanf(arg, " %i", &threads) < 1){
+				printf("Invalid number of threads, must be an integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		case OPT_NUMA: // Pin worker threads to NUMA nodes
+			numa = 1;
+		break;
+		case OPT_BENCH: // Benchmark kernels
+			bench = 1;
+		break;
+		case OPT_DEADLINE: // Set time to refine screenshot
+			if(!parse_duration(arg, &deadline) || deadline <= 0){
+				printf("Invalid deadline, must be a positive number of seconds optionally followed by ms, s, m, or h: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		
+		case 'L': // Serve tiles
+			serve_address = arg;
+		break;
+		case 'C': // Set size of tile cache
+			if(sscanf(arg, " %i", &cache_megabytes) < 1 || cache_megabytes < 0){
+				printf("Invalid cache size, must be a non-negative integer: \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		
+		case OPT_TERM: // Set how the terminal is drawn to
+			if(!term_parse(arg, &term_auto, &term_mode, &term_color)){
+				printf("Invalid terminal mode, must be auto, cells, half, or braille optionally followed by ,256 or ,true : \"%s\"\n", arg);
+				argp_usage(state);
+			}
+		break;
+		case ARGP_KEY_END:
+			// Formulas which are one of the provided rules use their kernels,
+			// otherwise continuous coloring smooths by the power, which for a formula is its degree
+			if(rule.formula && !formula_rule(&formula, &rule)) rule.power = formula.degree;
+			
+			if(!format_set) image_format = image_format_guess(screenshot_filename);
+			if(image_format == IMAGE_COUNTS) image_format = IMAGE_PNG;
+			if(image_format == IMAGE_PFM && sweep_sheet){
+				printf("Contact sheets can only be written as png, ppm, or pam\n");
+				argp_usage(state);
+			}
+			if(deadline > 0 && (sweep_columns > 0 || serve_address)){
+				printf("A deadline only applies to a single screenshot, not to a sweep or a server\n");
+				argp_usage(state);
+			}
+		break;
 		default: return ARGP_ERR_UNKNOWN;
 	}
 	return 0;
@@ -166,15 +362,31 @@ struct argp_option options[] = {
 	{"iter", 'n', "ITERATIONS", 0, "Number of iterations to perform before falling through  (default: 100)", 1},
 	{"power", 'p', "REAL[,IMAG]", 0, "Power to raise z to in iteration i.e. z_(n+1) = f(z_n) ^ p + c  (default: 2)", 1},
 	{"radius", 'r', "RADIUS", 0, "Radius within which iterations will continue i.e. |z_n| < RADIUS implies z_(n+1) will be calculated (default: 2)", 1},
+	{"precision", 'P', "PRECISION", 0, "Arithmetic used to calculate orbits: auto, float, double, or dd (double-double) where auto chooses the cheapest which can separate the pixels  (default: auto)", 1},
 	{"mandel", 'M', 0, 0, "Use the standard mandelbrot rule for generation i.e. z_(n+1) = z_n ^ p + c (Standard)", 2},
 	{"burning-ship", 'B', 0, 0, "Use the burning ship rule for generation i.e. z_(n+1) = (|Re{z_n}| + i * |Im{z_n}|) ^ p + c", 2},
 	{"tricorn", 'T', 0, 0, "Use the tricorn rule for generation i.e. z_(n+1) = conj(z_n) ^ p + c", 2},
+	{"formula", 'f', "EXPR", 0, "Iterate z_(n+1) = EXPR of z_n and c instead of the rules above, replacing -M, -B, -T, and -p (see below for formulas)", 2},
 	{"position", 'z', "REAL[,IMAG]", 0, "Specify center of window when first starting  (default: 0 + 0i)", 3},
 	{"window", 'w', "WIDTH,HEIGHT", 0, "Provide width and height (in complex plane) of window  (default: 2, 2)", 3},
-	{"screenshot", 's', "FILE", 0, "File Path to store screenshots in (default: fractal_screenshot.png)", 4},
+	{"term", OPT_TERM, "MODE[,COLORS]", 0, "Draw the viewer with cells (one color pair per cell), half (half blocks, two pixels per cell), or braille (two by four dots per cell) in 256 or true colors, where auto chooses from the terminal  (default: auto)", 3},
+	{"screenshot", 's', "FILE", 0, "File Path to store screenshots in, where - writes a screenshot of the window or the images of a sweep to standard output without opening the viewer (default: fractal_screenshot.png)", 4},
 	{"dimensions", 'd', "WIDTH,HEIGHT", 0, "Provide width and height (in pixels) of a screenshotted image  (default: 1000, 1000)", 4},
+	{"format", OPT_FORMAT, "FORMAT", 0, "Write screenshots as png, ppm (binary RGB), pam (RGB with a PAM header), or pfm (32-bit float of the value of each pixel before coloring) instead of the format given by the extension of the screenshot file (see below for raw formats)", 4},
+	{"deadline", OPT_DEADLINE, "DURATION", 0, "Without opening the viewer, refine a screenshot of the window in stages (coarse grid, full grid, raised iterations where points did not escape, then anti-aliased edges) and write the best so far once DURATION (e.g. 500ms, 30s, 2m) passes, every stage is done, or on interrupt", 4},
 	{"continuous", 'c', 0, 0, "In saved screenshots, interpolate the color of points depending on how far they escape. Also sets the default radius to 100 (default: false)", 4},
-	{"scheme", 'm', "SCHEME_NAME", 0, "Name of scheme (see below for provided color schemes)", 4},
+	{"scheme", 'm', "SCHEME_NAME|FILE", 0, "Name of scheme (see below for provided color schemes) or path of file to load scheme from", 4},
+	{"antialias", 'a', "SAMPLES", 0, "In saved screenshots, take SAMPLES extra jittered samples in pixels along edges and average them, rounding SAMPLES up to the next square (1, 4, 9, 16, ...) so that they cover each pixel evenly  (default: 0)", 4},
+	{"distance", 'e', "PIXELS", 0, "In saved screenshots, color by estimated distance to the boundary, fading to the background over PIXELS pixels, instead of by iterations", 4},
+	{"orbit-color", 'o', "KIND[:PARAM]", 0, "In saved screenshots, color by a value accumulated over each orbit: trap[:REAL,IMAG] for distance to a trap point, stripe[:DENSITY] for stripe average, or tia for triangle inequality average", 4},
+	{"aa-threshold", 'A', "DIFF", 0, "Difference in color (summed over red, green, and blue) between neighboring pixels which marks an edge for anti-aliasing  (default: 32)", 4},
+	{"sweep", 'S', "FROM:TO:COUNT[xROWS]", 0, "Save the Julia Sets of COUNT params evenly spaced from FROM to TO, or of a COUNT by ROWS grid of params with FROM and TO at opposite corners, then exit", 5},
+	{"sheet", 'k', 0, 0, "Save the images of a sweep as one contact sheet to the screenshot file instead of one file per param", 5},
+	{"threads", 't', "COUNT", 0, "Number of worker threads used to render sweeps and serve tiles  (default: number of processors)", 5},
+	{"numa", OPT_NUMA, 0, 0, "Pin the worker threads rendering sweeps and screenshots evenly to the NUMA nodes of the machine, so that the buffers and bands of rows each one renders stay in the memory of its node", 5},
+	{"bench", OPT_BENCH, 0, 0, "Time the kernel of each class of power over the params of the window with the transform and iterations given, against cpow, and check the powers of the non-integer kernels against cpow, then time the distance estimation kernels in the same way and exit", 5},
+	{"serve", 'L', "PORT|PATH", 0, "Serve PNG tiles over HTTP on the localhost PORT or at the UNIX socket PATH instead of opening the viewer (see below for requests)", 6},
+	{"cache", 'C', "MEGABYTES", 0, "Memory used by the server to keep recently rendered tiles and iteration counts  (default: 256)", 6},
 	{0}
 };
 
@@ -185,31 +397,94 @@ struct argp argp = {options, parse_opt,
 		"\tstarry -- blue background with orange and white highlight\n"
 		"\tfirey -- dark red background with yellow and blue highlight\n"
 		"\tforesty -- dark green background with cyan and yellow highlight\n"
+		"\tpurple -- dark blue background with green, yellow, and purple highlight\n"
+	"\n"
+	"Scheme Files:\n"
+		"\tOne entry per line, '# ' starts a comment\n"
+		"\tcycle ITERS -- Iterations in each cycle of the colors  (default: 10 for each color)\n"
+		"\tset RRGGBB -- Hexadecimal color of points which do not escape  (default: 000000)\n"
+		"\tRRGGBB -- Hexadecimal color to add to the cycle\n"
+	"\n"
+	"Formulas:\n"
+		"\tExpressions of z and c using numbers, i, pi, e, + - * / ^, (...), |...|, and the functions\n"
+		"\tsqrt exp log sin cos tan sinh cosh tanh conj rect abs re im, e.g. \"z^3 - z + c\" or \"sin(z) * c\"\n"
+	"\n"
+	"Raw Formats:\n"
+		"\tppm and pam are written uncompressed with a single header, and a sweep to standard output is a stream of images in order\n"
+		"\tpfm holds the iterations, distances, or accumulated values of each pixel as floats, -1 for points in the set, from the bottom row up\n"
 	"\n"
 	"Controls:\n"
 		"\tArrows / WASD / HJKL -- Move viewport around complex plane\n"
 		"\t'<' / '>' -- Zoom Out / Zoom In\n"
 		"\t'[' / ']' -- Decrease Iterations / Increase Iterations\n"
 		"\tC -- Toggle Continuous Coloring\n"
-		"\tY -- Take Screenshot (stored to -s option)\n"
-		"\tQ -- Quit"
+		"\tY -- Take Screenshot (stored to -s option) in the background, showing its progress in the status line\n"
+		"\tQ -- Quit\n"
+	"\n"
+	"Tile Requests:\n"
+		"\tGET /tile?x=REAL&y=IMAG&w=WIDTH&h=HEIGHT&cols=COLUMNS&rows=ROWS\n"
+		"\t(x, y) is the center and w by h is the size of the tile, other options default to those given\n"
+		"\tOverride with n=ITERATIONS p=REAL[,IMAG] r=RADIUS j=REAL[,IMAG] rule=mandel|burning-ship|tricorn\n"
+		"\tscheme=NAME cont=0|1 aa=SAMPLES de=PIXELS prec=auto|float|double|dd orbit=KIND[:PARAM]"
 };
 
 
 
 // Draw the fractal of the given parameters to the terminal
-void draw_complex(viewport_t vw);
+// Returns the precision used to calculate it
+precision_t draw_complex(viewport_t vw);
 
-// Generate the color for a given number of iterations using the scheme
-png_color scheme_get_color(color_scheme_t scm, double iters);
 // Writes current screen to file using global fractal parameters and color scheme
 bool write_fractal(const char *filename, viewport_t vw, color_scheme_t scm);
+// Write image to file, or standard output for "-", in the format of the screenshots
+// px holds the colors and iters the values from render_iters, which are overwritten when writing pfm
+// Returns true if successful ; false if error
+bool write_image(const char *filename, const png_color *px, double *iters, int width, int height);
+// Queue screenshot of the window using a copy of the global parameters to be rendered in the background
+void queue_screenshot(viewport_t vw);
+// Check whether any screenshots are waiting to be written or to have their result shown
+bool screenshots_active();
+// Print the progress of the screenshots and the result of the last one finished on the given row
+void draw_screenshots(int row);
+// Wait for the queued screenshots to be written and stop their workers
+void finish_screenshots();
+// Render the Julia Sets of the sweep using the global parameters and write them out
+// Returns true if successful ; false if error
+bool run_sweep();
+// Serve tiles using the global parameters as defaults
+// Only returns if the server could not be started or failed
+bool run_server();
+// Time the kernels of each class of power and check the non-integer powers against cpow
+// Returns true if successful ; false if error
+bool run_bench();
+// Refine a screenshot of the window until the deadline or an interrupt then write it
+// Returns true if successful ; false if error
+bool run_deadline();
 
 int main(int argc, char *argv[]){
+	// Build the color tables of the provided schemes before any are chosen
+	for(int i = 0; i < SCHEME_COUNT; i++) scheme_compile(schemes + i);
 	global_scheme = schemes[0];
 	argp_parse(&argp, argc, argv, 0, NULL, NULL);
 	
-	// Init ncurses
+	// Sweeps are rendered in batch without opening the viewer
+	if(sweep_columns > 0) return run_sweep() ? 0 : 1;
+	// As are served tiles
+	if(serve_address) return run_server() ? 0 : 1;
+	// And benchmarks
+	if(bench) return run_bench() ? 0 : 1;
+	// And screenshots given a deadline
+	if(deadline > 0) return run_deadline() ? 0 : 1;
+	// And screenshots written to standard output
+	if(strcmp(screenshot_filename, "-") == 0){
+		viewport_t vw = view;
+		vw.rows = scrshot_height;
+		vw.columns = scrshot_width;
+		return write_fractal(screenshot_filename, vw, global_scheme) ? 0 : 1;
+	}
+	
+	// Init ncurses, using the locale of the environment so blocks and braille can be drawn
+	setlocale(LC_ALL, "");
 	initscr();
 	cbreak();
 	keypad(stdscr, TRUE);
@@ -232,16 +507,26 @@ int main(int argc, char *argv[]){
 	
 	complex mouse_loc = 0;
 	
+	// Image is drawn directly to the terminal unless using the color pairs of ncurses
+	if(term_auto) term_detect(COLORS, &term_mode, &term_color);
+	screen = term_init(term_mode, term_color);
+	refresh();
+	
 	int ch;
 	MEVENT evt;
-	bool running = true;
-	bool screenshot_finished = false, cont_toggled = false;
+	precision_t prec = PREC_DOUBLE;
+	bool running = true, redraw = true;
+	bool cont_toggled = false;
 	while(running){
 		getmaxyx(stdscr, view.rows, view.columns);
-		// Draw fractal
-		draw_complex(view);
+		// Draw fractal unless only checking on screenshots
+		if(redraw) prec = draw_complex(view);
 		
 		// Print stats to screen
+		if(term_mode != TERM_CELLS){
+			move(view.rows - STATUS_ROWS, 0);
+			clrtobot();
+		}
 		attron(COLOR_PAIR(0));
 		mvprintw(view.rows - 1, 0, "Iters: %i\tMouse: %lf + %lf * i | Window: (%lf, %lf)",
 			iterations,
@@ -249,12 +534,10 @@ int main(int argc, char *argv[]){
 			view.width, view.height
 		);
 		if(is_julia) printw("\t\tJulia At: %lf + %lf * i ", creal(rule.param), cimag(rule.param));
+		printw("\t\tPrecision: %s ", precision_names[prec]);
 		
-		// When screenshot is saved print message indicating it to the user
-		if(screenshot_finished){
-			mvprintw(view.rows - 2, 0, "Screenshot saved to %s ", screenshot_filename);
-			screenshot_finished = false;
-		}
+		// Show progress of screenshots and indicate to the user when they are saved
+		draw_screenshots(view.rows - 2);
 		
 		// When user toggles continuity indicate to user
 		if(cont_toggled){
@@ -264,35 +547,38 @@ int main(int argc, char *argv[]){
 		
 		attroff(COLOR_PAIR(0));
 		
+		// Wake up regularly to update the progress while screenshots are rendering
+		timeout(screenshots_active() ? 250 : -1);
 		ch = getch();
+		redraw = ch != ERR;
 		switch(ch){
 			case 'w': case 'W':
 			case 'k': case 'K':
 			case KEY_UP: // Move Up
-				view.corner += view.height * I / 10;
+				view_shift(&view, view.height * I / 10);
 			break;
 			case 's': case 'S':
 			case 'j': case 'J':
 			case KEY_DOWN: // Move Down
-				view.corner -= view.height * I / 10;
+				view_shift(&view, -view.height * I / 10);
 			break;
 			case 'a': case 'A':
 			case 'h': case 'H':
 			case KEY_LEFT: // Move Left
-				view.corner -= view.width / 10;
+				view_shift(&view, -view.width / 10);
 			break;
 			case 'd': case 'D':
 			case 'l': case 'L':
 			case KEY_RIGHT: // Move Right
-				view.corner += view.width / 10;
+				view_shift(&view, view.width / 10);
 			break;
 			case ',': case '<': // Zoom Out
-				view.corner += -view.width * 0.05 + view.height * 0.05 * I;
+				view_shift(&view, -view.width * 0.05 + view.height * 0.05 * I);
 				view.width *= 1.1;
 				view.height *= 1.1;
 			break;
 			case '.': case '>': // Zoom In
-				view.corner += view.width * 0.05 - view.height * 0.05 * I;
+				view_shift(&view, view.width * 0.05 - view.height * 0.05 * I);
 				view.width *= 0.9;
 				view.height *= 0.9;
 			break;
@@ -304,12 +590,9 @@ int main(int argc, char *argv[]){
 			case '}': case ']': iterations += 10;
 			break;
 			
-			// Take screenshot
+			// Take screenshot in the background at the screenshot dimensions
 			case 'y': case 'Y':
-				view.rows = scrshot_height;
-				view.columns = scrshot_width;
-				write_fractal(screenshot_filename, view, global_scheme);
-				screenshot_finished = true;
+				queue_screenshot((viewport_t){view.corner, view.width, view.height, scrshot_height, scrshot_width, view.corner_lo});
 			break;
 			
 			// Toggle continuous coloring for screenshots
@@ -318,6 +601,11 @@ int main(int argc, char *argv[]){
 				cont_toggled = true;
 			break;
 			
+			// Terminal is cleared by ncurses when resized
+			case KEY_RESIZE:
+				term_invalidate(&screen);
+			break;
+			
 			// Calculate mouse position
 			case KEY_MOUSE:
 				if(getmouse(&evt) == OK){
@@ -333,6 +621,8 @@ int main(int argc, char *argv[]){
 	}
 	
 	endwin();
+	term_free(&screen);
+	finish_screenshots();
 	return 0;
 }
 
@@ -340,20 +630,38 @@ int main(int argc, char *argv[]){
 
 
 // Draw complex grid to terminal screen
-void draw_complex(viewport_t vw){
-	int rows, cols, i;
-	complex cmp, seed = rule.param;
+precision_t draw_complex(viewport_t vw){
+	int i;
 	
 	getmaxyx(stdscr, vw.rows, vw.columns);
-	for(int r = 0; r < vw.rows; r++) for(int c = 0; c < vw.columns; c++){
-		cmp = comp_at_rc(vw, r, c);
+	if(term_mode != TERM_CELLS){
+		// Render several pixels per cell colored by the scheme, leaving the status rows to ncurses
+		int rows = vw.rows, columns = vw.columns, cur_row, cur_col;
+		vw.rows *= term_sub_rows(term_mode);
+		vw.columns *= term_sub_cols(term_mode);
+		render_t rd = {rule, is_julia, iterations, vw, global_scheme, 0, 0, 0, precision};
 		
-		// Create orbit and count length
-		if(!is_julia){
-			rule.param = cmp;
-			cmp = seed;
+		size_t sz = (size_t)vw.rows * vw.columns;
+		double *iters = malloc(sizeof(double) * sz);
+		png_color *px = malloc(sizeof(png_color) * sz);
+		if(iters && px){
+			render_iters(&rd, iters);
+			render_colors(&rd, iters, px);
+			getyx(curscr, cur_row, cur_col);
+			term_draw(&screen, px, rows - STATUS_ROWS, columns, cur_row, cur_col);
 		}
-		i = frc_orbit(rule, &cmp, iterations, NULL, 0);
+		free(iters);
+		free(px);
+		return render_precision(&rd);
+	}
+	
+	// Calculate orbit lengths for every cell using integer counts
+	render_t rd = {rule, is_julia, iterations, vw, {0}, 0, 0, 0, precision};
+	double iters[vw.rows * vw.columns];
+	render_iters(&rd, iters);
+	
+	for(int r = 0; r < vw.rows; r++) for(int c = 0; c < vw.columns; c++){
+		i = (int)iters[r * vw.columns + c];
 		
 		// Restrict colors to 7 (displayable by terminal)
 		i = i < 0 ? 0 : i % 7 + 1;
@@ -364,112 +672,558 @@ void draw_complex(viewport_t vw){
 		attroff(COLOR_PAIR(i));
 	}
 	
-	rule.param = seed;
+	return render_precision(&rd);
 }
 
 
 
-png_color scheme_get_color(color_scheme_t scm, double iters){
-	// If point is in set return set_color
-	if(iters < 0) return scm.set_color;
+// Take snapshot of set at current location
+// Returns true if successful ; false if error
+bool write_fractal(const char *filename, viewport_t vw, color_scheme_t scm){
+	render_t rd = {rule, is_julia, iterations, vw, scm, aa_samples, aa_threshold, de_thickness, precision, accum};
 	
-	// Collapse iters into the cycle length using modulo
-	iters = fmod(iters, (double)scm.iters_per_cycle);
-	int n = (int)(iters * scm.color_count / scm.iters_per_cycle);
+	size_t sz = (size_t)vw.rows * vw.columns;
+	double *iters = malloc(sizeof(double) * sz);
+	png_color *px = malloc(sizeof(png_color) * sz);
+	if(!iters || !px){
+		fprintf(stderr, "Could not allocate image of %ix%i pixels\n", vw.columns, vw.rows);
+		free(iters);
+		free(px);
+		return false;
+	}
 	
-	// Find 'distance' between iters and prior and subsequent colors
-	double r, s;
-	r = iters * scm.color_count / scm.iters_per_cycle - n;
-	s = 1 - r;
+	render_image(&rd, iters, px);
+	bool success = write_image(filename, px, iters, vw.columns, vw.rows);
 	
-	png_color c1 = scm.colors[n], c2 = scm.colors[(n + 1) % scm.color_count];
+	free(iters);
+	free(px);
+	return success;
+}
+
+bool write_image(const char *filename, const png_color *px, double *iters, int width, int height){
+	if(image_format == IMAGE_PNG && strcmp(filename, "-") != 0) return write_png(filename, px, width, height);
+	
+	int fd = image_open(filename);
+	if(fd < 0) return false;
 	
-	// Weighted average of colors
-	c1.red = (int)(s * c1.red + r * c2.red);
-	c1.green = (int)(s * c1.green + r * c2.green);
-	c1.blue = (int)(s * c1.blue + r * c2.blue);
-	return c1;
+	bool success;
+	if(image_format == IMAGE_PNG){
+		// Standard output gets the encoded image in one write
+		size_t size;
+		unsigned char *data = encode_png(px, width, height, &size);
+		success = data && write_vec(fd, &(struct iovec){data, size}, 1);
+		free(data);
+	}else if(image_format == IMAGE_PFM) success = write_pfm(fd, iters, width, height);
+	else success = write_pnm(fd, image_format, px, width, height);
+	
+	success = image_close(fd) && success;
+	if(!success) fprintf(stderr, "Could not write image to %s\n", filename);
+	return success;
 }
 
-// Take snapshot of set at current location
-// Returns true if successful ; false if error
-bool write_fractal(const char *filename, viewport_t vw, color_scheme_t scm){
-	FILE *fl = fopen(filename, "wb");
-	if(!fl){
-		fprintf(stderr, "Could not open %s to write image\n", filename);
-		fclose(fl);
-		return false;
+
+
+// Screenshots are rendered by a pool of worker threads while the viewer keeps running
+// Each job is split into bands of rows so that the workers can share a single screenshot
+#define SCREENSHOT_BAND_ROWS 8
+
+typedef struct screenshot{
+	render_t rd;  // Copy of the parameters when the screenshot was taken
+	char filename[SCREENSHOT_NAME_LENGTH];
+	int index;  // Number of screenshots taken before this one
+	double *iters;  // From node_alloc so that each band is placed by the worker which renders it
+	png_color *px;
+	
+	// Number of bands in the image, handed out to workers, and finished
+	int bands, next_band, done_bands;
+	
+	struct screenshot *next;
+} screenshot_t;
+
+// Queue of screenshots shared by the viewer and the workers
+struct{
+	pthread_mutex_t lock;
+	pthread_cond_t wake;  // Signaled when a job is queued or the workers should stop
+	
+	// Jobs in the order they were taken, kept until written
+	screenshot_t *head, *tail;
+	int pending, taken;
+	
+	pthread_t *workers;
+	int worker_count;
+	bool stopping;
+	
+	// Result of the last job written, until shown by the viewer
+	char message[SCREENSHOT_NAME_LENGTH + 32];
+} shots = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+// Color and write the image of a job whose bands are all finished
+static bool screenshot_write(screenshot_t *job){
+	render_colors(&job->rd, job->iters, job->px);
+	render_antialias(&job->rd, job->iters, job->px);
+	
+	// Write to a temporary file first so that a job finishing at the same time can't interleave with it
+	char tmpname[SCREENSHOT_NAME_LENGTH + 16];
+	snprintf(tmpname, sizeof(tmpname), "%s.%i.%i", job->filename, (int)getpid(), job->index);
+	bool success = write_image(tmpname, job->px, job->iters, job->rd.view.columns, job->rd.view.rows);
+	return success && rename(tmpname, job->filename) == 0;
+}
+
+static void *screenshot_worker(void *arg){
+	screenshot_t *job, *prev, **link;
+	int band, r0, r1;
+	bool success;
+	
+	// Bands are first written by the worker which renders them, so pinned workers keep their bands on their own node
+	if(numa) node_pin((int)(intptr_t)arg);
+	
+	pthread_mutex_lock(&shots.lock);
+	while(1){
+		// Take the next band from the oldest job with any left
+		for(job = shots.head; job && job->next_band >= job->bands; job = job->next);
+		if(!job){
+			if(shots.stopping) break;
+			pthread_cond_wait(&shots.wake, &shots.lock);
+			continue;
+		}
+		band = job->next_band++;
+		pthread_mutex_unlock(&shots.lock);
+		
+		r0 = band * SCREENSHOT_BAND_ROWS;
+		r1 = r0 + SCREENSHOT_BAND_ROWS < job->rd.view.rows ? r0 + SCREENSHOT_BAND_ROWS : job->rd.view.rows;
+		render_iters_rows(&job->rd, job->iters, r0, r1);
+		
+		pthread_mutex_lock(&shots.lock);
+		if(++job->done_bands < job->bands) continue;
+		
+		// Whoever finishes the last band writes the image
+		pthread_mutex_unlock(&shots.lock);
+		success = screenshot_write(job);
+		pthread_mutex_lock(&shots.lock);
+		
+		snprintf(shots.message, sizeof(shots.message), success ? "Screenshot saved to %s " : "Could not save screenshot to %s ", job->filename);
+		for(prev = NULL, link = &shots.head; *link != job; prev = *link, link = &(*link)->next);
+		*link = job->next;
+		if(shots.tail == job) shots.tail = prev;
+		shots.pending--;
+		
+		node_free(job->iters, sizeof(double) * job->rd.view.rows * job->rd.view.columns);
+		free(job->px);
+		free(job);
+	}
+	pthread_mutex_unlock(&shots.lock);
+	return NULL;
+}
+
+void queue_screenshot(viewport_t vw){
+	// Workers are only started once the first screenshot is taken
+	if(!shots.workers){
+		int count = threads < 1 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : threads;
+		shots.workers = malloc(sizeof(pthread_t) * count);
+		for(shots.worker_count = 0; shots.workers && shots.worker_count < count; shots.worker_count++){
+			if(pthread_create(shots.workers + shots.worker_count, NULL, screenshot_worker, (void*)(intptr_t)node_of(shots.worker_count, count))) break;
+		}
 	}
 	
-	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if(!png_ptr){
-		fprintf(stderr, "Could not allocate write struct\n");
-		fclose(fl);
-		return false;
+	screenshot_t *job = malloc(sizeof(screenshot_t));
+	size_t sz = (size_t)vw.rows * vw.columns;
+	if(job){
+		*job = (screenshot_t){{rule, is_julia, iterations, vw, global_scheme, aa_samples, aa_threshold, de_thickness, precision, accum}};
+		strcpy(job->filename, screenshot_filename);
+		job->iters = node_alloc(sizeof(double) * sz);
+		job->px = malloc(sizeof(png_color) * sz);
+		job->bands = (vw.rows + SCREENSHOT_BAND_ROWS - 1) / SCREENSHOT_BAND_ROWS;
 	}
 	
-	png_infop info_ptr = png_create_info_struct(png_ptr);
-	if(!info_ptr){
-		fprintf(stderr, "Could not allocate info struct\n");
-		png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-		fclose(fl);
+	pthread_mutex_lock(&shots.lock);
+	if(!job || !job->iters || !job->px || shots.worker_count == 0){
+		snprintf(shots.message, sizeof(shots.message), "Could not start screenshot of %ix%i pixels ", vw.columns, vw.rows);
+		if(job){
+			node_free(job->iters, sizeof(double) * sz);
+			free(job->px);
+			free(job);
+		}
+	}else{
+		if(shots.tail) shots.tail->next = job;
+		else shots.head = job;
+		shots.tail = job;
+		job->index = shots.taken++;
+		shots.pending++;
+		pthread_cond_broadcast(&shots.wake);
+	}
+	pthread_mutex_unlock(&shots.lock);
+}
+
+bool screenshots_active(){
+	pthread_mutex_lock(&shots.lock);
+	bool active = shots.pending > 0 || shots.message[0];
+	pthread_mutex_unlock(&shots.lock);
+	return active;
+}
+
+void draw_screenshots(int row){
+	pthread_mutex_lock(&shots.lock);
+	move(row, 0);
+	if(shots.message[0]){
+		printw("%s", shots.message);
+		shots.message[0] = '\0';
+	}
+	if(shots.head){
+		printw("Screenshot: %i%% ", 100 * shots.head->done_bands / shots.head->bands);
+		if(shots.pending > 1) printw("(%i more queued) ", shots.pending - 1);
+	}
+	pthread_mutex_unlock(&shots.lock);
+}
+
+void finish_screenshots(){
+	if(!shots.workers) return;
+	
+	pthread_mutex_lock(&shots.lock);
+	if(shots.pending > 0) printf("Waiting for %i screenshot%s to be saved\n", shots.pending, shots.pending > 1 ? "s" : "");
+	shots.stopping = true;
+	pthread_cond_broadcast(&shots.wake);
+	pthread_mutex_unlock(&shots.lock);
+	
+	for(int i = 0; i < shots.worker_count; i++) pthread_join(shots.workers[i], NULL);
+	if(shots.message[0]) printf("%s\n", shots.message);
+	free(shots.workers);
+}
+
+
+
+// Write each image of the sweep to its own file
+bool sweep_out_file(int index, const render_t *rd, const png_color *px, double *iters, void *data){
+	// Insert index of image before the extension of the screenshot filename
+	char filename[SCREENSHOT_NAME_LENGTH + 16];
+	const char *ext = strrchr(screenshot_filename, '.');
+	int base = ext ? (int)(ext - screenshot_filename) : (int)strlen(screenshot_filename);
+	snprintf(filename, sizeof(filename), "%.*s_%04i%s", base, screenshot_filename, index, ext ? ext : "");
+	
+	if(!write_image(filename, px, iters, rd->view.columns, rd->view.rows)){
+		fprintf(stderr, "Could not save Julia Set at %lf + %lf * i to %s\n", creal(rd->rule.param), cimag(rd->rule.param), filename);
 		return false;
 	}
+	printf("Julia Set at %lf + %lf * i saved to %s\n", creal(rd->rule.param), cimag(rd->rule.param), filename);
+	return true;
+}
+
+// Images of a sweep written to standard output are sent in order, one after another
+// Workers take the images in order, so the worker holding the next image never waits and the rest wait for it
+struct{
+	pthread_mutex_t lock;
+	pthread_cond_t turn;
+	int next;  // Index of the next image to write
+} sweep_stream = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+
+bool sweep_out_stream(int index, const render_t *rd, const png_color *px, double *iters, void *data){
+	pthread_mutex_lock(&sweep_stream.lock);
+	while(sweep_stream.next != index) pthread_cond_wait(&sweep_stream.turn, &sweep_stream.lock);
+	pthread_mutex_unlock(&sweep_stream.lock);
 	
-	if(setjmp(png_jmpbuf(png_ptr))){
-		fprintf(stderr, "Error in PNG writing\n");
-		png_destroy_write_struct(&png_ptr, &info_ptr);
-		fclose(fl);
+	bool success = write_image(screenshot_filename, px, iters, rd->view.columns, rd->view.rows);
+	if(success) fprintf(stderr, "Julia Set at %lf + %lf * i written\n", creal(rd->rule.param), cimag(rd->rule.param));
+	else fprintf(stderr, "Could not write Julia Set at %lf + %lf * i\n", creal(rd->rule.param), cimag(rd->rule.param));
+	
+	// The next image still takes its turn so that the workers waiting for it are released
+	pthread_mutex_lock(&sweep_stream.lock);
+	sweep_stream.next++;
+	pthread_cond_broadcast(&sweep_stream.turn);
+	pthread_mutex_unlock(&sweep_stream.lock);
+	return success;
+}
+
+// Copy each image of the sweep into its cell of the contact sheet
+// Every image covers a separate region of the sheet so no locking is needed
+bool sweep_out_sheet(int index, const render_t *rd, const png_color *px, double *iters, void *data){
+	png_color *sheet = data;
+	int width = rd->view.columns, height = rd->view.rows;
+	int top = index / sweep_sheet_columns * height, left = index % sweep_sheet_columns * width;
+	
+	for(int r = 0; r < height; r++){
+		memcpy(sheet + (size_t)(top + r) * sweep_sheet_columns * width + left, px + r * width, sizeof(png_color) * width);
+	}
+	return true;
+}
+
+bool run_sweep(){
+	int count = sweep_columns * sweep_rows;
+	render_t *jobs = malloc(sizeof(render_t) * count);
+	if(!jobs){
+		fprintf(stderr, "Could not allocate sweep of %i Julia Sets\n", count);
 		return false;
 	}
 	
-	// Output PNG data
-	png_init_io(png_ptr, fl);
-	png_set_IHDR(png_ptr, info_ptr, view.columns, view.rows,
-		8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
-	);
-	
-	png_write_info(png_ptr, info_ptr);
-	
-	png_bytep row;
-	int r, c;
-	double i;
-	complex cmp, seed = rule.param;
-	// Iterate through pixels
-	row = png_malloc(png_ptr, view.columns * sizeof(png_color));
-	for(r = 0; r < view.rows; r++){
-		for(c = 0; c < view.columns; c++){
-			cmp = comp_at_rc(vw, r, c);
-			
-			// Calculate length of orbit before escape
-			if(!is_julia){
-				/* When calculating Mandelbrot, for example
-				 *   the point location, `cmp`, is used as the `c` in
-				 *   z -> z^2 + c
-				 *   while the initial value of z is uniform across the whole image
-				 */
-				rule.param = cmp;
-				cmp = seed;
-			}
-			i = frc_orbit(rule, &cmp, iterations, NULL, 0);
-			
-			if(scm.is_continuous && i > 0){
-				i -= log(log(cabs(cmp)) / log(rule.radius)) / log(cabs(rule.power));
-			}
-			
-			((png_color*)row)[c] = scheme_get_color(scm, i);
+	// Every image uses the current window at the screenshot dimensions
+	viewport_t vw = view;
+	vw.rows = scrshot_height;
+	vw.columns = scrshot_width;
+	
+	double t, u;
+	for(int r = 0; r < sweep_rows; r++) for(int c = 0; c < sweep_columns; c++){
+		render_t *rd = jobs + r * sweep_columns + c;
+		*rd = (render_t){rule, 1 /* Julia */, iterations, vw, global_scheme, aa_samples, aa_threshold, de_thickness, precision, accum};
+		
+		// Position of image along path or across grid
+		t = sweep_columns > 1 ? (double)c / (sweep_columns - 1) : 0;
+		u = sweep_rows > 1 ? (double)r / (sweep_rows - 1) : 0;
+		if(sweep_rows > 1){
+			rd->rule.param = creal(sweep_from) + t * creal(sweep_to - sweep_from)
+				+ (cimag(sweep_from) + u * cimag(sweep_to - sweep_from)) * I;
+		}else rd->rule.param = sweep_from + t * (sweep_to - sweep_from);
+	}
+	
+	if(threads < 1) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	
+	bool success, is_stdout = strcmp(screenshot_filename, "-") == 0;
+	if(sweep_sheet){
+		// Lay out a path of params as close to a square as possible
+		int sheet_rows;
+		if(sweep_rows > 1) sweep_sheet_columns = sweep_columns;
+		else sweep_sheet_columns = (int)ceil(sqrt(count));
+		sheet_rows = (count + sweep_sheet_columns - 1) / sweep_sheet_columns;
+		
+		size_t sz = (size_t)sweep_sheet_columns * vw.columns * sheet_rows * vw.rows;
+		png_color *sheet = calloc(sz, sizeof(png_color));
+		if(!sheet){
+			fprintf(stderr, "Could not allocate contact sheet of %ix%i images\n", sweep_sheet_columns, sheet_rows);
+			free(jobs);
+			return false;
+		}
+		
+		success = render_batch(jobs, count, threads, numa, sweep_out_sheet, sheet)
+			&& write_image(screenshot_filename, sheet, NULL, sweep_sheet_columns * vw.columns, sheet_rows * vw.rows);
+		if(success) fprintf(is_stdout ? stderr : stdout, "Contact sheet of %i Julia Sets saved to %s\n", count, screenshot_filename);
+		free(sheet);
+	}else success = render_batch(jobs, count, threads, numa, is_stdout ? sweep_out_stream : sweep_out_file, NULL);
+	
+	if(!success) fprintf(stderr, "Could not complete sweep\n");
+	free(jobs);
+	return success;
+}
+
+
+
+bool run_server(){
+	// Tiles default to the current window at the screenshot dimensions
+	viewport_t vw = view;
+	vw.rows = scrshot_height;
+	vw.columns = scrshot_width;
+	
+	server_t sv = {
+		{rule, is_julia, iterations, vw, global_scheme, aa_samples, aa_threshold, de_thickness, precision, accum},
+		schemes, scheme_names, SCHEME_COUNT,
+		threads < 1 ? (int)sysconf(_SC_NPROCESSORS_ONLN) : threads,
+		(size_t)cache_megabytes << 20
+	};
+	
+	return serve(serve_address, &sv);
+}
+
+
+
+// One power of each class with its own kernel, timed by the benchmark
+static const struct{
+	const char *name;
+	complex power;
+} bench_powers[] = {
+	{"square", 2},
+	{"cube", 3},
+	{"integer", 5},
+	{"real", 2.5},
+	{"complex", 2 + 0.3 * I}
+};
+#define BENCH_POWERS (int)(sizeof(bench_powers) / sizeof(bench_powers[0]))
+#define BENCH_SIZE 256  // Rows and columns of the grid of points timed for each power
+#define BENCH_CHECKS 1000000  // Number of random points at which frc_cpow is checked against cpow
+
+// Iterate every point of a BENCH_SIZE by BENCH_SIZE grid over the window with kern, or with cpow if kern is NULL
+// Returns nanoseconds per iteration
+static double bench_kernel(frc_kernel_t kern, fractal_t fr){
+	viewport_t vw = view;
+	vw.rows = vw.columns = BENCH_SIZE;
+	
+	struct timespec start, end;
+	long long total = 0;
+	complex pt;
+	int i;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int r = 0; r < BENCH_SIZE; r++) for(int c = 0; c < BENCH_SIZE; c++){
+		pt = comp_at_rc(vw, r, c);
+		if(!is_julia){
+			fr.param = pt;
+			pt = 0;
+		}
+		
+		if(kern){
+			i = kern(&fr, &pt, iterations, NULL, 0);
+			total += i < 0 ? iterations : i;
+		}else{
+			for(i = 0; cabs(pt) < fr.radius && i < iterations; i++) pt = cpow(fr.trans ? fr.trans(pt) : pt, fr.power) + fr.param;
+			total += i;
 		}
-		png_write_row(png_ptr, row);
 	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	return total > 0 ? secs * 1e9 / total : 0;
+}
+
+// Iterate the grid as bench_kernel does while tracking the derivative with kern, or with cpow if kern is NULL
+// Returns nanoseconds per iteration
+static double bench_de_kernel(frc_de_kernel_t kern, fractal_t fr){
+	viewport_t vw = view;
+	vw.rows = vw.columns = BENCH_SIZE;
 	
-	rule.param = seed;  // Reset rule.param since it may have been used to store cmp
+	struct timespec start, end;
+	long long total = 0;
+	complex pt, dz, dc = is_julia ? 0 : 1, tz;
+	int i;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(int r = 0; r < BENCH_SIZE; r++) for(int c = 0; c < BENCH_SIZE; c++){
+		pt = comp_at_rc(vw, r, c);
+		dz = is_julia ? 1 : 0;
+		if(!is_julia){
+			fr.param = pt;
+			pt = 0;
+		}
+		
+		if(kern){
+			i = kern(&fr, &pt, &dz, dc, iterations);
+			total += i < 0 ? iterations : i;
+		}else{
+			// The reflection of the derivative by the transform is left out as it costs nothing next to cpow
+			for(i = 0; cabs(pt) < fr.radius && i < iterations; i++){
+				tz = fr.trans ? fr.trans(pt) : pt;
+				dz = fr.power * cpow(tz, fr.power - 1) * dz + dc;
+				pt = cpow(tz, fr.power) + fr.param;
+			}
+			total += i;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 	
-	png_write_end(png_ptr, NULL);  // End writing
-	png_free(png_ptr, row);  // Deallocate row storage
-	png_destroy_write_struct(&png_ptr, &info_ptr);
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	return total > 0 ? secs * 1e9 / total : 0;
+}
+
+// Largest error of frc_cpow relative to the magnitude of cpow over random points within the radius
+// A quarter of the points are scaled down to check numbers close to zero
+static double bench_check(complex power){
+	unsigned int seed = 1;
+	double err, worst = 0, rad = rule.radius;
+	complex pt, want;
+	for(int i = 0; i < BENCH_CHECKS; i++){
+		pt = rad * (2.0 * rand_r(&seed) / RAND_MAX - 1) + rad * (2.0 * rand_r(&seed) / RAND_MAX - 1) * I;
+		if(i % 4 == 0) pt *= 1e-6;
+		want = cpow(pt, power);
+		if(cabs(want) == 0) continue;
+		err = cabs(frc_cpow(pt, power) - want) / cabs(want);
+		if(err > worst) worst = err;
+	}
+	return worst;
+}
+
+bool run_bench(){
+	printf("Kernels over %ix%i points of the window, up to %i iterations each\n", BENCH_SIZE, BENCH_SIZE, iterations);
+	printf("%-8s %-10s %14s %14s %8s %18s\n", "Class", "Power", "ns/iteration", "cpow ns/iter", "Speedup", "Error vs cpow");
 	
-	fclose(fl);  // Close file descriptor
+	// Formulas have a kernel of their own, so only the rule is timed
+	fractal_t fr = rule;
+	fr.formula = NULL;
+	double fast, slow;
+	char power[32];
+	for(int p = 0; p < BENCH_POWERS; p++){
+		fr.power = bench_powers[p].power;
+		fast = bench_kernel(frc_select(&fr), fr);
+		slow = bench_kernel(NULL, fr);
+		
+		snprintf(power, sizeof(power), cimag(fr.power) ? "%g%+gi" : "%g", creal(fr.power), cimag(fr.power));
+		printf("%-8s %-10s %14.2f %14.2f %7.1fx", bench_powers[p].name, power, fast, slow, fast > 0 ? slow / fast : 0);
+		
+		// Integer powers are calculated by repeated multiplication rather than log-polar form
+		if(cimag(fr.power) != 0 || creal(fr.power) != floor(creal(fr.power))) printf(" %18.3g\n", bench_check(fr.power));
+		else printf(" %18s\n", "-");
+	}
 	
+	// Distance estimation kernels carry the derivative through the same powers
+	printf("\nDistance estimation kernels over the same points\n");
+	printf("%-8s %-10s %14s %14s %8s\n", "Class", "Power", "ns/iteration", "cpow ns/iter", "Speedup");
+	for(int p = 0; p < BENCH_POWERS; p++){
+		fr.power = bench_powers[p].power;
+		fast = bench_de_kernel(frc_select_de(&fr), fr);
+		slow = bench_de_kernel(NULL, fr);
+		
+		snprintf(power, sizeof(power), cimag(fr.power) ? "%g%+gi" : "%g", creal(fr.power), cimag(fr.power));
+		printf("%-8s %-10s %14.2f %14.2f %7.1fx\n", bench_powers[p].name, power, fast, slow, fast > 0 ? slow / fast : 0);
+	}
 	return true;
 }
+
+
+
+// Set by SIGINT to stop refining, after which a second interrupt ends the program as usual
+static volatile sig_atomic_t deadline_interrupted = 0;
+static void deadline_interrupt(int sig){
+	deadline_interrupted = 1;
+}
+
+// Names of the stages of render_progressive for the message once written
+static const char *stage_names[] = {"coarse", "full", "deeper", "smoothed"};
+
+// Stop refining once the time given by data has passed or when interrupted
+static bool deadline_passed(void *data){
+	const struct timespec *end = data;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return deadline_interrupted || now.tv_sec > end->tv_sec || (now.tv_sec == end->tv_sec && now.tv_nsec >= end->tv_nsec);
+}
+
+bool run_deadline(){
+	viewport_t vw = view;
+	vw.rows = scrshot_height;
+	vw.columns = scrshot_width;
+	render_t rd = {rule, is_julia, iterations, vw, global_scheme, aa_samples, aa_threshold, de_thickness, precision, accum};
+	
+	size_t sz = (size_t)vw.rows * vw.columns;
+	double *iters = malloc(sizeof(double) * sz);
+	png_color *px = malloc(sizeof(png_color) * sz);
+	if(!iters || !px){
+		fprintf(stderr, "Could not allocate image of %ix%i pixels\n", vw.columns, vw.rows);
+		free(iters);
+		free(px);
+		return false;
+	}
+	
+	struct sigaction sa = {0};
+	sa.sa_handler = deadline_interrupt;
+	sa.sa_flags = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	end.tv_sec = start.tv_sec + (time_t)deadline;
+	end.tv_nsec = start.tv_nsec + (long)((deadline - floor(deadline)) * 1e9);
+	if(end.tv_nsec >= 1000000000){
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000;
+	}
+	
+	int reached;
+	render_stage_t stage = render_progressive(&rd, iters, px, deadline_passed, &end, &reached);
+	signal(SIGINT, SIG_DFL);
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double secs = now.tv_sec - start.tv_sec + (now.tv_nsec - start.tv_nsec) / 1e9;
+	
+	bool success = write_image(screenshot_filename, px, iters, vw.columns, vw.rows);
+	if(success){
+		fprintf(strcmp(screenshot_filename, "-") == 0 ? stderr : stdout, "Screenshot saved to %s after %.2fs at the %s stage (up to %i iterations)%s\n",
+			screenshot_filename, secs, stage_names[stage], reached, deadline_interrupted ? ", interrupted" : "");
+	}
+	
+	free(iters);
+	free(px);
+	return success;
+}
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "image.h"
+
+// Most buffers accepted by one call to writev, which limits.h only defines for some feature macros
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+const char *image_format_names[] = {"png", "ppm", "pam", "pfm", "counts"};
+
+bool image_format_parse(const char *name, image_format_t *fmt){
+	for(int i = 0; i <= IMAGE_COUNTS; i++){
+		if(strcmp(image_format_names[i], name) == 0){
+			*fmt = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+image_format_t image_format_guess(const char *filename){
+	image_format_t fmt;
+	const char *ext = strrchr(filename, '.');
+	if(ext && image_format_parse(ext + 1, &fmt)) return fmt;
+	return IMAGE_PNG;
+}
+
+int image_open(const char *filename){
+	if(strcmp(filename, "-") == 0) return STDOUT_FILENO;
+	
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(fd < 0) fprintf(stderr, "Could not open %s to write image\n", filename);
+	return fd;
+}
+
+bool image_close(int fd){
+	return fd == STDOUT_FILENO || close(fd) == 0;
+}
+
+bool write_vec(int fd, struct iovec *iov, int count){
+	ssize_t len;
+	while(count > 0){
+		len = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+		if(len < 0){
+			if(errno == EINTR) continue;
+			return false;
+		}
+		
+		// Skip the buffers written entirely and start from the rest of one written partially
+		for(; count > 0 && (size_t)len >= iov->iov_len; iov++, count--) len -= iov->iov_len;
+		if(count > 0){
+			iov->iov_base = (char*)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+	return true;
+}
+
+bool write_pnm(int fd, image_format_t fmt, const png_color *px, int width, int height){
+	char header[128];
+	int len;
+	if(fmt == IMAGE_PAM) len = snprintf(header, sizeof(header), "P7\nWIDTH %i\nHEIGHT %i\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n", width, height);
+	else len = snprintf(header, sizeof(header), "P6\n%i %i\n255\n", width, height);
+	
+	// Colors are stored as packed bytes of red, green, and blue, which is exactly the layout of the pixels
+	struct iovec iov[2] = {
+		{header, len},
+		{(void*)px, sizeof(png_color) * width * height}
+	};
+	return write_vec(fd, iov, 2);
+}
+
+bool write_pfm(int fd, double *vals, int width, int height){
+	// Each float is written at or before the double it came from, so narrowing in order never overwrites a value still to be read
+	// The floats are copied in as bytes since they share the memory of the doubles
+	float *flts = (float*)vals, flt;
+	size_t sz = (size_t)width * height;
+	for(size_t i = 0; i < sz; i++){
+		flt = (float)vals[i];
+		memcpy(flts + i, &flt, sizeof(float));
+	}
+	
+	// Negative scale marks little-endian floats
+	const unsigned int one = 1;
+	char header[64];
+	int len = snprintf(header, sizeof(header), "Pf\n%i %i\n%s\n", width, height, *(const char*)&one ? "-1.0" : "1.0");
+	
+	struct iovec *iov = malloc(sizeof(struct iovec) * (height + 1));
+	if(!iov) return false;
+	iov[0] = (struct iovec){header, len};
+	for(int r = 0; r < height; r++) iov[r + 1] = (struct iovec){flts + (size_t)(height - 1 - r) * width, sizeof(float) * width};
+	
+	bool success = write_vec(fd, iov, height + 1);
+	free(iov);
+	return success;
+}
@@ -0,0 +1,69 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#include <png.h>
+
+
+// Formats that images and plots can be written in
+typedef enum{
+	IMAGE_PNG,  // Compressed 8-bit RGB
+	IMAGE_PPM,  // Binary portable pixmap (P6) of 8-bit RGB
+	IMAGE_PAM,  // Portable arbitrary map (P7) of 8-bit RGB
+	IMAGE_PFM,  // Portable float map of one float per pixel, such as the values from render_iters
+	IMAGE_COUNTS  // Raw counts of the bins of a plot, see plot_write_counts
+} image_format_t;
+
+// Names of the formats as given on the command line and used as file extensions
+extern const char *image_format_names[];
+
+// Find the format with the given name
+// Returns true if found ; false if there is no such format
+bool image_format_parse(const char *name, image_format_t *fmt);
+// Choose the format from the extension of filename, PNG if it has none of the others
+image_format_t image_format_guess(const char *filename);
+
+// Open filename to be written by the writers below, where "-" is standard output
+// Returns file descriptor ; -1 if error (with a message printed to stderr)
+int image_open(const char *filename);
+// Close file descriptor from image_open, leaving standard output open
+// Returns true if successful ; false if error
+bool image_close(int fd);
+
+/* Write every buffer of iov to fd with as few calls to writev as possible
+ * Continues after partial writes and interruptions, so pipes receive every byte
+ * 
+ * Arguments:
+ *   int fd : file descriptor to write to
+ *   struct iovec *iov : buffers to write in order, which are modified to track what is left
+ *   int count : number of buffers
+ * 
+ * Returns:
+ *   bool : true if successful ; false if error
+ */
+bool write_vec(int fd, struct iovec *iov, int count);
+
+// Write image of `width` by `height` pixels in row-major order as PPM or PAM, chosen by fmt
+// The header and pixels are sent by a single writev straight from px
+// Returns true if successful ; false if error
+bool write_pnm(int fd, image_format_t fmt, const png_color *px, int width, int height);
+
+/* Write one value per pixel as a greyscale PFM of 32-bit floats in the byte order of the machine
+ * 
+ * The values are narrowed to floats in place, so that the rows can be sent by a single writev straight from vals
+ * PFM stores rows from the bottom up, which only changes the order of the rows in the writev
+ * 
+ * Arguments:
+ *   int fd : file descriptor to write to
+ *   double *vals : `width` by `height` values in row-major order
+ *   int width, height : dimensions of the image
+ * 
+ * Returns:
+ *   bool : true if successful ; false if error
+ *   double *vals : overwritten by the floats as written
+ */
+bool write_pfm(int fd, double *vals, int width, int height);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _LIBFRACTAL_H
+#define _LIBFRACTAL_H
+
+/* Library of the calculations behind fractal and buddha, built as libfractal.a and libfractal.so
+ * 
+ * Nothing in the library reads or writes global state (apart from view_gener and plot_rand, which use rand and the clock),
+ * so it can be used from many threads at once as long as each thread writes only to its own buffers:
+ * 
+ *   Escape-time grids are described by a render_t and calculated into buffers owned by the caller
+ *     render_t rd = {{NULL, 2, 0, 2}, false, 500, view, scheme};
+ *     render_iters(&rd, iters);  // rows * columns doubles
+ *     render_colors(&rd, iters, px);  // rows * columns colors
+ * 
+ *   Buddhabrots are described by a buddha_t and accumulated into counts owned by the caller
+ *     buddha_t bd = {{NULL, 2, 0, 2}, area, 1, {{20, 200}}};
+ *     buddha_accumulate(&bd, 1000000, seed, counts);  // channels * rows * columns unsigned ints
+ * 
+ *   Buffers are written out uncompressed by write_pnm and write_pfm, and plots by plot_write_counts
+ *     write_pnm(fd, IMAGE_PPM, px, columns, rows);
+ * 
+ *   Batches of images are rendered by render_batch, whose workers can be pinned to the NUMA nodes of the machine (see node.h)
+ *     render_batch(jobs, count, threads, numa, out, data);
+ * 
+ *   Formulas are compiled once by formula_compile and only read afterwards, so one can be shared by every thread
+ *     rd.rule.formula = &fm;
+ * 
+ * Link with -lfractal -lm -lpng -lpthread
+ */
+
+#include "fractal.h"
+#include "formula.h"
+#include "image.h"
+#include "node.h"
+#include "render.h"
+#include "buddha.h"
+
+#endif
@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "node.h"
+
+#define NODE_PATH "/sys/devices/system/node"
+
+
+// Processors of each node which has any, found once on first use
+static struct{
+	int count;
+	cpu_set_t *cpus;
+} nodes = {0, NULL};
+static pthread_once_t nodes_once = PTHREAD_ONCE_INIT;
+
+// Read a list of numbers such as "0-3,8-11" from the file at path into set
+// Returns true if the list held any numbers ; false otherwise
+static bool read_list(const char *path, cpu_set_t *set){
+	char list[4096], *at, *end;
+	long lo, hi;
+	
+	CPU_ZERO(set);
+	FILE *fl = fopen(path, "r");
+	if(!fl) return false;
+	at = fgets(list, sizeof(list), fl);
+	fclose(fl);
+	
+	while(at){
+		lo = strtol(at, &end, 10);
+		if(end == at) break;
+		hi = *end == '-' ? strtol(end + 1, &end, 10) : lo;
+		for(; lo <= hi && lo < CPU_SETSIZE; lo++) CPU_SET(lo, set);
+		at = *end == ',' ? end + 1 : NULL;
+	}
+	return CPU_COUNT(set) > 0;
+}
+
+static void node_init(){
+	// Node numbers are kept in a cpu_set_t too since they are listed the same way
+	cpu_set_t online, cpus;
+	char path[64];
+	if(!read_list(NODE_PATH "/online", &online)) return;
+	
+	nodes.cpus = malloc(sizeof(cpu_set_t) * CPU_COUNT(&online));
+	if(!nodes.cpus) return;
+	
+	// Nodes of memory alone have no processors to pin to
+	for(int id = 0; id < CPU_SETSIZE; id++) if(CPU_ISSET(id, &online)){
+		snprintf(path, sizeof(path), NODE_PATH "/node%i/cpulist", id);
+		if(read_list(path, &cpus)) nodes.cpus[nodes.count++] = cpus;
+	}
+}
+
+int node_count(){
+	pthread_once(&nodes_once, node_init);
+	return nodes.count > 0 ? nodes.count : 1;
+}
+
+int node_of(int index, int workers){
+	return workers > 0 ? (int)((long long)index * node_count() / workers) : 0;
+}
+
+bool node_pin(int node){
+	if(node_count() < 2) return false;
+	return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), nodes.cpus + node % nodes.count) == 0;
+}
+
+void *node_alloc(size_t bytes){
+	void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return mem == MAP_FAILED ? NULL : mem;
+}
+
+void node_free(void *mem, size_t bytes){
+	if(mem) munmap(mem, bytes);
+}
@@ -0,0 +1,30 @@
+#ifndef _NODE_H
+#define _NODE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/* Placement of threads on the NUMA nodes of the machine, as listed in /sys/devices/system/node
+ * 
+ * Pages are placed on the node of the thread which first writes to them,
+ * so a thread pinned to a node before it fills its buffers keeps them next to its processors
+ * Machines without NUMA information are treated as a single node holding every processor
+ */
+
+// Number of nodes with processors, at least one
+int node_count();
+// Node that worker `index` of `workers` should run on, spreading the workers evenly in contiguous blocks
+int node_of(int index, int workers);
+// Pin the calling thread to the processors of node, leaving it free to move between them
+// Returns true if successful ; false if error or the machine has only one node, where pinning would only restrict the scheduler
+bool node_pin(int node);
+
+// Allocate zeroed memory whose pages are fresh from the system, so each is placed by the thread which first writes to it
+// Memory reused by malloc may already have been placed by whichever thread wrote to it before
+// Returns NULL if error
+void *node_alloc(size_t bytes);
+// Deallocate memory of `bytes` bytes from node_alloc
+void node_free(void *mem, size_t bytes);
+
+#endif
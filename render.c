@@ -0,0 +1,765 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "node.h"
+#include "render.h"
+
+
+png_color scheme_get_color(color_scheme_t scm, double iters){
+	// If point is in set return set_color, as for values which are not finite and have no place in the cycle
+	if(iters < 0 || !isfinite(iters)) return scm.set_color;
+	if(scm.lut) return scm.lut[(long)(iters * SCHEME_LUT_STEPS) % scm.lut_size];
+	
+	// Collapse iters into the cycle length using modulo
+	iters = fmod(iters, (double)scm.iters_per_cycle);
+	int n = (int)(iters * scm.color_count / scm.iters_per_cycle);
+	
+	// Find 'distance' between iters and prior and subsequent colors
+	double r, s;
+	r = iters * scm.color_count / scm.iters_per_cycle - n;
+	s = 1 - r;
+	
+	png_color c1 = scm.colors[n], c2 = scm.colors[(n + 1) % scm.color_count];
+	
+	// Weighted average of colors
+	c1.red = (int)(s * c1.red + r * c2.red);
+	c1.green = (int)(s * c1.green + r * c2.green);
+	c1.blue = (int)(s * c1.blue + r * c2.blue);
+	return c1;
+}
+
+
+
+bool scheme_compile(color_scheme_t *scm){
+	int size = scm->iters_per_cycle * SCHEME_LUT_STEPS;
+	png_color *lut = malloc(sizeof(png_color) * size);
+	if(!lut) return false;
+	
+	// Every entry is calculated without the table so the colors match exactly
+	color_scheme_t plain = *scm;
+	plain.lut = NULL;
+	for(int i = 0; i < size; i++) lut[i] = scheme_get_color(plain, (double)i / SCHEME_LUT_STEPS);
+	
+	free(scm->lut);
+	scm->lut = lut;
+	scm->lut_size = size;
+	return true;
+}
+
+void scheme_colorize(color_scheme_t scm, const double *iters, double scale, int count, png_color *px){
+	// Find every index first in a loop simple enough to be vectorized, then gather the colors
+	int idx[count];
+	double steps = scale * SCHEME_LUT_STEPS;
+	for(int i = 0; i < count; i++){
+		idx[i] = iters[i] < 0 || !isfinite(iters[i]) ? -1 : (int)((long)(iters[i] * steps) % scm.lut_size);
+	}
+	for(int i = 0; i < count; i++) px[i] = idx[i] < 0 ? scm.set_color : scm.lut[idx[i]];
+}
+
+// Parse color written in hexadecimal as RRGGBB with an optional leading '#'
+static bool parse_hex_color(const char *str, png_color *cl){
+	unsigned int rgb;
+	if(*str == '#') str++;
+	if(strlen(str) != 6 || strspn(str, "0123456789abcdefABCDEF") != 6) return false;
+	sscanf(str, "%x", &rgb);
+	
+	*cl = (png_color){rgb >> 16, (rgb >> 8) & 0xff, rgb & 0xff};
+	return true;
+}
+
+bool scheme_load(const char *filename, color_scheme_t *scm){
+	FILE *fl = fopen(filename, "r");
+	if(!fl){
+		fprintf(stderr, "Could not open %s to read scheme\n", filename);
+		return false;
+	}
+	
+	color_scheme_t ld = {0, 0, 0, NULL, {0, 0, 0}, NULL, 0};
+	char line[256], word[64], arg[64];
+	int lineno = 0, cap = 0, fields;
+	bool success = true;
+	png_color cl, *colors;
+	while(success && fgets(line, sizeof(line), fl)){
+		lineno++;
+		
+		// Remove comment, which is a '#' followed by whitespace so that it is not confused with a color
+		for(char *cm = line; (cm = strchr(cm, '#')); cm++){
+			if(cm[1] == '\0' || strchr(" \t\r\n", cm[1])){
+				*cm = '\0';
+				break;
+			}
+		}
+		
+		fields = sscanf(line, " %63s %63s", word, arg);
+		if(fields < 1) continue;
+		
+		if(strcmp(word, "cycle") == 0){
+			success = fields == 2 && sscanf(arg, "%i", &ld.iters_per_cycle) == 1 && ld.iters_per_cycle > 0;
+		}else if(strcmp(word, "set") == 0){
+			success = fields == 2 && parse_hex_color(arg, &ld.set_color);
+		}else if(fields == 1 && parse_hex_color(word, &cl)){
+			// Grow array of colors as needed
+			if(ld.color_count == cap){
+				cap = cap ? cap * 2 : 8;
+				if(!(colors = realloc(ld.colors, sizeof(png_color) * cap))){
+					success = false;
+					break;
+				}
+				ld.colors = colors;
+			}
+			ld.colors[ld.color_count++] = cl;
+		}else success = false;
+		
+		if(!success) fprintf(stderr, "Invalid line %i in scheme %s: %s", lineno, filename, line);
+	}
+	fclose(fl);
+	
+	if(success && ld.color_count == 0){
+		fprintf(stderr, "Scheme %s has no colors\n", filename);
+		success = false;
+	}
+	// Default to ten iterations for every color as the provided schemes roughly do
+	if(ld.iters_per_cycle == 0) ld.iters_per_cycle = ld.color_count * 10;
+	
+	if(!success || !scheme_compile(&ld)){
+		free(ld.colors);
+		return false;
+	}
+	
+	*scm = ld;
+	return true;
+}
+
+
+
+bool accum_parse(const char *str, frc_accum_t *acc){
+	double real, imag = 0;
+	*acc = (frc_accum_t){ACCUM_NONE, 0, 5};
+	
+	if(strcmp(str, "none") == 0) return true;
+	else if(strcmp(str, "tia") == 0) acc->kind = ACCUM_TIA;
+	else if(strncmp(str, "trap", 4) == 0 && (str[4] == '\0' || str[4] == ':')){
+		acc->kind = ACCUM_TRAP;
+		if(str[4] && sscanf(str + 5, " %lf,%lf", &real, &imag) < 1) return false;
+		if(str[4]) acc->trap = real + imag * I;
+	}else if(strncmp(str, "stripe", 6) == 0 && (str[6] == '\0' || str[6] == ':')){
+		acc->kind = ACCUM_STRIPE;
+		if(str[6] && sscanf(str + 7, " %lf", &acc->density) < 1) return false;
+	}else return false;
+	
+	return true;
+}
+
+
+
+// Calculate the (possibly continuous) length of the orbit at a single point using the kernel selected for rd->rule
+static double render_point(const render_t *rd, frc_kernel_t kern, complex cmp){
+	fractal_t rule = rd->rule;
+	double i;
+	
+	// Calculate length of orbit before escape
+	if(!rd->is_julia){
+		/* When calculating Mandelbrot, for example
+		 *   the point location, `cmp`, is used as the `c` in
+		 *   z -> z^2 + c
+		 *   while the initial value of z is uniform across the whole image
+		 */
+		rule.param = cmp;
+		cmp = rd->rule.param;
+	}
+	i = kern(&rule, &cmp, rd->iterations, NULL, 0);
+	
+	if(rd->scheme.is_continuous && i > 0){
+		i -= log(log(cabs(cmp)) / log(rule.radius)) / log(cabs(rule.power));
+	}
+	return i;
+}
+
+// Calculate the (possibly continuous) length of the orbit at a single point using double-double precision
+static double render_point_dd(const render_t *rd, ddcomplex_t cmp){
+	ddcomplex_t param;
+	double i;
+	
+	if(rd->is_julia) param = dd_complex(rd->rule.param);
+	else{
+		param = cmp;
+		cmp = dd_complex(rd->rule.param);
+	}
+	i = frc_orbit_dd(&rd->rule, &cmp, param, rd->iterations);
+	
+	if(rd->scheme.is_continuous && i > 0){
+		i -= log(log(cabs(dd_to_complex(cmp))) / log(rd->rule.radius)) / log(cabs(rd->rule.power));
+	}
+	return i;
+}
+
+// Calculate distance to the boundary at a single point as a fraction of the distance of de_thickness pixels using the kernel selected for rd->rule
+// If dist is given, the estimated distance in the complex plane is stored into it
+static double render_point_de(const render_t *rd, frc_de_kernel_t kern, complex cmp, double *dist){
+	fractal_t rule = rd->rule;
+	complex dz;
+	int i;
+	
+	if(rd->is_julia){
+		dz = 1;
+		i = kern(&rule, &cmp, &dz, 0, rd->iterations);
+	}else{
+		rule.param = cmp;
+		cmp = rd->rule.param;
+		dz = 0;
+		i = kern(&rule, &cmp, &dz, 1, rd->iterations);
+	}
+	if(i < 0) return -1;
+	
+	double d = frc_distance(cmp, dz);
+	if(dist) *dist = d;
+	
+	d /= rd->de_thickness * fmax(rd->view.width / rd->view.columns, rd->view.height / rd->view.rows);
+	return d < 1 ? d : 1;
+}
+
+// Calculate the value accumulated over the orbit at a single point using the kernel selected for rd->accum
+static double render_point_accum(const render_t *rd, frc_accum_kernel_t kern, complex cmp){
+	fractal_t rule = rd->rule;
+	frc_accum_t acc = rd->accum;
+	int i;
+	
+	if(!rd->is_julia){
+		rule.param = cmp;
+		cmp = rd->rule.param;
+	}
+	i = kern(&rule, &cmp, rd->iterations, &acc);
+	if(i < 0) return -1;
+	
+	// Move from the average without the final iteration towards the full average as the orbit escapes further
+	if(rd->scheme.is_continuous && i > 0){
+		double frac = 1 - log(log(cabs(cmp)) / log(rule.radius)) / log(cabs(rule.power));
+		frac = frac < 0 ? 0 : frac > 1 ? 1 : frac;
+		return acc.last + frac * (acc.value - acc.last);
+	}
+	return acc.value;
+}
+
+precision_t render_precision(const render_t *rd){
+	if(rd->de_thickness > 0 || rd->accum.kind != ACCUM_NONE) return PREC_DOUBLE;
+	
+	precision_t prec = rd->precision == PREC_AUTO ? view_precision(rd->view) : rd->precision;
+	if(prec == PREC_DD && !frc_has_dd(&rd->rule)) prec = PREC_DOUBLE;
+	return prec;
+}
+
+// Kernels selected once for the whole render
+typedef struct{
+	frc_kernel_t orbit;  // NULL when the render uses double-double precision which has no kernel
+	frc_accum_kernel_t accum;  // NULL unless the render has an accumulator
+	frc_de_kernel_t de;  // NULL unless the render estimates distances
+} render_kernel_t;
+
+// Select kernels for the precision, accumulator, and distance estimation of the render
+static render_kernel_t render_kernel(const render_t *rd){
+	precision_t prec = render_precision(rd);
+	return (render_kernel_t){
+		prec == PREC_DD ? NULL : frc_select_prec(&rd->rule, prec),
+		frc_select_accum(&rd->rule, rd->accum.kind),
+		rd->de_thickness > 0 ? frc_select_de(&rd->rule) : NULL
+	};
+}
+
+// Calculate the value stored by render_iters for a point within the pixel at row r and column c
+// The point is offset from the corner of the pixel by the fractions dr and dc of a pixel
+static double render_value(const render_t *rd, render_kernel_t kern, int r, int c, double dr, double dc){
+	viewport_t vw = rd->view;
+	if(!kern.orbit) return render_point_dd(rd, comp_at_rc_dd(vw, r + dr, c + dc));
+	
+	complex cmp = comp_at_rc(vw, r, c) + dc * vw.width / vw.columns - dr * vw.height / vw.rows * I;
+	if(kern.de) return render_point_de(rd, kern.de, cmp, NULL);
+	else if(kern.accum) return render_point_accum(rd, kern.accum, cmp);
+	else return render_point(rd, kern.orbit, cmp);
+}
+
+// Generate color of a value from render_iters
+static png_color render_color(const render_t *rd, double val){
+	if(val < 0) return scheme_get_color(rd->scheme, val);
+	if(rd->de_thickness <= 0){
+		// Accumulated values pass through a whole cycle of colors for every change of one
+		if(rd->accum.kind != ACCUM_NONE) val *= rd->scheme.iters_per_cycle;
+		return scheme_get_color(rd->scheme, val);
+	}
+	
+	// Fade from boundary to background
+	png_color c1 = rd->scheme.set_color, c2 = rd->scheme.colors[0];
+	val = sqrt(val);
+	c1.red = (int)((1 - val) * c1.red + val * c2.red);
+	c1.green = (int)((1 - val) * c1.green + val * c2.green);
+	c1.blue = (int)((1 - val) * c1.blue + val * c2.blue);
+	return c1;
+}
+
+// Fill in rectangle of rows [r0, r1) and columns [c0, c1) of distance estimates
+// Uncalculated pixels are marked by NAN
+// Rectangles are only filled if can_cull, and only by their distance from the boundary if also can_bound
+static void render_rect_de(const render_t *rd, frc_de_kernel_t kern, double *vals, int r0, int c0, int r1, int c1, bool can_cull, bool can_bound){
+	viewport_t vw = rd->view;
+	int r, c;
+	double *val;
+	
+	// Small rectangles are calculated directly, as are those too thin to have an interior within their border
+	if(!can_cull || (r1 - r0) * (c1 - c0) <= 64 || r1 - r0 <= 2 || c1 - c0 <= 2){
+		for(r = r0; r < r1; r++) for(c = c0; c < c1; c++){
+			val = vals + r * vw.columns + c;
+			if(isnan(*val)) *val = render_point_de(rd, kern, comp_at_rc(vw, r, c), NULL);
+		}
+		return;
+	}
+	
+	// When even the least possible distance from the center escapes the rectangle
+	// every pixel is at least de_thickness from the boundary
+	double pxsize = fmax(vw.width / vw.columns, vw.height / vw.rows);
+	double dist, halfdiag = hypot(c1 - c0, r1 - r0) * pxsize / 2;
+	complex center = comp_at_rc(vw, r0, c0) + ((c1 - c0) * vw.width / vw.columns - (r1 - r0) * vw.height / vw.rows * I) / 2;
+	if(can_bound && render_point_de(rd, kern, center, &dist) >= 0 && dist / 4 - halfdiag >= rd->de_thickness * pxsize){
+		for(r = r0; r < r1; r++) for(c = c0; c < c1; c++) vals[r * vw.columns + c] = 1;
+		return;
+	}
+	
+	// Calculate border of rectangle
+	bool inside = true;
+	for(r = r0; r < r1; r++) for(c = c0; c < c1; c += (r == r0 || r == r1 - 1) ? 1 : c1 - c0 - 1){
+		val = vals + r * vw.columns + c;
+		if(isnan(*val)) *val = render_point_de(rd, kern, comp_at_rc(vw, r, c), NULL);
+		if(*val >= 0) inside = false;
+	}
+	
+	// The set has no holes so a border entirely within the set surrounds only points in the set
+	if(inside){
+		for(r = r0 + 1; r < r1 - 1; r++) for(c = c0 + 1; c < c1 - 1; c++) vals[r * vw.columns + c] = -1;
+		return;
+	}
+	
+	// Subdivide into quarters
+	int rm = (r0 + r1) / 2, cm = (c0 + c1) / 2;
+	render_rect_de(rd, kern, vals, r0, c0, rm, cm, can_cull, can_bound);
+	render_rect_de(rd, kern, vals, r0, cm, rm, c1, can_cull, can_bound);
+	render_rect_de(rd, kern, vals, rm, c0, r1, cm, can_cull, can_bound);
+	render_rect_de(rd, kern, vals, rm, cm, r1, c1, can_cull, can_bound);
+}
+
+void render_iters(const render_t *rd, double *iters){
+	render_iters_rows(rd, iters, 0, rd->view.rows);
+}
+
+void render_iters_rows(const render_t *rd, double *iters, int r0, int r1){
+	viewport_t vw = rd->view;
+	if(rd->de_thickness > 0){
+		for(size_t i = (size_t)r0 * vw.columns; i < (size_t)r1 * vw.columns; i++) iters[i] = NAN;
+		
+		// Filling rectangles relies on the lack of holes, which only holds for the holomorphic rules z -> z^n + c
+		// Filling by distance also relies on a quarter of the estimate being a lower bound on the distance
+		// which holds for Mandelbrot and for connected Julia sets, being those whose critical orbit from 0 stays bounded,
+		// but not for disconnected Julia sets, so those only fill rectangles whose border is within the set
+		complex p = rd->rule.power, z = 0;
+		bool can_cull = !rd->rule.trans && !rd->rule.formula && cimag(p) == 0 && creal(p) >= 2 && creal(p) == floor(creal(p));
+		bool can_bound = can_cull && (!rd->is_julia || frc_orbit(rd->rule, &z, rd->iterations, NULL, 0) < 0);
+		render_rect_de(rd, frc_select_de(&rd->rule), iters, r0, 0, r1, vw.columns, can_cull, can_bound);
+		return;
+	}
+	
+	// Kernel is selected once for the whole image
+	render_kernel_t kern = render_kernel(rd);
+	for(int r = r0; r < r1; r++) for(int c = 0; c < vw.columns; c++){
+		iters[r * vw.columns + c] = render_value(rd, kern, r, c, 0, 0);
+	}
+}
+
+void render_colors(const render_t *rd, const double *iters, png_color *px){
+	int count = rd->view.rows * rd->view.columns;
+	
+	// Compiled schemes are applied a row at a time unless fading by distance
+	if(rd->scheme.lut && rd->de_thickness <= 0){
+		double scale = rd->accum.kind != ACCUM_NONE ? rd->scheme.iters_per_cycle : 1;
+		for(int r = 0; r < rd->view.rows; r++){
+			scheme_colorize(rd->scheme, iters + r * rd->view.columns, scale, rd->view.columns, px + r * rd->view.columns);
+		}
+	}else for(int i = 0; i < count; i++) px[i] = render_color(rd, iters[i]);
+}
+
+
+
+// Conversion of 8-bit sRGB values into linear light
+static float srgb_linear[256];
+static pthread_once_t srgb_once = PTHREAD_ONCE_INIT;
+
+static void srgb_init(){
+	double v;
+	for(int i = 0; i < 256; i++){
+		v = i / 255.0;
+		srgb_linear[i] = v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4);
+	}
+}
+
+static png_byte linear_srgb(double v){
+	v = v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1 / 2.4) - 0.055;
+	return (png_byte)(v * 255 + 0.5);
+}
+
+// Hash pixel location and sample number into a pseudo-random offset in [0, 1)
+// Stateless so that the output does not depend on which thread renders the pixel
+static double jitter(unsigned int r, unsigned int c, unsigned int k){
+	unsigned int h = r * 0x9E3779B1u ^ c * 0x85EBCA77u ^ k * 0xC2B2AE3Du;
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return (h >> 8) / (double)(1 << 24);
+}
+
+// Determine if two neighboring pixels lie across an edge
+static bool is_edge(const render_t *rd, double i1, png_color p1, double i2, png_color p2){
+	if((i1 < 0) != (i2 < 0)) return true;
+	return abs(p1.red - p2.red) + abs(p1.green - p2.green) + abs(p1.blue - p2.blue) > rd->aa_threshold;
+}
+
+// Smooth the edges as render_antialias does, asking stop (if not NULL) before each row whether to give up
+// Returns true if every row was smoothed ; false if stopped early or out of memory
+static bool antialias_rows(const render_t *rd, const double *iters, png_color *px, render_stop_t stop, void *data){
+	if(rd->aa_samples <= 0) return true;
+	pthread_once(&srgb_once, srgb_init);
+	
+	viewport_t vw = rd->view;
+	
+	// Pixels are smoothed in place so keep the original colors of the previous and current row for comparisons
+	png_color *prev = malloc(sizeof(png_color) * vw.columns);
+	png_color *curr = malloc(sizeof(png_color) * vw.columns);
+	if(!prev || !curr){
+		free(prev);
+		free(curr);
+		return false;
+	}
+	
+	render_kernel_t kern = render_kernel(rd);
+	
+	// Samples are stratified over a square grid within each pixel
+	// so their number is rounded up to the next square to give every cell of the grid one sample without taking fewer than asked
+	int side = (int)ceil(sqrt(rd->aa_samples)), samples = side * side;
+	
+	int r, c, k, n;
+	bool edge;
+	double i, red, green, blue;
+	png_color col, *tmp;
+	for(r = 0; r < vw.rows; r++){
+		if(stop && stop(data)) break;
+		memcpy(curr, px + r * vw.columns, sizeof(png_color) * vw.columns);
+		for(c = 0; c < vw.columns; c++){
+			n = r * vw.columns + c;
+			edge = (r > 0 && is_edge(rd, iters[n], curr[c], iters[n - vw.columns], prev[c]))
+				|| (r + 1 < vw.rows && is_edge(rd, iters[n], curr[c], iters[n + vw.columns], px[n + vw.columns]))
+				|| (c > 0 && is_edge(rd, iters[n], curr[c], iters[n - 1], curr[c - 1]))
+				|| (c + 1 < vw.columns && is_edge(rd, iters[n], curr[c], iters[n + 1], curr[c + 1]));
+			if(!edge) continue;
+			
+			// Include the original sample at the corner of the pixel
+			red = srgb_linear[curr[c].red];
+			green = srgb_linear[curr[c].green];
+			blue = srgb_linear[curr[c].blue];
+			
+			for(k = 0; k < samples; k++){
+				i = render_value(rd, kern, r, c,
+					(k / side + jitter(r, c, 2 * k + 1)) / side,
+					(k % side + jitter(r, c, 2 * k)) / side
+				);
+				
+				col = render_color(rd, i);
+				red += srgb_linear[col.red];
+				green += srgb_linear[col.green];
+				blue += srgb_linear[col.blue];
+			}
+			
+			k = samples + 1;
+			px[n].red = linear_srgb(red / k);
+			px[n].green = linear_srgb(green / k);
+			px[n].blue = linear_srgb(blue / k);
+		}
+		
+		// Original colors of current row become the previous row
+		tmp = prev;
+		prev = curr;
+		curr = tmp;
+	}
+	
+	free(prev);
+	free(curr);
+	return r == vw.rows;
+}
+
+void render_antialias(const render_t *rd, const double *iters, png_color *px){
+	antialias_rows(rd, iters, px, NULL, NULL);
+}
+
+void render_image(const render_t *rd, double *iters, png_color *px){
+	render_iters(rd, iters);
+	render_colors(rd, iters, px);
+	render_antialias(rd, iters, px);
+}
+
+// Size of the blocks of the coarse grid and of the bands of rows of the full grid
+#define PROGRESSIVE_STEP 8
+// Iteration limits stop doubling once a pass frees fewer than one in this many of the pixels left
+#define PROGRESSIVE_FREED 1000
+// Samples along edges when the render asks for none
+#define PROGRESSIVE_SAMPLES 9
+
+render_stage_t render_progressive(const render_t *rd, double *iters, png_color *px, render_stop_t stop, void *data, int *iterations){
+	viewport_t vw = rd->view;
+	render_t part = *rd;
+	render_stage_t stage = STAGE_COARSE;
+	int r, c;
+	*iterations = rd->iterations;
+	
+	// Coarse grid covers the view with pixels PROGRESSIVE_STEP times as large, a little past the edges if needed
+	// Distance estimates are measured in its own pixels, so the thickness shrinks to keep the same distance
+	part.view.rows = (vw.rows + PROGRESSIVE_STEP - 1) / PROGRESSIVE_STEP;
+	part.view.columns = (vw.columns + PROGRESSIVE_STEP - 1) / PROGRESSIVE_STEP;
+	part.view.height = vw.height * part.view.rows * PROGRESSIVE_STEP / vw.rows;
+	part.view.width = vw.width * part.view.columns * PROGRESSIVE_STEP / vw.columns;
+	part.de_thickness = rd->de_thickness / PROGRESSIVE_STEP;
+	
+	// The coarse grid has no more pixels than the image, so it is calculated into the front of iters
+	// then spread over its blocks from the last pixel back, which never overwrites a value still to be read
+	render_iters(&part, iters);
+	for(r = vw.rows - 1; r >= 0; r--) for(c = vw.columns - 1; c >= 0; c--){
+		iters[r * vw.columns + c] = iters[r / PROGRESSIVE_STEP * part.view.columns + c / PROGRESSIVE_STEP];
+	}
+	
+	// Full grid replaces the coarse values a band of rows at a time
+	for(r = 0; r < vw.rows; r += PROGRESSIVE_STEP){
+		if(stop(data)) goto done;
+		render_iters_rows(rd, iters, r, r + PROGRESSIVE_STEP < vw.rows ? r + PROGRESSIVE_STEP : vw.rows);
+	}
+	stage = STAGE_FULL;
+	
+	// Pixels which did not escape are tried again with double the iterations
+	// until a pass frees too few of them to be worth the time
+	render_kernel_t kern = render_kernel(rd);
+	size_t i, left, freed, count = (size_t)vw.rows * vw.columns;
+	part = *rd;
+	for(left = 0, i = 0; i < count; i++) left += iters[i] < 0;
+	while(left > 0 && part.iterations <= INT_MAX / 2){
+		part.iterations *= 2;
+		freed = 0;
+		for(r = 0; r < vw.rows; r++){
+			if(stop(data)) goto done;
+			for(c = 0; c < vw.columns; c++){
+				i = (size_t)r * vw.columns + c;
+				if(iters[i] >= 0) continue;
+				iters[i] = render_value(&part, kern, r, c, 0, 0);
+				freed += iters[i] >= 0;
+			}
+			// Pixels freed at the higher limit are kept even if the pass is not finished
+			*iterations = part.iterations;
+		}
+		left -= freed;
+		if(freed * PROGRESSIVE_FREED < left) break;
+	}
+	stage = STAGE_DEEPER;
+	
+	// Edges are supersampled with the deepest limit so that the samples match their pixels
+	render_colors(&part, iters, px);
+	if(part.aa_samples <= 0) part.aa_samples = PROGRESSIVE_SAMPLES;
+	if(antialias_rows(&part, iters, px, stop, data)) stage = STAGE_SMOOTHED;
+	return stage;
+	
+	done:
+	render_colors(rd, iters, px);
+	return stage;
+}
+
+// Growing buffer which PNG data is written into by encode_png
+typedef struct{
+	unsigned char *data;
+	size_t size, cap;
+	bool failed;
+} png_buffer_t;
+
+static void png_buffer_write(png_structp png_ptr, png_bytep bytes, png_size_t len){
+	png_buffer_t *buf = png_get_io_ptr(png_ptr);
+	if(buf->failed) return;
+	
+	if(buf->size + len > buf->cap){
+		size_t cap = buf->cap ? buf->cap : 4096;
+		while(cap < buf->size + len) cap *= 2;
+		unsigned char *data = realloc(buf->data, cap);
+		if(!data){
+			buf->failed = true;
+			return;
+		}
+		buf->data = data;
+		buf->cap = cap;
+	}
+	
+	memcpy(buf->data + buf->size, bytes, len);
+	buf->size += len;
+}
+
+static void png_buffer_flush(png_structp png_ptr){}
+
+// Write the image as PNG either to the file fl or, if fl is NULL, into buf
+static bool png_output(FILE *fl, png_buffer_t *buf, const png_color *px, int width, int height){
+	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if(!png_ptr){
+		fprintf(stderr, "Could not allocate write struct\n");
+		return false;
+	}
+	
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if(!info_ptr){
+		fprintf(stderr, "Could not allocate info struct\n");
+		png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
+		return false;
+	}
+	
+	if(setjmp(png_jmpbuf(png_ptr))){
+		fprintf(stderr, "Error in PNG writing\n");
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		return false;
+	}
+	
+	// Output PNG data
+	if(fl) png_init_io(png_ptr, fl);
+	else png_set_write_fn(png_ptr, buf, png_buffer_write, png_buffer_flush);
+	png_set_IHDR(png_ptr, info_ptr, width, height,
+		8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+		PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT
+	);
+	
+	png_write_info(png_ptr, info_ptr);
+	
+	// Rows are written directly out of the pixel buffer
+	for(int r = 0; r < height; r++) png_write_row(png_ptr, (png_const_bytep)(px + r * width));
+	
+	png_write_end(png_ptr, NULL);  // End writing
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	
+	return fl || !buf->failed;
+}
+
+bool write_png(const char *filename, const png_color *px, int width, int height){
+	FILE *fl = fopen(filename, "wb");
+	if(!fl){
+		fprintf(stderr, "Could not open %s to write image\n", filename);
+		return false;
+	}
+	
+	bool success = png_output(fl, NULL, px, width, height);
+	
+	fclose(fl);  // Close file descriptor
+	
+	return success;
+}
+
+unsigned char *encode_png(const png_color *px, int width, int height, size_t *size){
+	png_buffer_t buf = {NULL, 0, 0, false};
+	if(!png_output(NULL, &buf, px, width, height)){
+		free(buf.data);
+		return NULL;
+	}
+	
+	*size = buf.size;
+	return buf.data;
+}
+
+
+
+// State shared between the workers of a batch
+typedef struct{
+	const render_t *jobs;
+	int count;
+	batch_out_t out;
+	void *data;
+	
+	// Index of the next job to be taken by a worker
+	int next;
+	pthread_mutex_t lock;
+	
+	// Whether workers are pinned to NUMA nodes, numbered in the order they start out of `threads`
+	bool numa;
+	int started, threads;
+	
+	// Largest number of pixels in any one job
+	size_t max_pixels;
+	
+	// Whether out failed for any image
+	bool failed;
+} batch_t;
+
+static void *batch_worker(void *arg){
+	batch_t *bt = arg;
+	int index;
+	
+	// Pinned before the buffers are first written so that they are placed on the node of the worker
+	if(bt->numa){
+		pthread_mutex_lock(&bt->lock);
+		index = bt->started++;
+		pthread_mutex_unlock(&bt->lock);
+		node_pin(node_of(index, bt->threads));
+	}
+	
+	// Buffers are allocated once per worker and reused for every job
+	double *iters = malloc(sizeof(double) * bt->max_pixels);
+	png_color *px = malloc(sizeof(png_color) * bt->max_pixels);
+	if(!iters || !px){
+		free(iters);
+		free(px);
+		return NULL;
+	}
+	
+	while(1){
+		// Take next job from queue
+		pthread_mutex_lock(&bt->lock);
+		index = bt->next < bt->count ? bt->next++ : -1;
+		pthread_mutex_unlock(&bt->lock);
+		if(index < 0) break;
+		
+		const render_t *rd = bt->jobs + index;
+		render_image(rd, iters, px);
+		if(!bt->out(index, rd, px, iters, bt->data)){
+			pthread_mutex_lock(&bt->lock);
+			bt->failed = true;
+			pthread_mutex_unlock(&bt->lock);
+		}
+	}
+	
+	free(iters);
+	free(px);
+	return NULL;
+}
+
+bool render_batch(const render_t *jobs, int count, int threads, bool numa, batch_out_t out, void *data){
+	batch_t bt = {jobs, count, out, data, 0, PTHREAD_MUTEX_INITIALIZER, numa, 0, 0, 0, false};
+	for(int i = 0; i < count; i++){
+		size_t sz = (size_t)jobs[i].view.rows * jobs[i].view.columns;
+		if(sz > bt.max_pixels) bt.max_pixels = sz;
+	}
+	
+	// No point in having workers that would never receive a job
+	if(threads > count) threads = count;
+	if(threads < 1) threads = 1;
+	bt.threads = threads;
+	
+	pthread_t tids[threads];
+	int started;
+	for(started = 0; started < threads; started++){
+		if(pthread_create(tids + started, NULL, batch_worker, &bt)) break;
+	}
+	
+	for(int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+	pthread_mutex_destroy(&bt.lock);
+	
+	// Workers which failed to allocate their buffers never take a job
+	// so the batch only succeeded if every job was handed out and written
+	return bt.next >= count && !bt.failed;
+}
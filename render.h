@@ -0,0 +1,229 @@
+#ifndef _RENDER_H
+#define _RENDER_H
+
+#include <stdbool.h>
+
+#include <png.h>
+
+#include "fractal.h"
+
+
+typedef struct{
+	/* color_count: Number of colors to cycle through
+	 * Ex: [    blue    |   orange   |    white    ]  ; color_count = 3
+	 * iters_per_cycle: Number of complex iterations to fit into each cycle of all the colors
+	 * Ex: [ 0 , 1 , 2 , 3 , 4 , 5 , 6 , 7 , 8 , 9 ]  ; iters_per_cycle = 10
+	 * A good ratio is   color_count * 10 = iters_per_cycle
+	 */
+	int color_count, iters_per_cycle;
+	
+	// Indicates that the color of points should be interpolated according to how far they go after escaping
+	bool is_continuous;
+	
+	// colors: array of 24-bit colors {red, green, blue} to cycle through
+	// set_color: color for non-escaping points
+	png_color *colors, set_color;
+	
+	// Table of one cycle of colors with SCHEME_LUT_STEPS entries for every iteration, NULL until compiled
+	// lut_size == iters_per_cycle * SCHEME_LUT_STEPS
+	png_color *lut;
+	int lut_size;
+} color_scheme_t;
+
+// Number of entries in the table of a compiled scheme for each iteration
+#define SCHEME_LUT_STEPS 64
+
+// Generate the color for a given number of iterations using the scheme
+png_color scheme_get_color(color_scheme_t scm, double iters);
+
+// Fill in the table of colors of the scheme so that colors can be looked up
+// Returns true if successful ; false if the table could not be allocated
+bool scheme_compile(color_scheme_t *scm);
+
+/* Generate the colors for many iteration counts using a compiled scheme
+ * 
+ * Arguments:
+ *   color_scheme_t scm : scheme compiled by scheme_compile
+ *   const double *iters : iteration counts, or -1 (or any value which is not finite) for non-escaping points
+ *   double scale : factor to multiply each count by before looking up its color
+ *   int count : number of entries in iters
+ * 
+ * Returns:
+ *   png_color *px : array of count colors to store into
+ */
+void scheme_colorize(color_scheme_t scm, const double *iters, double scale, int count, png_color *px);
+
+/* Load a scheme from a text file and compile it
+ * Every line holds one of the following, with '#' followed by whitespace starting a comment
+ *   cycle ITERS : iterations to fit into each cycle of the colors
+ *   set RRGGBB : color of non-escaping points in hexadecimal
+ *   RRGGBB : next color of the cycle in hexadecimal
+ * 
+ * Arguments:
+ *   const char *filename : path of file to load
+ * 
+ * Returns:
+ *   bool : true if successful ; false if error
+ *   color_scheme_t *scm : the loaded scheme, whose colors and table are allocated
+ */
+bool scheme_load(const char *filename, color_scheme_t *scm);
+
+
+// Full description of a single escape-time image
+// Rendering only reads the description, so any number of threads may render at once
+typedef struct{
+	// Rule used to generate the orbits
+	// If is_julia is false, then each pixel is used as the param and rule.param is the initial value of z
+	fractal_t rule;
+	bool is_julia;
+	
+	// Maximum number of iterations to perform for each pixel
+	int iterations;
+	
+	// Rectangle in complex plane and number of pixels in image
+	viewport_t view;
+	
+	// Colors used for the escape iterations
+	color_scheme_t scheme;
+	
+	// Number of extra samples to take in pixels along edges, rounded up to the next square so that they fill an even grid
+	// A pixel is on an edge when it and a neighbor differ in whether they escape
+	// or when their colors differ by more than aa_threshold (summed over red, green, and blue)
+	// aa_samples == 0 disables supersampling
+	int aa_samples, aa_threshold;
+	
+	// Color escaping pixels by their estimated distance to the boundary instead of by iterations
+	// Pixels fade from scheme.set_color at the boundary to scheme.colors[0] at de_thickness pixels away
+	// de_thickness <= 0 disables distance estimation
+	double de_thickness;
+	
+	// Arithmetic used for the orbits, PREC_AUTO chooses from the spacing of the pixels
+	// Distance estimation always uses double precision
+	// Double-double is only available for rules satisfying frc_has_dd, otherwise double is used
+	precision_t precision;
+	
+	// Color escaping pixels by a value accumulated over their orbits instead of by iterations
+	// The value is mapped onto the scheme so that a change of one passes through a whole cycle of colors
+	// With scheme.is_continuous, averages are interpolated by how far the orbit went after escaping
+	// Ignored when distance estimation is enabled ; accum.kind == ACCUM_NONE disables it
+	frc_accum_t accum;
+} render_t;
+
+/* Parse accumulator given as KIND[:PARAM]
+ *   trap[:REAL,IMAG] : orbit trap at the given point  (default: 0)
+ *   stripe[:DENSITY] : stripe average with the given number of stripes  (default: 5)
+ *   tia : triangle inequality average
+ *   none : no accumulator
+ * Returns true if successful ; false if invalid
+ */
+bool accum_parse(const char *str, frc_accum_t *acc);
+
+/* Calculate the length of the orbit for every pixel in the render
+ * 
+ * With distance estimation, rectangles of pixels which are all far from the boundary
+ * or which are bordered entirely by the set are filled without calculating each pixel
+ * 
+ * Arguments:
+ *   const render_t *rd : parameters of image to calculate
+ *   double *iters : array of view.rows * view.columns values to store result into
+ * 
+ * Returns:
+ *   double *iters : number of iterations before escape in row-major order
+ *      OR -1 if the pixel did not escape
+ *      NOTE when scheme.is_continuous is set, the counts are interpolated
+ *      NOTE with distance estimation, the fraction of de_thickness to the boundary (at most 1) is stored instead
+ *      NOTE with an accumulator, the accumulated value is stored instead
+ */
+void render_iters(const render_t *rd, double *iters);
+// Calculate only rows [r0, r1) of render_iters into the same places of iters, which still holds the whole image
+// Separate bands of rows can be calculated by separate threads at once
+void render_iters_rows(const render_t *rd, double *iters, int r0, int r1);
+
+// Find the precision that render_iters will use for the render
+precision_t render_precision(const render_t *rd);
+
+// Convert the iteration counts from render_iters into colors using rd->scheme
+void render_colors(const render_t *rd, const double *iters, png_color *px);
+
+/* Replace the color of each pixel along an edge with the average of jittered samples across the pixel
+ * The samples are stratified over a square grid, so rd->aa_samples is rounded up to the next square
+ * The samples are averaged in linear light rather than in sRGB
+ * 
+ * Arguments:
+ *   const render_t *rd : parameters of image, only does anything when rd->aa_samples > 0
+ *   const double *iters : iteration counts from render_iters
+ *   png_color *px : colors from render_colors
+ * 
+ * Returns:
+ *   png_color *px : the colors with edge pixels smoothed
+ */
+void render_antialias(const render_t *rd, const double *iters, png_color *px);
+
+// Calculate the colors of the render into px using iters as scratch space
+// Performs render_iters, render_colors, and render_antialias in turn
+void render_image(const render_t *rd, double *iters, png_color *px);
+
+// Stages reached by render_progressive, each refining the image left by the one before
+typedef enum{
+	STAGE_COARSE,  // Each block of pixels holds the value of a grid 8 times coarser
+	STAGE_FULL,  // Every pixel is calculated with rd->iterations
+	STAGE_DEEPER,  // Pixels which did not escape are calculated again with doubled limits until few more escape
+	STAGE_SMOOTHED  // Pixels along edges are supersampled
+} render_stage_t;
+
+// Callback asked by render_progressive between pieces of work whether to stop and keep the image so far
+typedef bool (*render_stop_t)(void *data);
+
+/* Render the image in stages of increasing quality until they are all done or stop returns true
+ * The coarse stage always finishes, after which the best image so far is kept however early it stops
+ * 
+ * Stages after the first are interrupted between rows, and a stage interrupted partway
+ * leaves the pixels it has reached refined and the rest as they were
+ * Edges are supersampled with rd->aa_samples, or 9 samples when that is 0
+ * 
+ * Arguments:
+ *   const render_t *rd : parameters of image to calculate
+ *   double *iters : array of view.rows * view.columns values to store result into
+ *   png_color *px : array of view.rows * view.columns colors to store result into
+ *   render_stop_t stop : asked whether to stop
+ *   void *data : passed through to stop
+ * 
+ * Returns:
+ *   render_stage_t : last stage finished
+ *   double *iters : values as from render_iters, with the deeper stage's raised limits
+ *   png_color *px : colors of the best image so far
+ *   int *iterations : highest iteration limit any pixel was calculated with
+ */
+render_stage_t render_progressive(const render_t *rd, double *iters, png_color *px, render_stop_t stop, void *data, int *iterations);
+
+// Write image of `width` by `height` pixels in row-major order to PNG file
+// Returns true if successful ; false if error
+bool write_png(const char *filename, const png_color *px, int width, int height);
+// Encode image of `width` by `height` pixels in row-major order as PNG in memory
+// Returns malloc'd buffer of *size bytes which the caller must free ; NULL if error
+unsigned char *encode_png(const png_color *px, int width, int height, size_t *size);
+
+
+// Callback used by render_batch to hand each finished image to the caller along with the values from render_iters
+// The buffers belong to the worker and are reused for its next image, so iters may be overwritten
+// Returns true if the image was handled ; false if error, which fails the batch once every image is rendered
+// NOTE called from the worker threads so it must be safe to call concurrently
+typedef bool (*batch_out_t)(int index, const render_t *rd, const png_color *px, double *iters, void *data);
+
+/* Render many images using a pool of worker threads
+ * Each worker allocates its buffers once and reuses them for every image it renders
+ * 
+ * Arguments:
+ *   const render_t *jobs : array of images to render
+ *   int count : number of entries in jobs
+ *   int threads : number of worker threads to use
+ *   bool numa : whether to pin the workers evenly to the NUMA nodes (see node.h) before they allocate their buffers
+ *   batch_out_t out : function called with the pixels of each finished image
+ *   void *data : passed through to out
+ * 
+ * Returns:
+ *   bool : true if successful ; false if buffers or threads could not be created or out failed for any image
+ */
+bool render_batch(const render_t *jobs, int count, int threads, bool numa, batch_out_t out, void *data);
+
+#endif
@@ -0,0 +1,592 @@
+#include <complex.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "serve.h"
+
+
+#define REQUEST_LENGTH 4096
+// Number of buckets the hash table of the cache starts with, doubled whenever there are more entries than buckets
+#define CACHE_BUCKETS 256
+// Largest number of pixels in a tile that will be rendered
+#define MAX_TILE_PIXELS (4096 * 4096)
+
+
+// Entry of the cache holding either an iteration buffer or encoded PNG
+typedef struct entry_s{
+	// Neighbors in list of entries from most to least recently used
+	struct entry_s *prev, *next;
+	// Next entry in the same bucket of the hash table
+	struct entry_s *chain;
+	unsigned long hash;
+	
+	void *data;
+	size_t size;
+	
+	// Number of workers using or waiting on the entry, which prevents it from being discarded
+	int refs;
+	// An entry is pending until the worker which created it fills it
+	bool ready;
+	
+	// Description of the render which produced the data, allocated along with the entry
+	char key[];
+} entry_t;
+
+typedef struct{
+	entry_t *head, *tail;
+	size_t size, capacity;
+	
+	// Hash table of the entries, with a power of 2 buckets
+	entry_t **buckets;
+	size_t bucket_count, entry_count;
+	
+	pthread_mutex_t lock;
+	// Signalled whenever a pending entry is filled
+	pthread_cond_t filled;
+} cache_t;
+
+
+// State shared between the workers of the server
+typedef struct{
+	const server_t *sv;
+	int sock;
+	cache_t cache;
+} server_state_t;
+
+
+
+static unsigned long key_hash(const char *key){
+	unsigned long h = 5381;
+	while(*key) h = h * 33 ^ (unsigned char)*key++;
+	return h;
+}
+
+// Format a key of any length
+// Returns malloc'd string which the caller must free ; NULL if out of memory
+static char *key_printf(const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	
+	char *key = len < 0 ? NULL : malloc(len + 1);
+	if(!key) return NULL;
+	va_start(args, format);
+	vsnprintf(key, len + 1, format, args);
+	va_end(args);
+	return key;
+}
+
+// Find the bucket of the hash table which holds the entries with the hash
+#define cache_bucket(ch, hash) ((ch)->buckets + ((hash) & ((ch)->bucket_count - 1)))
+
+// Double the number of buckets of the hash table, or allocate the first ones
+// Returns true if successful ; false if out of memory, leaving the table as it was
+// Must be called with the lock held
+static bool cache_grow(cache_t *ch){
+	size_t count = ch->bucket_count ? ch->bucket_count * 2 : CACHE_BUCKETS;
+	entry_t **buckets = calloc(count, sizeof(entry_t *));
+	if(!buckets) return false;
+	
+	entry_t *ent, *chain;
+	for(size_t i = 0; i < ch->bucket_count; i++){
+		for(ent = ch->buckets[i]; ent; ent = chain){
+			chain = ent->chain;
+			ent->chain = buckets[ent->hash & (count - 1)];
+			buckets[ent->hash & (count - 1)] = ent;
+		}
+	}
+	
+	free(ch->buckets);
+	ch->buckets = buckets;
+	ch->bucket_count = count;
+	return true;
+}
+
+static void cache_unlink(cache_t *ch, entry_t *ent){
+	if(ent->prev) ent->prev->next = ent->next;
+	else ch->head = ent->next;
+	if(ent->next) ent->next->prev = ent->prev;
+	else ch->tail = ent->prev;
+}
+
+static void cache_push(cache_t *ch, entry_t *ent){
+	ent->prev = NULL;
+	ent->next = ch->head;
+	if(ch->head) ch->head->prev = ent;
+	else ch->tail = ent;
+	ch->head = ent;
+}
+
+// Take entry out of the list and the hash table and free it
+// Must be called with the lock held
+static void cache_remove(cache_t *ch, entry_t *ent){
+	entry_t **pos = cache_bucket(ch, ent->hash);
+	while(*pos != ent) pos = &(*pos)->chain;
+	*pos = ent->chain;
+	ch->entry_count--;
+	
+	cache_unlink(ch, ent);
+	ch->size -= ent->size;
+	free(ent->data);
+	free(ent);
+}
+
+// Discard least recently used entries which are not in use until the cache fits its capacity
+// Must be called with the lock held
+static void cache_evict(cache_t *ch){
+	entry_t *ent = ch->tail, *prev;
+	while(ent && ch->size > ch->capacity){
+		prev = ent->prev;
+		if(ent->ready && ent->refs == 0) cache_remove(ch, ent);
+		ent = prev;
+	}
+}
+
+/* Find the entry for the key, creating a pending one if there is none
+ * When the entry is pending because another worker is filling it, waits for it to be filled
+ * 
+ * Returns:
+ *   entry_t * : entry for key which must be given to cache_release when done with
+ *      OR NULL if the entry could not be allocated or the worker filling it failed
+ *   bool *is_new : set if the entry was created and must be filled by the caller with cache_fill
+ */
+static entry_t *cache_acquire(cache_t *ch, const char *key, bool *is_new){
+	unsigned long hash = key_hash(key);
+	*is_new = false;
+	
+	pthread_mutex_lock(&ch->lock);
+	entry_t *ent;
+	for(ent = ch->buckets ? *cache_bucket(ch, hash) : NULL; ent; ent = ent->chain){
+		if(ent->hash == hash && strcmp(ent->key, key) == 0) break;
+	}
+	
+	if(ent){
+		// Mark as most recently used
+		cache_unlink(ch, ent);
+		cache_push(ch, ent);
+		
+		ent->refs++;
+		while(!ent->ready) pthread_cond_wait(&ch->filled, &ch->lock);
+		
+		// Failed entries are left without data and removed by the last worker to let go of them
+		if(!ent->data){
+			if(--ent->refs == 0) cache_remove(ch, ent);
+			ent = NULL;
+		}
+	}else{
+		// Keep no more entries than buckets so that the chains stay short
+		if(ch->entry_count >= ch->bucket_count) cache_grow(ch);
+		if(ch->buckets && (ent = malloc(sizeof(entry_t) + strlen(key) + 1))){
+			strcpy(ent->key, key);
+			ent->hash = hash;
+			ent->data = NULL;
+			ent->size = 0;
+			ent->refs = 1;
+			ent->ready = false;
+			
+			entry_t **bucket = cache_bucket(ch, hash);
+			ent->chain = *bucket;
+			*bucket = ent;
+			ch->entry_count++;
+			cache_push(ch, ent);
+			*is_new = true;
+		}
+	}
+	pthread_mutex_unlock(&ch->lock);
+	
+	return ent;
+}
+
+// Give data to a new entry and wake the workers waiting on it
+// data == NULL marks the entry as failed and it is removed once it is released
+static void cache_fill(cache_t *ch, entry_t *ent, void *data, size_t size){
+	pthread_mutex_lock(&ch->lock);
+	ent->data = data;
+	ent->size = data ? size : 0;
+	ent->ready = true;
+	ch->size += ent->size;
+	pthread_cond_broadcast(&ch->filled);
+	pthread_mutex_unlock(&ch->lock);
+}
+
+static void cache_release(cache_t *ch, entry_t *ent){
+	pthread_mutex_lock(&ch->lock);
+	ent->refs--;
+	if(!ent->data && ent->refs == 0) cache_remove(ch, ent);
+	cache_evict(ch);
+	pthread_mutex_unlock(&ch->lock);
+}
+
+
+
+// Parse a complex number of the form REAL[,IMAG] as given on the command line
+static bool parse_complex(const char *val, complex *out){
+	double real, imag = 0;
+	if(sscanf(val, " %lf,%lf", &real, &imag) < 1) return false;
+	*out = real + imag * I;
+	return true;
+}
+
+/* Build the render described by the query string of a tile request
+ * 
+ * Arguments:
+ *   const server_t *sv : settings of the server holding the defaults and schemes
+ *   char *query : query string, which is modified while parsing
+ * 
+ * Returns:
+ *   bool : false if the query is invalid
+ *   render_t *rd : render of the tile
+ */
+static bool parse_query(const server_t *sv, char *query, render_t *rd){
+	*rd = sv->defaults;
+	
+	long double x = 0, y = 0;
+	bool has_center = false, success = true;
+	int tmp;
+	
+	char *save, *key, *val;
+	for(key = strtok_r(query, "&", &save); key; key = strtok_r(NULL, "&", &save)){
+		val = strchr(key, '=');
+		if(!val) return false;
+		*val++ = '\0';
+		
+		if(strcmp(key, "x") == 0) success = has_center = sscanf(val, " %Lf", &x) == 1;
+		else if(strcmp(key, "y") == 0) success = has_center = sscanf(val, " %Lf", &y) == 1;
+		else if(strcmp(key, "w") == 0) success = sscanf(val, " %lf", &rd->view.width) == 1;
+		else if(strcmp(key, "h") == 0) success = sscanf(val, " %lf", &rd->view.height) == 1;
+		else if(strcmp(key, "cols") == 0) success = sscanf(val, " %i", &rd->view.columns) == 1;
+		else if(strcmp(key, "rows") == 0) success = sscanf(val, " %i", &rd->view.rows) == 1;
+		else if(strcmp(key, "n") == 0) success = sscanf(val, " %i", &rd->iterations) == 1;
+		else if(strcmp(key, "p") == 0) success = parse_complex(val, &rd->rule.power);
+		else if(strcmp(key, "r") == 0) success = sscanf(val, " %lf", &rd->rule.radius) == 1;
+		else if(strcmp(key, "j") == 0) success = rd->is_julia = parse_complex(val, &rd->rule.param);
+		else if(strcmp(key, "aa") == 0) success = sscanf(val, " %i", &rd->aa_samples) == 1;
+		else if(strcmp(key, "de") == 0) success = sscanf(val, " %lf", &rd->de_thickness) == 1;
+		else if(strcmp(key, "orbit") == 0) success = accum_parse(val, &rd->accum);
+		else if(strcmp(key, "cont") == 0){
+			success = sscanf(val, " %i", &tmp) == 1;
+			rd->scheme.is_continuous = tmp;
+		}else if(strcmp(key, "rule") == 0){
+			// Rules requested by name replace any formula given to the server
+			rd->rule.formula = NULL;
+			if(strcmp(val, "mandel") == 0) rd->rule.trans = NULL;
+			else if(strcmp(val, "burning-ship") == 0) rd->rule.trans = crect;
+			else if(strcmp(val, "tricorn") == 0) rd->rule.trans = conj;
+			else success = false;
+		}else if(strcmp(key, "scheme") == 0){
+			success = false;
+			for(int i = 0; i < sv->scheme_count; i++){
+				if(strcmp(sv->scheme_names[i], val) == 0){
+					bool is_cont = rd->scheme.is_continuous;
+					rd->scheme = sv->schemes[i];
+					rd->scheme.is_continuous = is_cont;
+					success = true;
+				}
+			}
+		}else if(strcmp(key, "prec") == 0){
+			if(strcmp(val, "auto") == 0) rd->precision = PREC_AUTO;
+			else if(strcmp(val, "float") == 0) rd->precision = PREC_FLOAT;
+			else if(strcmp(val, "double") == 0) rd->precision = PREC_DOUBLE;
+			else if(strcmp(val, "dd") == 0) rd->precision = PREC_DD;
+			else success = false;
+		}else success = false;
+		
+		if(!success) return false;
+	}
+	
+	if(rd->view.rows < 1 || rd->view.columns < 1 || (long)rd->view.rows * rd->view.columns > MAX_TILE_PIXELS) return false;
+	if(rd->iterations < 0 || rd->aa_samples < 0) return false;
+	
+	// Place the corner using long double to keep extra digits in the low order part
+	if(has_center){
+		x -= rd->view.width / 2;
+		y += rd->view.height / 2;
+		rd->view.corner = (double)x + (double)y * I;
+		rd->view.corner_lo = (double)(x - (double)x) + (double)(y - (double)y) * I;
+	}
+	
+	return true;
+}
+
+// Describe everything which affects the iteration counts of the render
+// Floating point values are printed in hexadecimal so that they are exact
+// Returns malloc'd key which the caller must free ; NULL if out of memory
+static char *iters_key(const render_t *rd){
+	return key_printf("i %p %p %a,%a %a,%a %a %i %i %a,%a,%a,%a %a,%a %ix%i %i %a %i %i %a,%a %a",
+		(void *)rd->rule.trans, (void *)rd->rule.formula, creal(rd->rule.power), cimag(rd->rule.power),
+		creal(rd->rule.param), cimag(rd->rule.param), rd->rule.radius,
+		rd->is_julia, rd->iterations,
+		creal(rd->view.corner), cimag(rd->view.corner), creal(rd->view.corner_lo), cimag(rd->view.corner_lo),
+		rd->view.width, rd->view.height, rd->view.columns, rd->view.rows,
+		rd->scheme.is_continuous, rd->de_thickness, render_precision(rd),
+		rd->accum.kind, creal(rd->accum.trap), cimag(rd->accum.trap), rd->accum.density
+	);
+}
+
+// Describe everything which affects the PNG of the render, extending the key of its iteration counts
+// Returns malloc'd key which the caller must free ; NULL if out of memory
+static char *tile_key(const render_t *rd, const char *ikey){
+	char *head = key_printf("p %s %i,%i %i %i %i,%i,%i",
+		ikey + 2, rd->aa_samples, rd->aa_threshold,
+		rd->scheme.color_count, rd->scheme.iters_per_cycle,
+		rd->scheme.set_color.red, rd->scheme.set_color.green, rd->scheme.set_color.blue
+	);
+	if(!head) return NULL;
+	
+	// Each color takes at most 12 characters " RRR,GGG,BBB"
+	size_t len = strlen(head), size = len + 12 * (size_t)rd->scheme.color_count + 1;
+	char *key = realloc(head, size);
+	if(!key){
+		free(head);
+		return NULL;
+	}
+	for(int i = 0; i < rd->scheme.color_count; i++){
+		png_color cl = rd->scheme.colors[i];
+		len += snprintf(key + len, size - len, " %i,%i,%i", cl.red, cl.green, cl.blue);
+	}
+	return key;
+}
+
+/* Get the PNG of the tile from the cache, rendering it if needed
+ * The iteration counts are cached separately so that they can be recolored with other schemes
+ * 
+ * Returns:
+ *   entry_t * : cache entry holding the PNG which must be released
+ *      OR NULL if error
+ */
+static entry_t *get_tile(cache_t *ch, const render_t *rd){
+	char *ikey = iters_key(rd), *pkey = ikey ? tile_key(rd, ikey) : NULL;
+	
+	bool is_new;
+	entry_t *tile = pkey ? cache_acquire(ch, pkey, &is_new) : NULL;
+	free(pkey);
+	if(!tile || !is_new){
+		free(ikey);
+		return tile;
+	}
+	
+	size_t sz = (size_t)rd->view.rows * rd->view.columns, png_size = 0;
+	unsigned char *png = NULL;
+	entry_t *iters = cache_acquire(ch, ikey, &is_new);
+	free(ikey);
+	if(iters && is_new){
+		double *vals = malloc(sizeof(double) * sz);
+		if(vals) render_iters(rd, vals);
+		cache_fill(ch, iters, vals, sizeof(double) * sz);
+		if(!vals){
+			cache_release(ch, iters);
+			iters = NULL;
+		}
+	}
+	
+	if(iters){
+		png_color *px = malloc(sizeof(png_color) * sz);
+		if(px){
+			render_colors(rd, iters->data, px);
+			render_antialias(rd, iters->data, px);
+			png = encode_png(px, rd->view.columns, rd->view.rows, &png_size);
+			free(px);
+		}
+		cache_release(ch, iters);
+	}
+	
+	cache_fill(ch, tile, png, png_size);
+	if(!png){
+		cache_release(ch, tile);
+		return NULL;
+	}
+	return tile;
+}
+
+
+
+// Write all of the bytes to the connection
+static bool send_all(int fd, const void *data, size_t size){
+	const char *pos = data;
+	ssize_t sent;
+	while(size > 0){
+		sent = send(fd, pos, size, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR) continue;
+		if(sent <= 0) return false;
+		pos += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+static void send_response(int fd, const char *status, const char *type, const void *body, size_t size){
+	char header[256];
+	int len = snprintf(header, sizeof(header),
+		"HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		status, type, size
+	);
+	if(send_all(fd, header, len)) send_all(fd, body, size);
+}
+
+static void send_error(int fd, const char *status){
+	send_response(fd, status, "text/plain", status, strlen(status));
+}
+
+// Read one request from the connection and reply to it
+static void handle_connection(server_state_t *st, int fd){
+	char req[REQUEST_LENGTH];
+	size_t len = 0;
+	ssize_t got;
+	
+	// Read until the end of the header
+	while(1){
+		got = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if(got < 0 && errno == EINTR) continue;
+		if(got <= 0) return;
+		len += got;
+		req[len] = '\0';
+		if(strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+		if(len == sizeof(req) - 1){
+			send_error(fd, "431 Request Header Fields Too Large");
+			return;
+		}
+	}
+	
+	// Request line: METHOD TARGET VERSION
+	char *target = strchr(req, ' ');
+	if(!target){
+		send_error(fd, "400 Bad Request");
+		return;
+	}
+	*target++ = '\0';
+	target[strcspn(target, " \r\n")] = '\0';
+	
+	if(strcmp(req, "GET") != 0){
+		send_error(fd, "405 Method Not Allowed");
+		return;
+	}
+	
+	char *query = strchr(target, '?');
+	if(query) *query++ = '\0';
+	if(strcmp(target, "/tile") != 0){
+		send_error(fd, "404 Not Found");
+		return;
+	}
+	
+	render_t rd;
+	if(!parse_query(st->sv, query ? query : "", &rd)){
+		send_error(fd, "400 Bad Request");
+		return;
+	}
+	
+	entry_t *tile = get_tile(&st->cache, &rd);
+	if(!tile){
+		send_error(fd, "500 Internal Server Error");
+		return;
+	}
+	send_response(fd, "200 OK", "image/png", tile->data, tile->size);
+	cache_release(&st->cache, tile);
+}
+
+static void *serve_worker(void *arg){
+	server_state_t *st = arg;
+	
+	// The pending connections of the listening socket form the queue of requests
+	int fd;
+	while(1){
+		fd = accept(st->sock, NULL, NULL);
+		if(fd < 0){
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			perror("accept");
+			break;
+		}
+		
+		handle_connection(st, fd);
+		close(fd);
+	}
+	
+	return NULL;
+}
+
+// Open socket listening on the address
+// Returns file descriptor of socket ; -1 if error
+static int open_listener(const char *address){
+	int sock;
+	if(strchr(address, '/')){
+		struct sockaddr_un addr = {.sun_family = AF_UNIX};
+		if(strlen(address) >= sizeof(addr.sun_path)){
+			fprintf(stderr, "Socket path is too long: \"%s\"\n", address);
+			return -1;
+		}
+		strcpy(addr.sun_path, address);
+		
+		// Replace socket left behind by a previous server
+		struct stat sb;
+		if(stat(address, &sb) == 0 && S_ISSOCK(sb.st_mode)) unlink(address);
+		
+		sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+			perror(address);
+			if(sock >= 0) close(sock);
+			return -1;
+		}
+	}else{
+		int port;
+		if(sscanf(address, " %i", &port) < 1 || port < 0 || port > 65535){
+			fprintf(stderr, "Invalid port: \"%s\"\n", address);
+			return -1;
+		}
+		
+		// Only accept connections from this machine
+		struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		
+		int reuse = 1;
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if(sock >= 0) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if(sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+			perror(address);
+			if(sock >= 0) close(sock);
+			return -1;
+		}
+	}
+	
+	if(listen(sock, 128) < 0){
+		perror("listen");
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+bool serve(const char *address, const server_t *sv){
+	server_state_t st = {sv, open_listener(address), {NULL, NULL, 0, sv->cache_bytes, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER}};
+	if(st.sock < 0) return false;
+	
+	int threads = sv->threads < 1 ? 1 : sv->threads;
+	pthread_t tids[threads];
+	int started;
+	for(started = 0; started < threads; started++){
+		if(pthread_create(tids + started, NULL, serve_worker, &st)) break;
+	}
+	if(started == 0){
+		fprintf(stderr, "Could not start worker threads\n");
+		close(st.sock);
+		return false;
+	}
+	
+	printf("Serving tiles on %s with %i workers\n", address, started);
+	fflush(stdout);
+	
+	// Workers only return if the socket fails
+	for(int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+	close(st.sock);
+	return false;
+}
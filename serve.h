@@ -0,0 +1,48 @@
+#ifndef _SERVE_H
+#define _SERVE_H
+
+#include <stdbool.h>
+
+#include "render.h"
+
+
+// Settings of the tile server
+typedef struct{
+	// Parameters of tiles whose request does not override them
+	render_t defaults;
+	
+	// Color schemes which can be requested by name
+	const color_scheme_t *schemes;
+	const char *const *scheme_names;
+	int scheme_count;
+	
+	// Number of worker threads rendering tiles
+	int threads;
+	// Number of bytes of tiles and iteration buffers to keep in the cache
+	size_t cache_bytes;
+} server_t;
+
+/* Serve PNG tiles over HTTP until the process is killed
+ * 
+ * Each worker thread accepts a connection, reads one request, and replies with the tile
+ * Rendered tiles and their iteration counts are kept in a cache shared by all workers,
+ * with the least recently used entries discarded once it grows past cache_bytes
+ * A tile that is already being rendered by another worker is waited on instead of rendered twice
+ * 
+ * Requests are of the form
+ *   GET /tile?x=REAL&y=IMAG&w=WIDTH&h=HEIGHT&cols=COLUMNS&rows=ROWS
+ * where (x, y) is the center and w by h is the size of the tile in the complex plane
+ * Other parameters override the defaults:
+ *   n=ITERATIONS  p=REAL[,IMAG]  r=RADIUS  j=REAL[,IMAG]  rule=mandel|burning-ship|tricorn
+ *   scheme=NAME  cont=0|1  aa=SAMPLES  de=PIXELS  prec=auto|float|double|dd  orbit=KIND[:PARAM]
+ * 
+ * Arguments:
+ *   const char *address : TCP port on localhost to listen on, or path of UNIX socket if it contains a '/'
+ *   const server_t *sv : settings of the server
+ * 
+ * Returns:
+ *   bool : false if the server could not be started
+ */
+bool serve(const char *address, const server_t *sv);
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <langinfo.h>
+
+#include "term.h"
+
+
+// Upper half block, whose foreground is the top pixel and background the bottom pixel
+#define GLYPH_HALF 0x2580
+// Braille patterns start at this code point with a bit for each dot
+#define GLYPH_BRAILLE 0x2800
+
+// Bit of the braille pattern for the dot at each row and column of the cell
+static const unsigned char braille_bits[4][2] = {{0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+
+
+term_t term_init(term_mode_t mode, term_color_t color){
+	term_t tm = {mode, color, 0, 0, NULL, NULL, 0, 0};
+	return tm;
+}
+
+void term_free(term_t *tm){
+	free(tm->cells);
+	free(tm->out);
+	tm->cells = NULL;
+	tm->out = NULL;
+	tm->rows = tm->columns = 0;
+	tm->size = tm->cap = 0;
+}
+
+void term_invalidate(term_t *tm){
+	free(tm->cells);
+	tm->cells = NULL;
+}
+
+void term_detect(int colors, term_mode_t *mode, term_color_t *color){
+	const char *ct = getenv("COLORTERM");
+	bool is_true = ct && (strcmp(ct, "truecolor") == 0 || strcmp(ct, "24bit") == 0);
+	*color = is_true ? TERM_COLOR_TRUE : TERM_COLOR_256;
+	
+	bool is_utf8 = strcmp(nl_langinfo(CODESET), "UTF-8") == 0;
+	*mode = is_utf8 && (is_true || colors >= 256) ? TERM_HALF : TERM_CELLS;
+}
+
+bool term_parse(const char *str, bool *is_auto, term_mode_t *mode, term_color_t *color){
+	const char *comma = strchr(str, ',');
+	size_t len = comma ? (size_t)(comma - str) : strlen(str);
+	
+	*is_auto = false;
+	if(len == 4 && strncmp(str, "auto", 4) == 0) *is_auto = true;
+	else if(len == 5 && strncmp(str, "cells", 5) == 0) *mode = TERM_CELLS;
+	else if(len == 4 && strncmp(str, "half", 4) == 0) *mode = TERM_HALF;
+	else if(len == 7 && strncmp(str, "braille", 7) == 0) *mode = TERM_BRAILLE;
+	else return false;
+	
+	if(!comma) return true;
+	if(*is_auto) return false;
+	if(strcmp(comma + 1, "256") == 0) *color = TERM_COLOR_256;
+	else if(strcmp(comma + 1, "true") == 0) *color = TERM_COLOR_TRUE;
+	else return false;
+	return true;
+}
+
+
+// Append formatted text to the output of the frame
+static void term_printf(term_t *tm, const char *fmt, ...){
+	va_list args;
+	int len;
+	while(1){
+		va_start(args, fmt);
+		len = vsnprintf(tm->out + tm->size, tm->cap - tm->size, fmt, args);
+		va_end(args);
+		if(len < 0) return;
+		if(tm->size + len < tm->cap) break;
+		
+		// Grow buffer and try again
+		size_t cap = tm->cap ? tm->cap * 2 : 1 << 16;
+		while(cap <= tm->size + len) cap *= 2;
+		char *out = realloc(tm->out, cap);
+		if(!out) return;
+		tm->out = out;
+		tm->cap = cap;
+	}
+	tm->size += len;
+}
+
+static void term_utf8(term_t *tm, unsigned int cp){
+	if(cp < 0x80) term_printf(tm, "%c", cp);
+	else if(cp < 0x800) term_printf(tm, "%c%c", 0xc0 | cp >> 6, 0x80 | (cp & 0x3f));
+	else term_printf(tm, "%c%c%c", 0xe0 | cp >> 12, 0x80 | (cp >> 6 & 0x3f), 0x80 | (cp & 0x3f));
+}
+
+// Index of the closest color in the 6x6x6 cube or grey ramp of the xterm palette
+static int palette_index(png_color cl){
+	static const int levels[6] = {0, 95, 135, 175, 215, 255};
+	int r = cl.red < 48 ? 0 : cl.red < 115 ? 1 : (cl.red - 35) / 40;
+	int g = cl.green < 48 ? 0 : cl.green < 115 ? 1 : (cl.green - 35) / 40;
+	int b = cl.blue < 48 ? 0 : cl.blue < 115 ? 1 : (cl.blue - 35) / 40;
+	int cube = 16 + 36 * r + 6 * g + b;
+	
+	// Compare against the closest grey
+	int avg = (cl.red + cl.green + cl.blue) / 3;
+	int grey = avg > 238 ? 23 : avg < 8 ? 0 : (avg - 8) / 10;
+	int gv = 8 + 10 * grey;
+	
+	int dc = (cl.red - levels[r]) * (cl.red - levels[r]) + (cl.green - levels[g]) * (cl.green - levels[g]) + (cl.blue - levels[b]) * (cl.blue - levels[b]);
+	int dg = (cl.red - gv) * (cl.red - gv) + (cl.green - gv) * (cl.green - gv) + (cl.blue - gv) * (cl.blue - gv);
+	return dg < dc ? 232 + grey : cube;
+}
+
+// Reduce color to what will actually be shown so that changes which are not visible are not sent
+static png_color term_quantize(const term_t *tm, png_color cl){
+	static const unsigned char levels[6] = {0, 95, 135, 175, 215, 255};
+	if(tm->color == TERM_COLOR_TRUE) return cl;
+	
+	int idx = palette_index(cl);
+	if(idx >= 232){
+		unsigned char v = 8 + 10 * (idx - 232);
+		return (png_color){v, v, v};
+	}
+	idx -= 16;
+	return (png_color){levels[idx / 36], levels[idx / 6 % 6], levels[idx % 6]};
+}
+
+static void term_sgr(term_t *tm, int layer, png_color cl){
+	if(tm->color == TERM_COLOR_TRUE) term_printf(tm, "\x1b[%i;2;%i;%i;%im", layer, cl.red, cl.green, cl.blue);
+	else term_printf(tm, "\x1b[%i;5;%im", layer, palette_index(cl));
+}
+
+static bool same_color(png_color a, png_color b){
+	return a.red == b.red && a.green == b.green && a.blue == b.blue;
+}
+
+static png_color average(const png_color *cls, int count){
+	int r = 0, g = 0, b = 0;
+	for(int i = 0; i < count; i++){
+		r += cls[i].red;
+		g += cls[i].green;
+		b += cls[i].blue;
+	}
+	return (png_color){(r + count / 2) / count, (g + count / 2) / count, (b + count / 2) / count};
+}
+
+// Build the cell showing the pixels of the cell at row r and column c
+static term_cell_t term_cell(const term_t *tm, const png_color *px, int columns, int r, int c){
+	term_cell_t cell;
+	int width = columns * term_sub_cols(tm->mode);
+	
+	if(tm->mode == TERM_HALF){
+		cell.fg = term_quantize(tm, px[(size_t)2 * r * width + c]);
+		cell.bg = term_quantize(tm, px[(size_t)(2 * r + 1) * width + c]);
+		cell.glyph = GLYPH_HALF;
+	}else{
+		// Split the dots into the brighter and darker halves of the cell
+		png_color sub[8], on[8], off[8];
+		int lum[8], mean = 0, i, non = 0, noff = 0;
+		for(i = 0; i < 8; i++){
+			sub[i] = px[(size_t)(4 * r + i / 2) * width + 2 * c + i % 2];
+			lum[i] = 2 * sub[i].red + 5 * sub[i].green + sub[i].blue;
+			mean += lum[i];
+		}
+		
+		cell.glyph = GLYPH_BRAILLE;
+		for(i = 0; i < 8; i++){
+			if(8 * lum[i] > mean){
+				on[non++] = sub[i];
+				cell.glyph |= braille_bits[i / 2][i % 2];
+			}else off[noff++] = sub[i];
+		}
+		
+		cell.fg = term_quantize(tm, non ? average(on, non) : average(off, noff));
+		cell.bg = term_quantize(tm, noff ? average(off, noff) : average(on, non));
+	}
+	
+	// A cell of a single color is drawn as a space so its foreground does not matter
+	if(same_color(cell.fg, cell.bg)){
+		cell.glyph = ' ';
+		cell.fg = cell.bg;
+	}
+	return cell;
+}
+
+void term_draw(term_t *tm, const png_color *px, int rows, int columns, int cur_row, int cur_col){
+	if(tm->mode == TERM_CELLS || rows < 1 || columns < 1) return;
+	
+	// Anything on the screen is unknown after a change of size
+	if(rows != tm->rows || columns != tm->columns || !tm->cells){
+		free(tm->cells);
+		tm->cells = malloc(sizeof(term_cell_t) * rows * columns);
+		if(!tm->cells) return;
+		tm->rows = rows;
+		tm->columns = columns;
+		for(int i = 0; i < rows * columns; i++) tm->cells[i].glyph = 0;
+	}
+	
+	tm->size = 0;
+	term_cell_t cell, *old;
+	png_color fg = {0}, bg = {0};
+	bool has_fg = false, has_bg = false;
+	int next_r = -1, next_c = -1;
+	for(int r = 0; r < rows; r++) for(int c = 0; c < columns; c++){
+		cell = term_cell(tm, px, columns, r, c);
+		old = tm->cells + r * columns + c;
+		if(old->glyph == cell.glyph && same_color(old->fg, cell.fg) && same_color(old->bg, cell.bg)) continue;
+		*old = cell;
+		
+		// Only move the cursor when the cell doesn't follow the last one written
+		if(r != next_r || c != next_c) term_printf(tm, "\x1b[%i;%iH", r + 1, c + 1);
+		if(!has_bg || !same_color(bg, cell.bg)){
+			term_sgr(tm, 48, bg = cell.bg);
+			has_bg = true;
+		}
+		// Spaces only show the background so keep whatever foreground is set
+		if(cell.glyph != ' ' && (!has_fg || !same_color(fg, cell.fg))){
+			term_sgr(tm, 38, fg = cell.fg);
+			has_fg = true;
+		}
+		
+		term_utf8(tm, cell.glyph);
+		next_r = r;
+		next_c = c + 1;
+	}
+	if(tm->size == 0) return;
+	
+	// Leave the attributes and cursor as ncurses expects them
+	term_printf(tm, "\x1b[0m\x1b[%i;%iH", cur_row + 1, cur_col + 1);
+	
+	fflush(stdout);
+	for(size_t sent = 0; sent < tm->size;){
+		ssize_t len = write(STDOUT_FILENO, tm->out + sent, tm->size - sent);
+		if(len <= 0) break;
+		sent += len;
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef _TERM_H
+#define _TERM_H
+
+#include <stdbool.h>
+
+#include <png.h>
+
+
+// How pixels are packed into the cells of the terminal
+typedef enum{
+	TERM_CELLS,  // One pixel per cell drawn with the color pairs of ncurses
+	TERM_HALF,  // Two pixels stacked in each cell using the upper half block
+	TERM_BRAILLE  // Two by four pixels in each cell using braille dots in two colors
+} term_mode_t;
+
+// Colors sent to the terminal
+typedef enum{
+	TERM_COLOR_256,  // xterm 256 color palette
+	TERM_COLOR_TRUE  // 24-bit color
+} term_color_t;
+
+// Number of pixels in each cell of the terminal for the mode
+#define term_sub_rows(mode) ((mode) == TERM_BRAILLE ? 4 : (mode) == TERM_HALF ? 2 : 1)
+#define term_sub_cols(mode) ((mode) == TERM_BRAILLE ? 2 : 1)
+
+// Contents of a single cell as last sent to the terminal
+typedef struct{
+	unsigned int glyph;  // Unicode code point
+	png_color fg, bg;
+} term_cell_t;
+
+// Screen drawn directly to the terminal outside of ncurses
+typedef struct{
+	term_mode_t mode;
+	term_color_t color;
+	
+	// Cells last sent to the terminal, NULL until the first frame
+	int rows, columns;
+	term_cell_t *cells;
+	
+	// Buffer that the output of each frame is collected into before being written at once
+	char *out;
+	size_t size, cap;
+} term_t;
+
+// Create screen for the mode and colors
+term_t term_init(term_mode_t mode, term_color_t color);
+// Deallocate memory for screen
+void term_free(term_t *tm);
+// Forget what was last sent so the next frame is drawn in full, such as after the terminal is cleared
+void term_invalidate(term_t *tm);
+
+/* Choose the mode and colors for the terminal from the environment
+ * Truecolor is used if COLORTERM is "truecolor" or "24bit", otherwise the 256 color palette
+ * Half blocks are used if the locale uses UTF-8 and the terminal has at least 256 colors, otherwise cells
+ * 
+ * Arguments:
+ *   int colors : number of colors supported by the terminal according to ncurses
+ * 
+ * Returns:
+ *   term_mode_t *mode : the chosen mode
+ *   term_color_t *color : the chosen colors
+ */
+void term_detect(int colors, term_mode_t *mode, term_color_t *color);
+
+// Parse mode and colors given as MODE[,COLORS] where MODE is auto, cells, half, or braille and COLORS is 256 or true
+// Returns true if successful ; false if invalid
+bool term_parse(const char *str, bool *is_auto, term_mode_t *mode, term_color_t *color);
+
+/* Draw image into the top rows of the terminal, only sending the cells which changed since the last frame
+ * 
+ * Arguments:
+ *   term_t *tm : screen to draw to
+ *   const png_color *px : image of rows * term_sub_rows by columns * term_sub_cols pixels in row-major order
+ *   int rows, columns : number of cells to draw
+ *   int cur_row, cur_col : position to leave the cursor at, where ncurses expects it to be
+ */
+void term_draw(term_t *tm, const png_color *px, int rows, int columns, int cur_row, int cur_col);
+
+#endif